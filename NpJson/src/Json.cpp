@@ -1,12 +1,27 @@
 #include "Json.h"
+#include "JsonCodec.h"
+#include <algorithm>
 #include <cctype>
+#include <cerrno>
+#include <cstdarg>
 #include <cstring>
 #include <cstdlib>
-#include <fstream>
-#include <libgen.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits>
+#include <pthread.h>
+#include <set>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
 
 const size_t MAX_STRING_DISPLAY_SIZE = 1024;
+const size_t DEFAULT_MAX_DEPTH = 1024;
+const size_t INDEXED_OBJECT_SIZE = 8; // smaller objects are searched linearly
+const size_t MIN_OBJECT_CAPACITY = 4;
+
+static size_t s_maxDepth = DEFAULT_MAX_DEPTH;
+static bool s_utf8Validation = true;
 
 static const char NULL_TEXT[] = "null";
 static const char TRUE_TEXT[] = "true";
@@ -18,6 +33,26 @@ const Json& Json::Null()
 	return nullJson;
 }
 
+static const Json& s_null = Json::Null(); // constructed before any reader thread can race on it
+
+#ifdef NPJSON_STATS
+extern __thread Json::Stats g_jsonStats; // see JsonStats.cpp
+#define COUNT_STAT(field) (++g_jsonStats.field)
+#else
+#define COUNT_STAT(field) ((void)0)
+#endif
+
+inline Json::Node::Node(JsonType t, const std::string& s):
+	refs(1), persistent(false), exposed(false), type(t), text(s)
+{
+	COUNT_STAT(nodesCreated);
+}
+
+inline Json::Node::~Node()
+{
+	COUNT_STAT(nodesDestroyed);
+}
+
 static inline std::string InitJsonText(Json::JsonType type, const std::string& text)
 {
 	if (type == Json::TYPE_NULL) {
@@ -32,250 +67,685 @@ static inline std::string InitJsonText(Json::JsonType type, const std::string& t
 }
 
 Json::Json(Json::JsonType type, const std::string& text):
-	type_(type), text_(InitJsonText(type, text))
+	node_(type == TYPE_NULL ? NULL : new Node(type, InitJsonText(type, text)))
 {
 }
 
 Json::Json(bool v, Json::JsonType type):
-	type_(type), text_(v ? TRUE_TEXT : FALSE_TEXT)
+	node_(new Node(type, v ? TRUE_TEXT : FALSE_TEXT))
 {
 }
 
 Json::Json(int8_t v, Json::JsonType type):
-	type_(type), text_(ToString(v))
+	node_(new Node(type, ToString(v)))
 {
 }
 
 Json::Json(int16_t v, Json::JsonType type):
-	type_(type), text_(ToString(v))
+	node_(new Node(type, ToString(v)))
 {
 }
 
 Json::Json(int32_t v, Json::JsonType type):
-	type_(type), text_(ToString(v))
+	node_(new Node(type, ToString(v)))
 {
 }
 
 Json::Json(int64_t v, Json::JsonType type):
-	type_(type), text_(ToString(v))
+	node_(new Node(type, ToString(v)))
 {
 }
 
 Json::Json(uint8_t v, Json::JsonType type):
-	type_(type), text_(ToString(v))
+	node_(new Node(type, ToString(v)))
 {
 }
 
 Json::Json(uint16_t v, Json::JsonType type):
-	type_(type), text_(ToString(v))
+	node_(new Node(type, ToString(v)))
 {
 }
 
 Json::Json(uint32_t v, Json::JsonType type):
-	type_(type), text_(ToString(v))
+	node_(new Node(type, ToString(v)))
 {
 }
 
 Json::Json(uint64_t v, Json::JsonType type):
-	type_(type), text_(ToString(v))
+	node_(new Node(type, ToString(v)))
 {
 }
 
 Json::Json(float v, Json::JsonType type):
-	type_(type), text_(ToString(v))
+	node_(new Node(type, ToString(v)))
 {
 }
 
 Json::Json(double v, Json::JsonType type):
-	type_(type), text_(ToString(v))
+	node_(new Node(type, ToString(v)))
 {
 }
 
 Json::Json(const char* v, Json::JsonType type):
-	type_(type), text_(v)
+	node_(new Node(type, v))
 {
 }
 
 Json::Json(const std::string& v, Json::JsonType type):
-	type_(type), text_(v)
+	node_(new Node(type, v))
+{
+}
+
+Json::Json(const Json& j): node_(Copy(j.node_, false))
+{
+}
+
+Json::~Json()
+{
+	Release(node_);
+}
+
+Json::Node* Json::Copy(Json::Node* node, bool persistent)
+{
+	if (node == NULL) {
+		return NULL;
+	} else if (node->persistent && !node->exposed) { // share it instead of copying
+		__atomic_add_fetch(&node->refs, 1, __ATOMIC_RELAXED);
+		return node;
+	} else {
+		return Duplicate(node, persistent);
+	}
+}
+
+Json::Node* Json::Duplicate(const Json::Node* node, bool persistent)
+{
+	Json copy; // to release the partial copy if anything throws
+	copy.node_ = new Node(node->type, node->text);
+	copy.node_->persistent = (persistent || node->persistent);
+	COUNT_STAT(nodesCopied);
+	COUNT_STAT(stringCopies);
+	std::vector<std::pair<const Node*, Node*> > pending;
+	if (!node->array.empty()) {
+		pending.push_back(std::make_pair(node, copy.node_));
+	}
+	while (!pending.empty()) { // depth first, every new node is linked into the copy at once
+		const Node* from = pending.back().first;
+		Node* to = pending.back().second;
+		pending.pop_back();
+		std::vector<Json>& array = to->array;
+		array.resize(from->array.size());
+		for (size_t i = 0; i < array.size(); ++i) {
+			CopyTo(from->array[i].node_, array[i], to->persistent, pending);
+		}
+		std::vector<Json>& object = to->object;
+		object.resize(from->object.size());
+		for (size_t i = 0; i < object.size(); ++i) {
+			CopyTo(from->object[i].node_, object[i], to->persistent, pending);
+		}
+		to->index = from->index;
+	}
+
+	Node* res = copy.node_;
+	copy.node_ = NULL;
+	return res;
+}
+
+void Json::CopyTo(Json::Node* node, Json& j, bool persistent, std::vector<std::pair<const Node*, Node*> >& pending)
+{
+	if (node == NULL) {
+		return;
+	} else if (node->persistent && !node->exposed) { // share it instead of copying
+		__atomic_add_fetch(&node->refs, 1, __ATOMIC_RELAXED);
+		j.node_ = node;
+	} else {
+		j.node_ = new Node(node->type, node->text);
+		j.node_->persistent = (persistent || node->persistent);
+		COUNT_STAT(nodesCopied);
+		COUNT_STAT(stringCopies);
+		if (!node->array.empty()) { // children are copied later
+			pending.push_back(std::make_pair(node, j.node_));
+		}
+	}
+}
+
+bool Json::Shared(const Json::Node* node)
+{
+	return (node->persistent && __atomic_load_n(&node->refs, __ATOMIC_ACQUIRE) > 1);
+}
+
+static inline bool Unreferenced(long& refs, bool persistent)
+{
+	return (!persistent || __atomic_sub_fetch(&refs, 1, __ATOMIC_ACQ_REL) == 0);
+}
+
+void Json::Release(Json::Node* node)
+{
+	if (node == NULL || !Unreferenced(node->refs, node->persistent)) {
+		return;
+	} else if (node->array.empty()) {
+		delete node;
+		return;
+	}
+
+	// children are detached and released here instead of by recursive destructors
+	std::vector<Node*> pending(1, node);
+	while (!pending.empty()) {
+		node = pending.back();
+		pending.pop_back();
+		for (size_t i = 0; i < node->array.size(); ++i) {
+			ReleaseLater(node->array[i].node_, pending);
+		}
+		for (size_t i = 0; i < node->object.size(); ++i) {
+			ReleaseLater(node->object[i].node_, pending);
+		}
+		delete node;
+	}
+}
+
+void Json::ReleaseLater(Json::Node*& node, std::vector<Node*>& pending)
+{
+	if (node != NULL && Unreferenced(node->refs, node->persistent)) {
+		if (node->array.empty()) {
+			delete node;
+		} else {
+			pending.push_back(node);
+		}
+	}
+	node = NULL;
+}
+
+Json::Node* Json::Mutable()
+{
+	if (node_ == NULL) {
+		node_ = new Node(TYPE_NULL, NULL_TEXT);
+	} else if (Shared(node_)) { // copy on write, children are still shared
+		Node* node = Duplicate(node_, true);
+		Release(node_);
+		node_ = node;
+	}
+	return node_;
+}
+
+Json::Node* Json::Expose()
+{
+	Node* node = Mutable();
+	node->exposed = true; // the caller may keep a reference, so stop sharing it
+	return node;
+}
+
+Json& Json::Child(Json::Node* parent, Json& sub)
+{
+	if (parent->persistent && sub.node_ == NULL) { // new values inherit persistence
+		sub.node_ = new Node(TYPE_NULL, NULL_TEXT);
+		sub.node_->persistent = true;
+	}
+	return sub;
+}
+
+/*
+ * A std::vector<Json> copies its elements when it grows or shifts them, which
+ * means deep copies before C++11, so room is made by swapping handles instead.
+ */
+static void Reserve(std::vector<Json>& array, size_t size)
+{
+	if (size > array.capacity()) {
+		std::vector<Json> grown;
+		grown.reserve(std::max(size, array.capacity() * 2));
+		grown.resize(array.size());
+		for (size_t i = 0; i < array.size(); ++i) {
+			grown[i].Swap(array[i]);
+		}
+		array.swap(grown);
+	}
+}
+
+static Json& InsertAt(std::vector<Json>& array, size_t before)
 {
+	Reserve(array, array.size() + 1);
+	array.push_back(Json());
+	for (size_t i = array.size() - 1; i > before && i > 0; --i) {
+		array[i].Swap(array[i - 1]);
+	}
+	return array[std::min(before, array.size() - 1)];
 }
 
-Json::Json(const Json& j): type_(j.type_),
-		text_(j.text_), array_(j.array_), object_(j.object_)
+static void RemoveAt(std::vector<Json>& array, size_t pos)
 {
+	for (size_t i = pos; i + 1 < array.size(); ++i) {
+		array[i].Swap(array[i + 1]);
+	}
+	array.pop_back();
 }
 
 bool Json::EqualTo(const Json& j) const
 {
-	if (type_ != j.type_) {
+	std::vector<std::pair<const Json*, const Json*> > pending;
+	if (!EqualShallow(*this, j, pending)) {
 		return false;
 	}
-	if (type_ == TYPE_ARRAY) {
-		if (Size() != j.Size()) {
+	while (!pending.empty()) {
+		std::pair<const Json*, const Json*> items = pending.back();
+		pending.pop_back();
+		if (!EqualShallow(*items.first, *items.second, pending)) {
 			return false;
 		}
-		for (size_t i = 0; i < Size(); ++i) {
-			if (Sub(i) != j.Sub(i)) {
-				return false;
-			}
-		}
-	} else if (type_ == TYPE_OBJECT) {
-		const std::vector<std::string> keys = Keys();
-		if (keys != j.Keys()) {
+	}
+	return true;
+}
+
+bool Json::EqualShallow(const Json& a, const Json& b, std::vector<std::pair<const Json*, const Json*> >& pending)
+{
+	if (a.node_ == b.node_) {
+		return true;
+	}
+	JsonType type = a.Type();
+	if (type != b.Type()) {
+		return false;
+	}
+	if (type == TYPE_ARRAY || type == TYPE_OBJECT) {
+		const std::vector<Json>& x = a.node_->array;
+		const std::vector<Json>& y = b.node_->array;
+		if (x.size() != y.size()) {
 			return false;
 		}
-		for (size_t i = 0; i < keys.size(); ++i) {
-			if (Sub(keys[i]) != j.Sub(keys[i])) {
+		for (size_t i = 0; i < x.size(); ++i) { // children are compared later
+			if (type == TYPE_ARRAY) {
+				pending.push_back(std::make_pair(&x[i], &y[i]));
+			} else if (x[i].node_ != y[i].node_ && x[i].node_->text != y[i].node_->text) {
 				return false;
+			} else {
+				pending.push_back(std::make_pair(&a.node_->object[i], &b.node_->object[i]));
 			}
 		}
-	} else if (type_ != TYPE_NULL) {
-		return text_ == j.text_;
+	} else if (type != TYPE_NULL) {
+		return a.node_->text == b.node_->text;
 	}
 	return true;
 }
 
 Json& Json::Sub(size_t index)
 {
-	if (type_ != TYPE_ARRAY) {
+	if (Type() != TYPE_ARRAY) {
 		Clear(TYPE_ARRAY);
 	}
-	if (index >= array_.size()) {
-		array_.resize(index + 1);
+	Node* node = Expose();
+	if (index >= node->array.size()) {
+		Reserve(node->array, index + 1);
+		node->array.resize(index + 1);
 	}
-	return array_[index];
+	return Child(node, node->array[index]);
 }
 
 Json& Json::Sub(const std::string& name)
 {
-	if (type_ != TYPE_OBJECT) {
+	return Sub(name, NULL);
+}
+
+Json& Json::Sub(const JsonKey& key)
+{
+	return Sub(key.Name(), &key);
+}
+
+Json& Json::Sub(const std::string& name, const JsonKey* key)
+{
+	if (Type() != TYPE_OBJECT) {
 		Clear(TYPE_OBJECT);
 	}
-	for (size_t i = 0; i < array_.size(); ++i) {
-		if (array_[i].AsString() == name) {
-			return object_[name];
-		}
+	Node* node = Expose();
+	size_t pos = (key != NULL ? FindKey(node, name, key->key_->node_, &key->hash_) : FindKey(node, name, NULL, NULL));
+	if (pos != std::string::npos) {
+		return Child(node, node->object[pos]);
+	}
+	Json added;
+	if (key != NULL) {
+		added = *key->key_;
+	} else {
+		InternKey(name, HashKey(name), added);
 	}
-	Json o;
-	o = name;
-	array_.push_back(o);
-	return object_[name];
+	return Child(node, AddKey(node, added));
 }
 
 const Json& Json::Sub(size_t index) const
 {
-	if (type_ == TYPE_ARRAY && index < array_.size()) {
-		return array_[index];
+	if (Type() == TYPE_ARRAY && index < node_->array.size()) {
+		return node_->array[index];
 	}
 	return Null();
 }
 
 const Json& Json::Sub(const std::string& name) const
 {
-	if (type_ == TYPE_OBJECT) {
-		std::map<std::string, Json>::const_iterator it = object_.find(name);
-		if (it != object_.end()) {
-			return it->second;
+	return Sub(name, NULL);
+}
+
+const Json& Json::Sub(const JsonKey& key) const
+{
+	return Sub(key.Name(), &key);
+}
+
+const Json& Json::Sub(const std::string& name, const JsonKey* key) const
+{
+	if (Type() == TYPE_OBJECT) {
+		size_t pos = (key != NULL ? FindKey(node_, name, key->key_->node_, &key->hash_) : FindKey(node_, name, NULL, NULL));
+		if (pos != std::string::npos) {
+			return node_->object[pos];
 		}
 	}
 	return Null();
 }
 
+uint32_t Json::HashKey(const std::string& name)
+{
+	uint32_t hash = 2166136261u; // FNV-1a
+	for (size_t i = 0; i < name.size(); ++i) {
+		hash = (hash ^ static_cast<unsigned char>(name[i])) * 16777619u;
+	}
+	return hash;
+}
+
+/*
+ * The keys of an object are found by a linear search while it is small, and by
+ * an open addressing hash index of their positions when it grows bigger. Keys
+ * are mostly interned, so the node of the name (if known) is compared first.
+ */
+size_t Json::FindKey(const Json::Node* node, const std::string& name, const Json::Node* shared, const uint32_t* hash)
+{
+	const std::vector<Json>& keys = node->array;
+	const std::vector<uint32_t>& index = node->index;
+	if (index.empty()) {
+		for (size_t i = 0; i < keys.size(); ++i) {
+			if (keys[i].node_ == shared || keys[i].node_->text == name) {
+				return i;
+			}
+		}
+		return std::string::npos;
+	}
+	size_t mask = index.size() - 1;
+	for (size_t slot = (hash != NULL ? *hash : HashKey(name)) & mask; index[slot] != 0; slot = (slot + 1) & mask) {
+		const Node* k = keys[index[slot] - 1].node_;
+		if (k == shared || k->text == name) {
+			return index[slot] - 1;
+		}
+	}
+	return std::string::npos;
+}
+
+Json& Json::AddKey(Json::Node* node, Json& key)
+{
+	if (node->array.empty()) { // most objects have a few keys, skip the smallest steps of growth
+		node->array.reserve(MIN_OBJECT_CAPACITY);
+		node->object.reserve(MIN_OBJECT_CAPACITY);
+	}
+	InsertAt(node->array, node->array.size()).Swap(key);
+	Json& value = InsertAt(node->object, node->object.size());
+	size_t size = node->array.size();
+	if (size < INDEXED_OBJECT_SIZE) {
+		return value;
+	} else if (size * 2 > node->index.size()) { // at most half full
+		IndexKeys(node);
+		return value;
+	}
+	size_t mask = node->index.size() - 1;
+	size_t slot = HashKey(node->array.back().node_->text) & mask;
+	while (node->index[slot] != 0) {
+		slot = (slot + 1) & mask;
+	}
+	node->index[slot] = static_cast<uint32_t>(size);
+	return value;
+}
+
+void Json::IndexKeys(Json::Node* node)
+{
+	std::vector<uint32_t>& index = node->index;
+	const std::vector<Json>& keys = node->array;
+	if (keys.size() < INDEXED_OBJECT_SIZE) {
+		std::vector<uint32_t>().swap(index);
+		return;
+	}
+	size_t capacity = INDEXED_OBJECT_SIZE * 2;
+	while (capacity < keys.size() * 4) {
+		capacity *= 2;
+	}
+	index.assign(capacity, 0);
+	for (size_t i = 0; i < keys.size(); ++i) {
+		size_t slot = HashKey(keys[i].node_->text) & (capacity - 1);
+		while (index[slot] != 0) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+		index[slot] = static_cast<uint32_t>(i + 1);
+	}
+}
+
+static pthread_mutex_t s_keysMutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, Json>* s_keys = NULL; // never freed, a JsonKey may be used by any static destructor
+static uint64_t s_keyFilter[64]; // a bit by the hash of each registered name, set atomically
+
+const Json* Json::RegisterKey(const std::string& name)
+{
+	pthread_mutex_lock(&s_keysMutex);
+	if (s_keys == NULL) {
+		s_keys = new std::map<std::string, Json>();
+	}
+	std::map<std::string, Json>::iterator it = s_keys->find(name);
+	if (it == s_keys->end()) {
+		it = s_keys->insert(std::make_pair(name, Json(name))).first;
+		it->second.node_->persistent = true;
+		uint32_t bit = HashKey(name) % (sizeof(s_keyFilter) * 8);
+		__atomic_or_fetch(&s_keyFilter[bit / 64], static_cast<uint64_t>(1) << (bit % 64), __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&s_keysMutex);
+	return &it->second;
+}
+
+const Json* Json::RegisteredKey(const std::string& name, uint32_t hash)
+{
+	uint32_t bit = hash % (sizeof(s_keyFilter) * 8);
+	if ((__atomic_load_n(&s_keyFilter[bit / 64], __ATOMIC_ACQUIRE) & (static_cast<uint64_t>(1) << (bit % 64))) == 0) {
+		return NULL; // surely not registered, no need to lock
+	}
+	pthread_mutex_lock(&s_keysMutex);
+	std::map<std::string, Json>::const_iterator it = s_keys->find(name);
+	const Json* key = (it == s_keys->end() ? NULL : &it->second);
+	pthread_mutex_unlock(&s_keysMutex);
+	return key;
+}
+
+/*
+ * Object keys are interned: each thread keeps the key nodes it has added lately
+ * in a small direct mapped cache, so the records of a document, or of a stream
+ * of documents, share their key nodes instead of allocating the same names over
+ * and over again. A name registered by a JsonKey is shared with it.
+ */
+const size_t KEY_CACHE_SIZE = 256; // a power of 2
+
+struct KeyCache
+{
+	uint32_t hashes[KEY_CACHE_SIZE];
+	Json keys[KEY_CACHE_SIZE];
+};
+
+static pthread_key_t s_keyCacheKey;
+static pthread_once_t s_keyCacheOnce = PTHREAD_ONCE_INIT;
+static __thread KeyCache* t_keyCache = NULL;
+
+static void FreeKeyCache(void* cache) // on the exiting thread
+{
+	t_keyCache = NULL; // a key interned later by another destructor makes a new cache, freed in the next round
+	delete static_cast<KeyCache*>(cache);
+}
+
+static void CreateKeyCacheKey()
+{
+	pthread_key_create(&s_keyCacheKey, FreeKeyCache);
+}
+
+void Json::InternKey(const std::string& name, uint32_t hash, Json& key)
+{
+	KeyCache* cache = t_keyCache;
+	if (cache == NULL) {
+		pthread_once(&s_keyCacheOnce, CreateKeyCacheKey);
+		cache = new KeyCache();
+		pthread_setspecific(s_keyCacheKey, cache); // freed when the thread exits
+		t_keyCache = cache;
+	}
+	size_t slot = hash & (KEY_CACHE_SIZE - 1);
+	Json& cached = cache->keys[slot];
+	if (cached.node_ != NULL && cache->hashes[slot] == hash && cached.node_->text == name) {
+		key = cached; // persistent, so shared
+		return;
+	}
+	const Json* registered = RegisteredKey(name, hash);
+	if (registered != NULL) {
+		cached = *registered;
+	} else {
+		Json added(name);
+		added.node_->persistent = true;
+		cached.Swap(added);
+	}
+	cache->hashes[slot] = hash;
+	key = cached;
+}
+
+JsonKey::JsonKey(const std::string& name): key_(Json::RegisterKey(name)), hash_(Json::HashKey(name))
+{
+}
+
+const std::string& JsonKey::Name() const
+{
+	return key_->node_->text;
+}
+
 void Json::Clone(const Json& j)
 {
-	Json copy(j); // considering j may be *this or part of *this
-	type_ = copy.type_;
-	text_ = copy.text_;
-	array_ = copy.array_;
-	object_ = copy.object_;
+	Json copy; // considering j may be *this or part of *this
+	copy.node_ = Copy(j.node_, node_ != NULL && node_->persistent);
+	Swap(copy);
+}
+
+void Json::Swap(Json& j)
+{
+	std::swap(node_, j.node_);
 }
 
 void Json::Clear(Json::JsonType type, const std::string& text)
 {
-	type_ = type;
-	text_ = InitJsonText(type, text);
-	array_.clear();
-	object_.clear();
+	std::string value = InitJsonText(type, text); // text may be part of *this
+	if (node_ == NULL && type == TYPE_NULL) {
+		return;
+	}
+	if (node_ == NULL || Shared(node_)) { // never touch a shared node
+		Node* node = new Node(type, "");
+		node->persistent = (node_ != NULL && node_->persistent);
+		Release(node_);
+		node_ = node;
+	} else {
+		node_->type = type;
+		node_->array.clear();
+		node_->object.clear();
+		node_->index.clear();
+		node_->exposed = false;
+	}
+	node_->text.swap(value);
 }
 
 void Json::Insert(const Json& value, size_t before)
 {
-	Json copy(value); // consider value may be *this or part of *this
-	if (type_ != TYPE_ARRAY) {
+	Json copy; // consider value may be *this or part of *this
+	copy.node_ = Copy(value.node_, node_ != NULL && node_->persistent);
+	if (Type() != TYPE_ARRAY) {
 		Clear(TYPE_ARRAY);
 	}
-	if (before >= array_.size()) {
-		array_.push_back(copy);
-	} else {
-		array_.insert(array_.begin() + before, copy);
-	}
+	InsertAt(Mutable()->array, before).Swap(copy);
 }
 
 void Json::Insert(const std::string& key, const Json& value, size_t before)
 {
-	Json copy(value); // consider value may be *this or part of *this
-	if (type_ != TYPE_OBJECT) {
+	Json copy; // consider value may be *this or part of *this
+	copy.node_ = Copy(value.node_, node_ != NULL && node_->persistent);
+	if (Type() != TYPE_OBJECT) {
 		Clear(TYPE_OBJECT);
 	}
-	if (!Has(key)) {
-		if (before < array_.size()) {
-			array_.insert(array_.begin() + before, Json(key));
-		} else {
-			array_.push_back(Json(key));
+	Node* node = Mutable();
+	uint32_t hash = HashKey(key);
+	size_t pos = FindKey(node, key, NULL, &hash);
+	if (pos == std::string::npos) {
+		Json name;
+		InternKey(key, hash, name);
+		AddKey(node, name);
+		pos = node->array.size() - 1;
+		if (before < pos) {
+			Move(pos, before);
+			pos = before;
 		}
 	}
-	object_[key] = copy;
+	node->object[pos].Swap(copy);
 }
 
 void Json::Move(size_t index, size_t before)
 {
-	if (index < array_.size()) {
-		if (before < array_.size()) {
-			if (index < before) {
-				array_.insert(array_.begin() + before, array_[index]);
-				array_.erase(array_.begin() + index);
-			} else if (index > before) {
-				array_.insert(array_.begin() + before, array_[index]);
-				array_.erase(array_.begin() + index + 1);
-			}
-		} else {
-			array_.insert(array_.end(), array_[index]);
-			array_.erase(array_.begin() + index);
-		}
+	if (node_ == NULL || index >= node_->array.size()) {
+		return;
+	}
+	Node* node = Mutable();
+	std::vector<Json>& array = node->array;
+	std::vector<Json>& object = node->object; // the values of the keys of an object move with them
+	size_t to = before;
+	if (before >= array.size()) {
+		to = array.size() - 1;
+	} else if (index < before) {
+		to = before - 1;
+	}
+	for (; index < to; ++index) {
+		array[index].Swap(array[index + 1]);
+		if (!object.empty()) object[index].Swap(object[index + 1]);
+	}
+	for (; index > to; --index) {
+		array[index].Swap(array[index - 1]);
+		if (!object.empty()) object[index].Swap(object[index - 1]);
+	}
+	if (!node->index.empty()) {
+		IndexKeys(node);
 	}
 }
 
 void Json::Move(const std::string& key, size_t before)
 {
-	for (size_t i = 0; i < array_.size(); ++i) {
-		if (array_[i].AsString() == key) {
-			Move(i, before);
-			return;
+	if (Type() == TYPE_OBJECT) {
+		size_t pos = FindKey(node_, key, NULL, NULL);
+		if (pos != std::string::npos) {
+			Move(pos, before);
 		}
 	}
 }
 
 void Json::Erase(size_t pos)
 {
-	if (type_ == TYPE_ARRAY && pos < array_.size()) {
-		array_.erase(array_.begin() + pos);
+	if (Type() == TYPE_ARRAY && pos < node_->array.size()) {
+		RemoveAt(Mutable()->array, pos);
 	}
 }
 
 void Json::Erase(const std::string& name)
 {
-	if (type_ == TYPE_OBJECT) {
-		std::map<std::string, Json>::iterator it = object_.find(name);
-		if (it != object_.end()) {
-			object_.erase(it);
-			for (size_t i = 0; i < array_.size(); ++i) {
-				if (array_[i].AsString() == name) {
-					array_.erase(array_.begin() + i);
-					break;
-				}
-			}
-		}
+	Erase(name, NULL);
+}
+
+void Json::Erase(const JsonKey& key)
+{
+	Erase(key.Name(), &key);
+}
+
+void Json::Erase(const std::string& name, const JsonKey* key)
+{
+	if (Type() != TYPE_OBJECT) {
+		return;
+	}
+	size_t pos = (key != NULL ? FindKey(node_, name, key->key_->node_, &key->hash_) : FindKey(node_, name, NULL, NULL));
+	if (pos != std::string::npos) {
+		Node* node = Mutable();
+		RemoveAt(node->array, pos);
+		RemoveAt(node->object, pos);
+		IndexKeys(node);
 	}
 }
 
@@ -387,43 +857,48 @@ Json& Json::operator = (const std::string& v)
 
 bool Json::AsBool() const
 {
-	if (type_ == TYPE_ARRAY || type_ == TYPE_OBJECT) {
+	JsonType type = Type();
+	if (type == TYPE_ARRAY || type == TYPE_OBJECT) {
 		return Size() > 0;
-	} else if (type_ == TYPE_NULL) {
+	} else if (type == TYPE_NULL) {
 		return false;
 	} else {
-		return (text_ != "" && text_ != FALSE_TEXT && text_ != "0");
+		const std::string& text = node_->text;
+		return (text != "" && text != FALSE_TEXT && text != "0");
 	}
 }
 
 std::string Json::AsString() const
 {
-	if (type_ == TYPE_NULL) {
+	JsonType type = Type();
+	if (type == TYPE_NULL) {
 		return "";
-	} else if (type_ == TYPE_OBJECT || type_ == TYPE_ARRAY) {
+	} else if (type == TYPE_OBJECT || type == TYPE_ARRAY) {
 		return Dump();
 	} else {
-		return text_;
+		COUNT_STAT(stringCopies);
+		return node_->text;
 	}
 }
 
 size_t Json::Size() const
 {
-	if (type_ == TYPE_ARRAY) {
-		return array_.size();
-	} else if (type_ == TYPE_OBJECT) {
-		return object_.size();
+	JsonType type = Type();
+	if (type == TYPE_ARRAY) {
+		return node_->array.size();
+	} else if (type == TYPE_OBJECT) {
+		return node_->object.size();
 	} else {
-		return (type_ == TYPE_NULL ? 0 : 1);
+		return (type == TYPE_NULL ? 0 : 1);
 	}
 }
 
 std::vector<std::string> Json::Keys() const
 {
 	std::vector<std::string> names;
-	if (type_ == TYPE_OBJECT) {
-		for (size_t i = 0; i < array_.size(); ++i) {
-			names.push_back(array_[i].AsString());
+	if (Type() == TYPE_OBJECT) {
+		for (size_t i = 0; i < node_->array.size(); ++i) {
+			names.push_back(node_->array[i].AsString());
 		}
 	}
 	return names;
@@ -431,7 +906,12 @@ std::vector<std::string> Json::Keys() const
 
 bool Json::Has(const std::string& name) const
 {
-	return (type_ == TYPE_OBJECT && object_.find(name) != object_.end());
+	return (Type() == TYPE_OBJECT && FindKey(node_, name, NULL, NULL) != std::string::npos);
+}
+
+bool Json::Has(const JsonKey& key) const
+{
+	return (Type() == TYPE_OBJECT && FindKey(node_, key.Name(), key.key_->node_, &key.hash_) != std::string::npos);
 }
 
 bool Json::HasAndNotEmpty(const std::string& name) const
@@ -439,380 +919,2266 @@ bool Json::HasAndNotEmpty(const std::string& name) const
 	return Has(name) && (*this)[name].AsString() != "";
 }
 
-static std::string EncodeString(const std::string& s, bool unicode)
+void Json::SetPersistent(bool persistent)
 {
-	std::stringstream ss;
-	for (size_t i = 0; i < s.size(); ++i) {
-		if (s[i] == '"') {
-			ss << "\\\"";
-		} else if (s[i] == '\\') {
-			ss << "\\\\";
-		} else if (s[i] == '/') {
-			ss << "\\/";
-		} else if (s[i] == '\b') {
-			ss << "\\b";
-		} else if (s[i] == '\f') {
-			ss << "\\f";
-		} else if (s[i] == '\n') {
-			ss << "\\n";
-		} else if (s[i] == '\r') {
-			ss << "\\r";
-		} else if (s[i] == '\t') {
-			ss << "\\t";
-		} else if (unicode) {
-			unsigned int c = static_cast<unsigned char>(s[i]);
-			if (c >= 0x7F) {
-				ss << "\\u00"
-					<< std::hex << std::uppercase
-					<< static_cast<unsigned int>(c >> 4)
-					<< static_cast<unsigned int>(c & 0x0F)
-					<< std::dec << std::nouppercase;
-			} else {
-				ss << s[i];
-			}
-		} else {
-			ss << s[i];
-		}
+	if (persistent && node_ == NULL) {
+		node_ = new Node(TYPE_NULL, NULL_TEXT); // keep the mode for later values
 	}
-	return ss.str();
+	MarkPersistent(*this, persistent);
 }
 
-std::string Json::Dump(size_t indent, const std::string& sp, const std::string& eol, bool unicode, bool omitLongString) const
+bool Json::IsPersistent() const
 {
-	std::string prefix;
-	for (size_t i = 0; i < indent; ++i) {
-		prefix += sp;
-	}
-	std::string suffix = eol;
-	std::stringstream ss;
-	if (type_ == TYPE_ARRAY) {
-		ss << '[' << suffix;
-		for (size_t i = 0; i < array_.size(); ++i) {
-			ss << prefix << sp << array_[i].Dump(indent + 1, sp, eol, unicode, omitLongString);
-			if (i + 1 < array_.size()) {
-				ss << ",";
-			}
-			ss << eol;
-		}
-		ss << prefix << ']';
-	} else if (type_ == TYPE_OBJECT) {
-		ss << '{' << suffix;
-		for (size_t i = 0; i < array_.size(); ++i) {
-			std::string name = array_[i].AsString();
-			ss << prefix << sp << '"' << EncodeString(name, unicode) << '"' << ":";
-			std::map<std::string, Json>::const_iterator it = object_.find(name);
-			if (it == object_.end()) {
-				ss << NULL_TEXT;
-			} else {
-				ss << it->second.Dump(indent + 1, sp, eol, unicode, omitLongString);
-			}
-			if (i + 1 < array_.size()) {
-				ss << ',';
-			}
-			ss << eol;
+	return (node_ != NULL && node_->persistent);
+}
+
+void Json::MarkPersistent(Json& j, bool persistent)
+{
+	std::vector<Json*> pending(1, &j);
+	while (!pending.empty()) {
+		Json& sub = *pending.back();
+		pending.pop_back();
+		if (sub.node_ == NULL || (persistent && Shared(sub.node_))) {
+			continue; // a shared node and everything below it is persistent already
 		}
-		ss << prefix << '}';
-	} else if (type_ == TYPE_STRING) {
-		if (omitLongString && text_.size() > MAX_STRING_DISPLAY_SIZE) {
-			ss << '"' << text_.substr(0, MAX_STRING_DISPLAY_SIZE) << "...\"(" << text_.size() << " bytes)";
-		} else {
-			ss << '"' << EncodeString(text_, unicode) << '"';
+		Node* node = sub.Mutable();
+		node->persistent = persistent;
+		node->exposed = false;
+		std::vector<Json>& items = (node->type == TYPE_OBJECT ? node->object : node->array); // key nodes are never modified
+		for (size_t i = 0; i < items.size(); ++i) {
+			pending.push_back(&items[i]);
 		}
-	} else {
-		ss << text_;
 	}
-	return ss.str();
 }
 
-static void SkipSpaces(const char *& s)
+static size_t StringHeap(const std::string& s) // 0 if the text is stored in place (short string)
 {
-	while (*s) {
-		if (isspace(*s)) {
-			++s;
-		} else if (*s == '/' && *(s + 1) == '*') { // Skip comments
-			s += 2;
-			while (*s) {
-				if (*s == '*' && *(s + 1) == '/') {
-					s += 2;
-					break;
+	const char* data = s.data();
+	const char* self = reinterpret_cast<const char*>(&s);
+	if (s.capacity() == 0 || (data >= self && data < self + sizeof(s))) {
+		return 0;
+	}
+	return s.capacity() + 1;
+}
+
+Json::Usage Json::MemoryUsage() const
+{
+	Usage usage;
+	memset(&usage, 0, sizeof(usage));
+	std::set<const Node*> shared;
+	std::vector<const Node*> pending;
+	if (node_ != NULL) {
+		pending.push_back(node_);
+	}
+	while (!pending.empty()) {
+		const Node* node = pending.back();
+		pending.pop_back();
+		if (Shared(node) && !shared.insert(node).second) {
+			continue;
+		}
+		usage.nodes += sizeof(Node);
+		size_t heap = StringHeap(node->text);
+		if (heap > 0) {
+			usage.strings += node->text.size() + 1;
+			usage.slack += heap - node->text.size() - 1;
+		}
+
+		const std::vector<Json>& array = node->array;
+		usage.slack += (array.capacity() - array.size()) * sizeof(Json);
+		if (node->type != TYPE_OBJECT) {
+			usage.containers += array.size() * sizeof(Json);
+			for (size_t i = 0; i < array.size(); ++i) {
+				if (array[i].node_ != NULL) {
+					pending.push_back(array[i].node_);
 				}
-				++s;
 			}
-		} else {
-			break;
+			continue;
+		}
+		usage.keys += array.size() * sizeof(Json) + node->index.capacity() * sizeof(uint32_t);
+		for (size_t i = 0; i < array.size(); ++i) { // the key nodes, in insertion order
+			const Node* key = array[i].node_;
+			if (!Shared(key) || shared.insert(key).second) {
+				usage.keys += sizeof(Node) + StringHeap(key->text);
+			}
+		}
+		const std::vector<Json>& object = node->object;
+		usage.containers += object.size() * sizeof(Json);
+		usage.slack += (object.capacity() - object.size()) * sizeof(Json);
+		for (size_t i = 0; i < object.size(); ++i) {
+			if (object[i].node_ != NULL) {
+				pending.push_back(object[i].node_);
+			}
 		}
 	}
+	return usage;
 }
 
-static unsigned int HexValue(int c)
+static void Shrink(std::vector<Json>& array)
 {
-	if (c >= '0' && c <= '9') {
-		return (c - '0');
-	} else if (c >= 'A' && c <= 'F') {
-		return (c - 'A') + 10;
-	} else if (c >= 'a' && c <= 'f') {
-		return (c - 'a') + 10;
-	} else {
-		return c;
+	if (array.capacity() > array.size()) { // handles are swapped, not copied
+		std::vector<Json> shrunk(array.size());
+		for (size_t i = 0; i < array.size(); ++i) {
+			shrunk[i].Swap(array[i]);
+		}
+		array.swap(shrunk);
 	}
 }
 
-static bool ParseString(const char *& s, Json& v, bool strict = true)
+void Json::ShrinkToFit()
 {
-	SkipSpaces(s);
-	if (strict) {
-		if (*s != '"') return false; else ++s;
+	std::vector<Node*> pending;
+	if (node_ != NULL && !Shared(node_)) {
+		pending.push_back(node_);
 	}
-	std::string text;
-	while (*s) {
-		if (strict) {
-			if (*s == '"') break;
-		} else {
-			if (*s == ':' || *s == ',' || *s == '}' || *s == ']' || isspace(*s)) break;
+	while (!pending.empty()) {
+		Node* node = pending.back();
+		pending.pop_back();
+		if (StringHeap(node->text) > node->text.size() + 1) {
+			std::string(node->text.data(), node->text.size()).swap(node->text);
 		}
-		if (*s == '\\') {
-			switch (*(++s)) {
-			case '"':
-			case '\\':
-			case '/': text += *s++; break;
-			case 'b': text += '\b'; ++s; break;
-			case 'f': text += '\f'; ++s; break;
-			case 'n': text += '\n'; ++s; break;
-			case 'r': text += '\r'; ++s; break;
-			case 't': text += '\t'; ++s; break;
-			case 'u':
-				if (!isxdigit(s[1])) return false;
-				if (!isxdigit(s[2])) return false;
-				if (!isxdigit(s[3])) return false;
-				if (!isxdigit(s[4])) return false;
-				text.push_back(static_cast<char>(
-						(HexValue(s[1]) << 12) +
-						(HexValue(s[2]) << 8) +
-						(HexValue(s[3]) << 4) +
-						HexValue(s[4])));
-				s += 5;
-				break;
-			default: return false;
+		Shrink(node->array);
+		Shrink(node->object);
+		for (size_t i = 0; i < node->array.size(); ++i) {
+			if (node->array[i].node_ != NULL && !Shared(node->array[i].node_)) {
+				pending.push_back(node->array[i].node_);
 			}
-		} else {
-			text += *s++;
 		}
-	}
+		for (size_t i = 0; i < node->object.size(); ++i) {
+			if (node->object[i].node_ != NULL && !Shared(node->object[i].node_)) {
+				pending.push_back(node->object[i].node_);
+			}
+		}
+	}
+}
+
+/*
+ * Hash consing: the children of a node are deduplicated before the node itself,
+ * so that identical subtrees have the same child nodes, and comparing a node
+ * with the canonical ones of the same hash takes comparing its child pointers.
+ * Nodes shared with other documents are not modified, nor looked into.
+ */
+size_t Json::Deduplicate()
+{
+	size_t before = MemoryUsage().Total();
+	SetPersistent(); // modifying a shared node will copy it
+	if (Shared(node_)) {
+		return 0;
+	}
+
+	std::multimap<uint64_t, Json> canonical; // by ShallowHash()
+	std::vector<std::pair<Json*, bool> > stack(1, std::make_pair(this, false)); // and whether its children are done
+	while (!stack.empty()) {
+		Json* j = stack.back().first;
+		Node* node = j->node_;
+		if (node == NULL) {
+			stack.pop_back();
+			continue;
+		} else if (!stack.back().second && !Shared(node)) {
+			stack.back().second = true;
+			for (size_t i = 0; i < node->array.size(); ++i) {
+				stack.push_back(std::make_pair(&node->array[i], false));
+			}
+			for (size_t i = 0; i < node->object.size(); ++i) {
+				stack.push_back(std::make_pair(&node->object[i], false));
+			}
+			continue;
+		}
+		stack.pop_back();
+		if (j == this) {
+			break;
+		}
+		uint64_t hash = ShallowHash(node);
+		typedef std::multimap<uint64_t, Json>::const_iterator Iterator;
+		std::pair<Iterator, Iterator> range = canonical.equal_range(hash);
+		Iterator it = range.first;
+		while (it != range.second && !SameShallow(it->second.node_, node)) {
+			++it;
+		}
+		if (it == range.second) {
+			canonical.insert(std::make_pair(hash, *j)); // shares the node
+		} else if (it->second.node_ != node) {
+			j->Clone(it->second);
+		}
+	}
+	canonical.clear();
+	size_t after = MemoryUsage().Total();
+	return (before > after ? before - after : 0);
+}
+
+uint64_t Json::ShallowHash(const Json::Node* node)
+{
+	uint64_t hash = (HashKey(node->text) ^ (static_cast<uint64_t>(node->type) << 32)) * 1099511628211ULL;
+	for (size_t i = 0; i < node->array.size(); ++i) {
+		hash = (hash ^ reinterpret_cast<uintptr_t>(node->array[i].node_)) * 1099511628211ULL;
+	}
+	for (size_t i = 0; i < node->object.size(); ++i) {
+		hash = (hash ^ reinterpret_cast<uintptr_t>(node->object[i].node_)) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool Json::SameShallow(const Json::Node* a, const Json::Node* b) // with the same children
+{
+	if (a->type != b->type || a->text != b->text || a->array.size() != b->array.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < a->array.size(); ++i) {
+		if (a->array[i].node_ != b->array[i].node_) {
+			return false;
+		}
+	}
+	for (size_t i = 0; i < a->object.size(); ++i) {
+		if (a->object[i].node_ != b->object[i].node_) {
+			return false;
+		}
+	}
+	return true;
+}
+
+struct Json::DumpStyle
+{
+	DumpStyle(const std::string& s, const std::string& e, bool u, bool o):
+		sp(s), eol(e), unicode(u), omitLongString(o) { }
+	const std::string& sp;
+	const std::string& eol;
+	bool unicode;
+	bool omitLongString;
+};
+
+static inline void AppendIndent(std::string& out, size_t indent, const std::string& sp)
+{
+	if (sp.empty()) {
+		return;
+	}
+	for (size_t i = 0; i < indent; ++i) {
+		out += sp;
+	}
+}
+
+static inline bool IsContinuation(unsigned char c)
+{
+	return ((c & 0xC0) == 0x80);
+}
+
+// the size of the well-formed UTF-8 sequence (RFC 3629) at s, 0 if malformed
+static size_t Utf8Size(const char* s)
+{
+	const unsigned char* u = reinterpret_cast<const unsigned char*>(s);
+	if (u[0] < 0x80) {
+		return 1;
+	} else if (u[0] < 0xC2) {
+		return 0; // a continuation byte or an overlong sequence
+	} else if (u[0] < 0xE0) {
+		return (IsContinuation(u[1]) ? 2 : 0);
+	} else if (u[0] < 0xF0) {
+		unsigned char low = (u[0] == 0xE0 ? 0xA0 : 0x80); // overlong
+		unsigned char high = (u[0] == 0xED ? 0x9F : 0xBF); // surrogates
+		return (u[1] >= low && u[1] <= high && IsContinuation(u[2]) ? 3 : 0);
+	} else if (u[0] < 0xF5) {
+		unsigned char low = (u[0] == 0xF0 ? 0x90 : 0x80); // overlong
+		unsigned char high = (u[0] == 0xF4 ? 0x8F : 0xBF); // beyond U+10FFFF
+		return (u[1] >= low && u[1] <= high && IsContinuation(u[2]) && IsContinuation(u[3]) ? 4 : 0);
+	}
+	return 0;
+}
+
+static void AppendHex(std::string& out, unsigned int code) // an escaped UTF-16 code unit
+{
+	static const char HEX[] = "0123456789ABCDEF";
+	out += "\\u";
+	out += HEX[(code >> 12) & 0x0F];
+	out += HEX[(code >> 8) & 0x0F];
+	out += HEX[(code >> 4) & 0x0F];
+	out += HEX[code & 0x0F];
+}
+
+static void AppendEncoded(std::string& out, const std::string& s, bool unicode)
+{
+	size_t done = 0;
+	for (size_t i = 0; i < s.size(); ++i) {
+		unsigned char c = static_cast<unsigned char>(s[i]);
+		const char* escaped = NULL;
+		switch (c) {
+		case '"': escaped = "\\\""; break;
+		case '\\': escaped = "\\\\"; break;
+		case '/': escaped = "\\/"; break;
+		case '\b': escaped = "\\b"; break;
+		case '\f': escaped = "\\f"; break;
+		case '\n': escaped = "\\n"; break;
+		case '\r': escaped = "\\r"; break;
+		case '\t': escaped = "\\t"; break;
+		default:
+			if (!unicode || c < 0x7F) {
+				continue;
+			}
+		}
+		out.append(s, done, i - done);
+		done = i + 1;
+		if (escaped) {
+			out += escaped;
+			continue;
+		}
+		unsigned int code = c; // a byte which is not UTF-8 is escaped alone
+		size_t size = (c < 0x80 ? 1 : Utf8Size(s.c_str() + i));
+		if (size > 1) {
+			code = c & (0xFF >> (size + 1));
+			for (size_t k = 1; k < size; ++k) {
+				code = (code << 6) | (s[i + k] & 0x3F);
+			}
+			done = i + size;
+			i = done - 1;
+		}
+		if (code >= 0x10000) { // a surrogate pair
+			code -= 0x10000;
+			AppendHex(out, 0xD800 + (code >> 10));
+			code = 0xDC00 + (code & 0x3FF);
+		}
+		AppendHex(out, code);
+	}
+	out.append(s, done, s.size() - done);
+}
+
+std::string Json::Dump(size_t indent, const std::string& sp, const std::string& eol, bool unicode, bool omitLongString) const
+{
+	std::string out;
+	DumpTo(out, indent, DumpStyle(sp, eol, unicode, omitLongString));
+	return out;
+}
+
+void Json::DumpTo(std::string& out, size_t indent, const Json::DumpStyle& style) const
+{
+	JsonType type = Type();
+	if (type == TYPE_ARRAY || type == TYPE_OBJECT) {
+		out += (type == TYPE_ARRAY ? '[' : '{');
+		out += style.eol;
+		DumpItems(out, 0, node_->array.size(), indent, style);
+		AppendIndent(out, indent, style.sp);
+		out += (type == TYPE_ARRAY ? ']' : '}');
+	} else {
+		DumpScalar(out, style);
+	}
+}
+
+void Json::DumpScalar(std::string& out, const Json::DumpStyle& style) const
+{
+	if (Type() == TYPE_STRING) {
+		const std::string& text = node_->text;
+		out += '"';
+		if (style.omitLongString && text.size() > MAX_STRING_DISPLAY_SIZE) {
+			out.append(text, 0, MAX_STRING_DISPLAY_SIZE);
+			out += "...\"(";
+			out += ToString(text.size());
+			out += " bytes)";
+		} else {
+			AppendEncoded(out, text, style.unicode);
+			out += '"';
+		}
+	} else {
+		out += (node_ ? node_->text : NULL_TEXT);
+	}
+}
+
+struct DumpFrame
+{
+	DumpFrame(const Json* j, size_t b, size_t e, size_t i): json(j), begin(b), end(e), indent(i) { }
+	const Json* json;
+	size_t begin; // next item
+	size_t end;
+	size_t indent;
+};
+
+void Json::DumpItems(std::string& out, size_t begin, size_t end, size_t indent, const Json::DumpStyle& style) const
+{
+	// nested containers are dumped with an explicit stack, deep documents cannot overflow the call stack
+	std::vector<DumpFrame> stack(1, DumpFrame(this, begin, end, indent));
+	for (;;) {
+		DumpFrame& frame = stack.back();
+		const Node* node = frame.json->node_;
+		if (frame.begin == frame.end) { // close a nested container and finish its item in the parent
+			size_t level = frame.indent;
+			stack.pop_back();
+			if (stack.empty()) {
+				break;
+			}
+			AppendIndent(out, level, style.sp);
+			out += (node->type == TYPE_ARRAY ? ']' : '}');
+			const DumpFrame& parent = stack.back();
+			if (parent.begin < parent.json->node_->array.size()) {
+				out += ',';
+			}
+			out += style.eol;
+			continue;
+		}
+
+		size_t i = frame.begin++;
+		AppendIndent(out, frame.indent + 1, style.sp);
+		const Json* sub = &node->array[i];
+		if (node->type == TYPE_OBJECT) {
+			const std::string& name = sub->node_->text;
+			out += '"';
+			AppendEncoded(out, name, style.unicode);
+			out += "\":";
+			sub = &node->object[i];
+		}
+		JsonType type = sub->Type();
+		if (type == TYPE_ARRAY || type == TYPE_OBJECT) {
+			out += (type == TYPE_ARRAY ? '[' : '{');
+			out += style.eol;
+			stack.push_back(DumpFrame(sub, 0, sub->node_->array.size(), frame.indent + 1));
+		} else {
+			sub->DumpScalar(out, style);
+			if (i + 1 < node->array.size()) {
+				out += ',';
+			}
+			out += style.eol;
+		}
+	}
+}
+
+Json::Serializer::Serializer(const Json& json, size_t indent, const std::string& sp, const std::string& eol, bool unicode):
+	json_(&json), indent_(indent), sp_(sp), eol_(eol), unicode_(unicode), started_(false), offset_(0)
+{
+}
+
+size_t Json::Serializer::Fill(char* buffer, size_t capacity)
+{
+	size_t size = 0;
+	while (size < capacity) {
+		if (offset_ < pending_.size()) {
+			size_t n = std::min(capacity - size, pending_.size() - offset_);
+			memcpy(buffer + size, pending_.data() + offset_, n);
+			offset_ += n;
+			size += n;
+		} else if (!Next()) {
+			break;
+		}
+	}
+	return size;
+}
+
+bool Json::Serializer::Next() // the next piece of text as DumpTo() and DumpItems() produce it
+{
+	DumpStyle style(sp_, eol_, unicode_, false);
+	pending_.clear();
+	offset_ = 0;
+	if (!started_) {
+		started_ = true;
+		JsonType type = json_->Type();
+		if (type == TYPE_ARRAY || type == TYPE_OBJECT) {
+			pending_ += (type == TYPE_ARRAY ? '[' : '{');
+			pending_ += eol_;
+			Frame frame = { json_, 0, indent_ };
+			stack_.push_back(frame);
+		} else {
+			json_->DumpScalar(pending_, style);
+		}
+		return true;
+	} else if (stack_.empty()) {
+		return false;
+	}
+
+	Frame& frame = stack_.back();
+	const Node* node = frame.json->node_;
+	if (frame.next == node->array.size()) { // close a container
+		size_t level = frame.indent;
+		stack_.pop_back();
+		AppendIndent(pending_, level, sp_);
+		pending_ += (node->type == TYPE_ARRAY ? ']' : '}');
+		if (!stack_.empty()) { // and finish its item in the parent
+			const Frame& parent = stack_.back();
+			if (parent.next < parent.json->node_->array.size()) {
+				pending_ += ',';
+			}
+			pending_ += eol_;
+		}
+		return true;
+	}
+
+	size_t i = frame.next++;
+	AppendIndent(pending_, frame.indent + 1, sp_);
+	const Json* sub = &node->array[i];
+	if (node->type == TYPE_OBJECT) {
+		pending_ += '"';
+		AppendEncoded(pending_, sub->node_->text, unicode_);
+		pending_ += "\":";
+		sub = &node->object[i];
+	}
+	JsonType type = sub->Type();
+	if (type == TYPE_ARRAY || type == TYPE_OBJECT) {
+		pending_ += (type == TYPE_ARRAY ? '[' : '{');
+		pending_ += eol_;
+		Frame child = { sub, 0, frame.indent + 1 };
+		stack_.push_back(child); // frame is invalid from here
+	} else {
+		sub->DumpScalar(pending_, style);
+		if (i + 1 < node->array.size()) {
+			pending_ += ',';
+		}
+		pending_ += eol_;
+	}
+	return true;
+}
+
+/*
+ * Parallel dump: the document is split into tasks, each being either a piece of
+ * text (brackets, keys, separators) or a range of items of one container. The
+ * ranges are serialized concurrently into their own buffers, whose exact sizes
+ * then give each of them its place in the result, to which they are copied
+ * concurrently as well.
+ */
+const size_t PARALLEL_DUMP_MIN_NODES = 1024;  // smaller containers are not split
+const size_t PARALLEL_DUMP_TASKS_PER_THREAD = 8;
+const size_t PARALLEL_DUMP_MAX_DEPTH = 64;    // deeper containers are not split
+
+struct Json::DumpTask
+{
+	const Json* json; // NULL for a piece of text
+	size_t begin;
+	size_t end;
+	size_t indent;
+	size_t offset;
+	std::string text;
+};
+
+struct Json::DumpJob
+{
+	std::vector<DumpTask>* tasks;
+	const DumpStyle* style;
+	char* out; // NULL while serializing, the result while copying
+	size_t next;
+};
+
+void Json::AddDumpText(std::vector<Json::DumpTask>& tasks, const std::string& text)
+{
+	if (tasks.empty() || tasks.back().json != NULL) {
+		tasks.push_back(DumpTask());
+		tasks.back().json = NULL;
+	}
+	tasks.back().text += text;
+}
+
+void Json::AddDumpItems(std::vector<Json::DumpTask>& tasks, const Json* json, size_t begin, size_t end, size_t indent)
+{
+	if (begin < end) {
+		tasks.push_back(DumpTask());
+		tasks.back().json = json;
+		tasks.back().begin = begin;
+		tasks.back().end = end;
+		tasks.back().indent = indent;
+	}
+}
+
+size_t Json::Weight(size_t limit) const
+{
+	size_t weight = 1;
+	if (node_ != NULL) {
+		weight += node_->array.size();
+		for (size_t i = 0; i < node_->array.size() && weight < limit; ++i) {
+			const Json& sub = (Type() == TYPE_OBJECT ? node_->object[i] : node_->array[i]);
+			if (sub.Type() == TYPE_ARRAY || sub.Type() == TYPE_OBJECT) {
+				weight += sub.Weight(limit - weight) - 1;
+			}
+		}
+	}
+	return weight;
+}
+
+void Json::PlanDump(std::vector<Json::DumpTask>& tasks, size_t indent, const Json::DumpStyle& style, size_t threads, size_t depth) const
+{
+	JsonType type = Type();
+	const std::vector<Json>& array = node_->array;
+	size_t size = array.size();
+	AddDumpText(tasks, (type == TYPE_ARRAY ? "[" : "{") + style.eol);
+
+	if (size >= PARALLEL_DUMP_MIN_NODES) { // split into chunks of items
+		size_t grain = std::max(size / (threads * PARALLEL_DUMP_TASKS_PER_THREAD), static_cast<size_t>(1));
+		for (size_t begin = 0; begin < size; begin += grain) {
+			AddDumpItems(tasks, this, begin, std::min(begin + grain, size), indent);
+		}
+	} else { // small items are dumped together, big ones are split themselves
+		size_t begin = 0;
+		for (size_t i = 0; i < size; ++i) {
+			const Json& sub = (type == TYPE_OBJECT ? Sub(array[i].node_->text) : array[i]);
+			if ((sub.Type() == TYPE_ARRAY || sub.Type() == TYPE_OBJECT) && depth < PARALLEL_DUMP_MAX_DEPTH &&
+					sub.Weight(PARALLEL_DUMP_MIN_NODES) >= PARALLEL_DUMP_MIN_NODES) {
+				AddDumpItems(tasks, this, begin, i, indent);
+				std::string text;
+				AppendIndent(text, indent + 1, style.sp);
+				if (type == TYPE_OBJECT) {
+					text += '"';
+					AppendEncoded(text, array[i].node_->text, style.unicode);
+					text += "\":";
+				}
+				AddDumpText(tasks, text);
+				sub.PlanDump(tasks, indent + 1, style, threads, depth + 1);
+				AddDumpText(tasks, (i + 1 < size ? "," : "") + style.eol);
+				begin = i + 1;
+			}
+		}
+		AddDumpItems(tasks, this, begin, size, indent);
+	}
+
+	std::string text;
+	AppendIndent(text, indent, style.sp);
+	text += (type == TYPE_ARRAY ? ']' : '}');
+	AddDumpText(tasks, text);
+}
+
+void* Json::DumpWorker(void* arg)
+{
+	DumpJob* job = static_cast<DumpJob*>(arg);
+	for (;;) {
+		size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+		if (i >= job->tasks->size()) {
+			break;
+		}
+		DumpTask& task = (*job->tasks)[i];
+		if (job->out == NULL) {
+			if (task.json != NULL) {
+				task.json->DumpItems(task.text, task.begin, task.end, task.indent, *job->style);
+			}
+		} else {
+			memcpy(job->out + task.offset, task.text.data(), task.text.size());
+			std::string().swap(task.text);
+		}
+	}
+	return NULL;
+}
+
+static size_t ThreadCount(size_t threads) // 0 for all CPUs
+{
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cpus > 0 ? cpus : 1);
+	}
+	return threads;
+}
+
+// runs the worker on the calling thread and threads - 1 more, until they all return
+static void RunThreads(void* (*worker)(void*), void* job, size_t threads)
+{
+	std::vector<pthread_t> ids(threads - 1);
+	size_t started = 0;
+	for (; started < ids.size(); ++started) {
+		if (pthread_create(&ids[started], NULL, worker, job) != 0) {
+			break; // the remaining work is simply done by fewer threads
+		}
+	}
+	worker(job);
+	for (size_t i = 0; i < started; ++i) {
+		pthread_join(ids[i], NULL);
+	}
+}
+
+void Json::RunDumpWorkers(Json::DumpJob& job, size_t threads)
+{
+	job.next = 0;
+	RunThreads(DumpWorker, &job, threads);
+}
+
+std::string Json::DumpParallel(size_t threads, size_t indent, const std::string& sp, const std::string& eol, bool unicode, bool omitLongString) const
+{
+	DumpStyle style(sp, eol, unicode, omitLongString);
+	threads = ThreadCount(threads);
+	std::string out;
+	JsonType type = Type();
+	if (threads == 1 || (type != TYPE_ARRAY && type != TYPE_OBJECT) ||
+			Weight(PARALLEL_DUMP_MIN_NODES) < PARALLEL_DUMP_MIN_NODES) {
+		DumpTo(out, indent, style);
+		return out;
+	}
+
+	std::vector<DumpTask> tasks;
+	PlanDump(tasks, indent, style, threads, 0);
+	DumpJob job;
+	job.tasks = &tasks;
+	job.style = &style;
+	job.out = NULL;
+	RunDumpWorkers(job, threads);
+
+	size_t size = 0;
+	for (size_t i = 0; i < tasks.size(); ++i) {
+		tasks[i].offset = size;
+		size += tasks[i].text.size();
+	}
+	out.resize(size);
+	if (size > 0) {
+		job.out = &out[0];
+		RunDumpWorkers(job, threads);
+	}
+	return out;
+}
+
+static void SkipSpaces(const char *& s)
+{
+	while (*s) {
+		if (isspace(*s)) {
+			++s;
+		} else if (*s == '/' && *(s + 1) == '*') { // Skip comments
+			s += 2;
+			while (*s) {
+				if (*s == '*' && *(s + 1) == '/') {
+					s += 2;
+					break;
+				}
+				++s;
+			}
+		} else {
+			break;
+		}
+	}
+}
+
+/*
+ * The class of each byte within a string: STRING_END ends a quoted string,
+ * SYMBOL_END an unquoted one and NON_ASCII starts a multi-byte UTF-8 sequence,
+ * so that runs of plain bytes are copied at once.
+ */
+enum { STRING_END = 1, SYMBOL_END = 2, NON_ASCII = 4 };
+static const unsigned char CHAR_CLASS[256] = {
+	3, 0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 2, 0, 0, // '\0', '\t' .. '\r'
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	2, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, // ' ', '"', ','
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0, 0, // ':'
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 2, 0, 0, // '\\', ']'
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, // '}'
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+};
+
+static void AppendUtf8(std::string& text, unsigned int code)
+{
+	if (code < 0x80) {
+		text += static_cast<char>(code);
+	} else if (code < 0x800) {
+		text += static_cast<char>(0xC0 | (code >> 6));
+		text += static_cast<char>(0x80 | (code & 0x3F));
+	} else if (code < 0x10000) {
+		text += static_cast<char>(0xE0 | (code >> 12));
+		text += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+		text += static_cast<char>(0x80 | (code & 0x3F));
+	} else {
+		text += static_cast<char>(0xF0 | (code >> 18));
+		text += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+		text += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+		text += static_cast<char>(0x80 | (code & 0x3F));
+	}
+}
+
+static unsigned int HexValue(int c)
+{
+	if (c >= '0' && c <= '9') {
+		return (c - '0');
+	} else if (c >= 'A' && c <= 'F') {
+		return (c - 'A') + 10;
+	} else if (c >= 'a' && c <= 'f') {
+		return (c - 'a') + 10;
+	} else {
+		return c;
+	}
+}
+
+static bool ScanHex(const char *& s, unsigned int& code) // the 4 digits of \u
+{
+	code = 0;
+	for (int i = 0; i < 4; ++i) {
+		if (!isxdigit(s[i])) return false;
+		code = (code << 4) + HexValue(s[i]);
+	}
+	s += 4;
+	return true;
+}
+
+static bool DecodeEscape(const char *& s, std::string& text, bool utf8)
+{
+	switch (*(++s)) {
+	case '"':
+	case '\\':
+	case '/': text += *s++; return true;
+	case 'b': text += '\b'; ++s; return true;
+	case 'f': text += '\f'; ++s; return true;
+	case 'n': text += '\n'; ++s; return true;
+	case 'r': text += '\r'; ++s; return true;
+	case 't': text += '\t'; ++s; return true;
+	case 'u': break;
+	default: return false;
+	}
+	unsigned int code;
+	++s;
+	if (!ScanHex(s, code)) return false;
+	if (code >= 0xD800 && code < 0xDC00 && s[0] == '\\' && s[1] == 'u') { // a surrogate pair
+		const char *p = s + 2;
+		unsigned int low;
+		if (ScanHex(p, low) && low >= 0xDC00 && low < 0xE000) {
+			code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+			s = p;
+		}
+	}
+	if (code >= 0xD800 && code < 0xE000 && utf8) {
+		return false; // a lone surrogate, kept in its 3 byte form otherwise
+	}
+	AppendUtf8(text, code);
+	return true;
+}
+
+/*
+ * A quoted (strict) or unquoted string. With utf8 the text has to be well-formed
+ * UTF-8, which is checked while the string is copied rather than in another pass.
+ */
+static bool DecodeString(const char *& s, std::string& text, bool strict, bool utf8)
+{
+	SkipSpaces(s);
+	if (strict) {
+		if (*s != '"') return false; else ++s;
+	}
+	text.clear();
+	unsigned char stop = (strict ? STRING_END : SYMBOL_END) | (utf8 ? NON_ASCII : 0);
+	for (;;) {
+		const char *run = s;
+		while (!(CHAR_CLASS[static_cast<unsigned char>(*s)] & stop)) ++s;
+		text.append(run, s - run);
+		if (*s == '\\') {
+			if (!DecodeEscape(s, text, utf8)) return false;
+		} else if (static_cast<unsigned char>(*s) >= 0x80) {
+			size_t size = Utf8Size(s);
+			if (size == 0) return false;
+			text.append(s, size);
+			s += size;
+		} else {
+			break;
+		}
+	}
 	if (strict) {
 		if (*s != '"') return false; else ++s;
 	}
-	v = text;
-	return true;
+	return true;
+}
+
+static inline bool ValidateUtf8(bool strict) // whether the strings of strict text have to be UTF-8
+{
+	return (strict && Json::Utf8Validation());
+}
+
+static bool ParseString(const char *& s, Json& v, bool strict, bool utf8)
+{
+	std::string text;
+	if (!DecodeString(s, text, strict, utf8)) {
+		return false;
+	}
+	v = text;
+	return true;
+}
+
+static bool ScanNumber(const char *& s)
+{
+	SkipSpaces(s);
+	if (*s == '-' || *s == '+') ++s;
+	if (!isdigit(*s) && *s != '.') return false; else ++s;
+	while (isdigit(*s)) ++s;
+	if (*s == '.') {
+		++s;
+		while (isdigit(*s)) ++s;
+	}
+	if (*s == 'e' || *s == 'E') {
+		++s;
+		if (*s == '+' || *s == '-') ++s;
+		if (!isdigit(*s)) return false; else ++s;
+		while (isdigit(*s)) ++s;
+	}
+	return true;
+}
+
+static bool ParseNumber(const char *& s, Json& v)
+{
+	const char *s0 = s;
+	if (!ScanNumber(s)) {
+		return false;
+	}
+	v.Clear(Json::TYPE_NUMBER, std::string(s0, s));
+	return true;
+}
+
+static inline bool IsVaidSeparator(char c)
+{
+	return (c == '\0' || strchr(",]} \t\n\r", c) != NULL);
+}
+
+static inline bool MatchSymbol(const char *& s, const char *t, size_t size)
+{
+	if (strncmp(s, t, size) == 0 && IsVaidSeparator(s[size])) { // never reads beyond the end of s
+		s += size;
+		return true;
+	}
+	return false;
+}
+
+static bool ParseScalar(const char *& s, Json& v, bool strict)
+{
+	SkipSpaces(s);
+	if (*s == '"') {
+		return ParseString(s, v, true, ValidateUtf8(strict));
+	}
+	if (*s == '+' || *s == '-' || *s == '.' || isdigit(*s)) {
+		const char *p = s;
+		if (ParseNumber(p, v)) {
+			if (strict) {
+				s = p;
+				return true;
+			}
+			if (IsVaidSeparator(*p)) {
+				s = p;
+				return true;
+			}
+		} else if (strict) {
+			return false;
+		}
+		// otherwise, try to parse as string
+	}
+	if (MatchSymbol(s, NULL_TEXT, sizeof(NULL_TEXT) - 1)) {
+		v.Clear();
+		return true;
+	} else if (MatchSymbol(s, TRUE_TEXT, sizeof(TRUE_TEXT) - 1)) {
+		v = true;
+		return true;
+	} else if (MatchSymbol(s, FALSE_TEXT, sizeof(FALSE_TEXT) - 1)) {
+		v = false;
+		return true;
+	} else if (!strict) {
+		return ParseString(s, v, false, false);
+	} else {
+		return false;
+	}
+}
+
+/*
+ * Arrays and objects are parsed with an explicit stack of the containers being
+ * filled, so that the nesting of untrusted input is limited by MaxDepth() rather
+ * than by the size of the call stack. Values are parsed in place into their slots.
+ */
+bool Json::ParseValue(const char *& s, bool strict)
+{
+	enum { VALUE, ITEM, NEXT, CLOSE } state = VALUE;
+	size_t maxDepth = MaxDepth();
+	bool utf8 = ValidateUtf8(strict);
+	std::vector<Json*> stack;
+	std::string name; // of a key
+	Json* slot = this;
+	for (;;) {
+		if (state == VALUE) { // a value into slot
+			SkipSpaces(s);
+			if (*s == '{' || *s == '[') {
+				if (stack.size() >= maxDepth) {
+					return false;
+				}
+				JsonType type = (*s == '{' ? TYPE_OBJECT : TYPE_ARRAY);
+				++s;
+				SkipSpaces(s);
+				slot->Clear(type);
+				stack.push_back(slot);
+				state = (*s == (type == TYPE_OBJECT ? '}' : ']') ? CLOSE : ITEM);
+			} else if (!ParseScalar(s, *slot, strict)) {
+				return false;
+			} else if (stack.empty()) {
+				return true;
+			} else {
+				state = NEXT;
+			}
+			continue;
+		}
+
+		Node* node = stack.back()->node_;
+		bool object = (node->type == TYPE_OBJECT);
+		if (state == ITEM) { // the beginning of an item
+			if (!strict) {
+				SkipSpaces(s);
+				if (*s == ',') {
+					++s;
+					continue;
+				} else if (*s == (object ? '}' : ']')) {
+					state = CLOSE;
+					continue;
+				}
+			}
+			if (object) {
+				if (!DecodeString(s, name, strict || *s == '"', utf8)) return false;
+				SkipSpaces(s);
+				if (*s != ':') return false; else ++s;
+				uint32_t hash = HashKey(name);
+				Json key;
+				InternKey(name, hash, key);
+				size_t pos = FindKey(node, name, key.node_, &hash);
+				if (pos == std::string::npos) {
+					slot = &Child(node, AddKey(node, key));
+				} else {
+					slot = &Child(node, node->object[pos]); // a duplicate key replaces the value
+				}
+			} else {
+				slot = &Child(node, InsertAt(node->array, node->array.size()));
+			}
+			state = VALUE;
+		} else if (state == NEXT) { // after the value of an item
+			SkipSpaces(s);
+			if (*s == (object ? '}' : ']')) {
+				state = CLOSE;
+			} else if (!object && *s == '}') {
+				return false;
+			} else {
+				if (*s == ',') {
+					++s;
+				} else if (strict || *s == '\0' || *s == ':') {
+					return false; // a missing separator is only tolerated before another value
+				}
+				state = ITEM;
+			}
+		} else { // CLOSE
+			++s;
+			stack.pop_back();
+			if (stack.empty()) {
+				return true;
+			}
+			state = NEXT;
+		}
+	}
+}
+
+bool Json::Parse(const std::string& text, size_t *pos, bool strict)
+{
+	const char *p = text.c_str();
+	if (!ParseValue(p, strict)) {
+		if (pos) *pos = p - text.c_str();
+		return false;
+	}
+	SkipSpaces(p);
+	if (pos) *pos = p - text.c_str();
+	return (!*p);
+}
+
+/*
+ * Validation scans the same grammar as ParseValue() and ParseScalar() over a
+ * bounded buffer, keeping only one bit per nesting level (whether it is an
+ * object) in a local array. A '\0' within the text ends it as for Parse().
+ */
+class TextValidator
+{
+public:
+	TextValidator(const char* text, size_t size, bool strict);
+	bool Document();
+	const char* Position() const { return s_; }
+private:
+	char At(const char* p) const { return (p < end_ ? *p : '\0'); }
+	bool Hex(const char *& p, unsigned int& code) const { return (end_ - p >= 4 && ScanHex(p, code)); }
+	void Spaces();
+	bool Scalar();
+	bool Number(const char *& p) const;
+	bool Symbol(const char* t, size_t size);
+	bool String(bool quoted);
+	bool Escape();
+	bool Utf8();
+private:
+	static const size_t LOCAL_DEPTH = 4096;
+	const char* s_;
+	const char* end_; // of the text or at its first '\0'
+	bool strict_;
+	bool utf8_;
+};
+
+TextValidator::TextValidator(const char* text, size_t size, bool strict):
+	s_(text), end_(text + size), strict_(strict), utf8_(ValidateUtf8(strict))
+{
+	const char* nul = static_cast<const char*>(memchr(text, '\0', size));
+	if (nul != NULL) {
+		end_ = nul;
+	}
+}
+
+void TextValidator::Spaces()
+{
+	while (s_ < end_) {
+		if (isspace(*s_)) {
+			++s_;
+		} else if (*s_ == '/' && At(s_ + 1) == '*') {
+			s_ += 2;
+			while (s_ < end_) {
+				if (*s_ == '*' && At(s_ + 1) == '/') {
+					s_ += 2;
+					break;
+				}
+				++s_;
+			}
+		} else {
+			break;
+		}
+	}
+}
+
+bool TextValidator::Document()
+{
+	enum { VALUE, ITEM, NEXT, CLOSE } state = VALUE;
+	size_t maxDepth = Json::MaxDepth();
+	uint64_t local[LOCAL_DEPTH / 64];
+	std::vector<uint64_t> more; // only for a MaxDepth() above LOCAL_DEPTH
+	uint64_t* objects = local;
+	if (maxDepth > LOCAL_DEPTH) {
+		more.resize(maxDepth / 64 + 1);
+		objects = &more[0];
+	}
+	size_t depth = 0;
+	for (;;) {
+		if (state == VALUE) {
+			Spaces();
+			char c = At(s_);
+			if (c == '{' || c == '[') {
+				if (depth >= maxDepth) {
+					return false;
+				}
+				uint64_t bit = 1ULL << (depth % 64);
+				objects[depth / 64] = (c == '{' ? objects[depth / 64] | bit : objects[depth / 64] & ~bit);
+				++depth;
+				++s_;
+				Spaces();
+				state = (At(s_) == (c == '{' ? '}' : ']') ? CLOSE : ITEM);
+			} else if (!Scalar()) {
+				return false;
+			} else if (depth == 0) {
+				break;
+			} else {
+				state = NEXT;
+			}
+			continue;
+		}
+
+		bool object = ((objects[(depth - 1) / 64] >> ((depth - 1) % 64)) & 1);
+		if (state == ITEM) {
+			if (!strict_) {
+				Spaces();
+				if (At(s_) == ',') {
+					++s_;
+					continue;
+				} else if (At(s_) == (object ? '}' : ']')) {
+					state = CLOSE;
+					continue;
+				}
+			}
+			if (object) {
+				if (!String(strict_ || At(s_) == '"')) return false;
+				Spaces();
+				if (At(s_) != ':') return false; else ++s_;
+			}
+			state = VALUE;
+		} else if (state == NEXT) {
+			Spaces();
+			char c = At(s_);
+			if (c == (object ? '}' : ']')) {
+				state = CLOSE;
+			} else if (!object && c == '}') {
+				return false;
+			} else {
+				if (c == ',') {
+					++s_;
+				} else if (strict_ || c == '\0' || c == ':') {
+					return false;
+				}
+				state = ITEM;
+			}
+		} else { // CLOSE
+			++s_;
+			if (--depth == 0) {
+				break;
+			}
+			state = NEXT;
+		}
+	}
+	Spaces();
+	return true;
+}
+
+bool TextValidator::Scalar()
+{
+	Spaces();
+	char c = At(s_);
+	if (c == '"') {
+		return String(true);
+	}
+	if (c == '+' || c == '-' || c == '.' || isdigit(c)) {
+		const char *p = s_;
+		if (Number(p)) {
+			if (strict_ || IsVaidSeparator(At(p))) {
+				s_ = p;
+				return true;
+			}
+		} else if (strict_) {
+			return false;
+		}
+	}
+	if (Symbol(NULL_TEXT, sizeof(NULL_TEXT) - 1) || Symbol(TRUE_TEXT, sizeof(TRUE_TEXT) - 1) ||
+			Symbol(FALSE_TEXT, sizeof(FALSE_TEXT) - 1)) {
+		return true;
+	}
+	return (!strict_ && String(false));
+}
+
+bool TextValidator::Number(const char *& p) const // as ScanNumber()
+{
+	if (At(p) == '-' || At(p) == '+') ++p;
+	if (!isdigit(At(p)) && At(p) != '.') return false; else ++p;
+	while (isdigit(At(p))) ++p;
+	if (At(p) == '.') {
+		++p;
+		while (isdigit(At(p))) ++p;
+	}
+	if (At(p) == 'e' || At(p) == 'E') {
+		++p;
+		if (At(p) == '+' || At(p) == '-') ++p;
+		if (!isdigit(At(p))) return false; else ++p;
+		while (isdigit(At(p))) ++p;
+	}
+	return true;
+}
+
+bool TextValidator::Symbol(const char* t, size_t size) // as MatchSymbol()
+{
+	if (static_cast<size_t>(end_ - s_) >= size && memcmp(s_, t, size) == 0 && IsVaidSeparator(At(s_ + size))) {
+		s_ += size;
+		return true;
+	}
+	return false;
+}
+
+bool TextValidator::String(bool quoted) // as DecodeString()
+{
+	Spaces();
+	if (quoted) {
+		if (At(s_) != '"') return false; else ++s_;
+	}
+	unsigned char stop = (quoted ? STRING_END : SYMBOL_END) | (utf8_ ? NON_ASCII : 0);
+	for (;;) {
+		const char* s = s_; // a local, which the stores of s_ cannot alias
+		while (s < end_ && !(CHAR_CLASS[static_cast<unsigned char>(*s)] & stop)) ++s;
+		s_ = s;
+		if (At(s_) == '\\') {
+			if (!Escape()) return false;
+		} else if (static_cast<unsigned char>(At(s_)) >= 0x80) {
+			if (!Utf8()) return false;
+		} else {
+			break;
+		}
+	}
+	if (quoted) {
+		if (At(s_) != '"') return false; else ++s_;
+	}
+	return true;
+}
+
+bool TextValidator::Escape() // as DecodeEscape()
+{
+	switch (At(++s_)) {
+	case '"':
+	case '\\':
+	case '/':
+	case 'b':
+	case 'f':
+	case 'n':
+	case 'r':
+	case 't': ++s_; return true;
+	case 'u': break;
+	default: return false;
+	}
+	unsigned int code;
+	++s_;
+	if (!Hex(s_, code)) return false;
+	if (code >= 0xD800 && code < 0xDC00 && At(s_) == '\\' && At(s_ + 1) == 'u') {
+		const char *p = s_ + 2;
+		unsigned int low;
+		if (Hex(p, low) && low >= 0xDC00 && low < 0xE000) {
+			code = 0x10000;
+			s_ = p;
+		}
+	}
+	return (code < 0xD800 || code >= 0xE000 || !utf8_);
+}
+
+bool TextValidator::Utf8()
+{
+	char tail[4] = { 0, 0, 0, 0 }; // Utf8Size() may look 3 bytes ahead
+	const char* p = s_;
+	if (end_ - s_ < 4) {
+		memcpy(tail, s_, end_ - s_);
+		p = tail;
+	}
+	size_t size = Utf8Size(p);
+	s_ += size;
+	return (size > 0);
+}
+
+bool Json::Validate(const char* text, size_t size, bool strict, ErrorInfo* error)
+{
+	TextValidator validator(text, size, strict);
+	if (validator.Document() && validator.Position() == text + size) {
+		return true;
+	}
+	if (error != NULL) {
+		error->offset = validator.Position() - text;
+		error->line = 1;
+		const char* line = text;
+		for (const char* p = text; p < validator.Position(); ++p) {
+			if (*p == '\n') {
+				++error->line;
+				line = p + 1;
+			}
+		}
+		error->column = validator.Position() - line + 1;
+	}
+	return false;
+}
+
+void Json::SetMaxDepth(size_t depth)
+{
+	__atomic_store_n(&s_maxDepth, depth, __ATOMIC_RELAXED);
+}
+
+size_t Json::MaxDepth()
+{
+	return __atomic_load_n(&s_maxDepth, __ATOMIC_RELAXED);
+}
+
+void Json::SetUtf8Validation(bool validate)
+{
+	__atomic_store_n(&s_utf8Validation, validate, __ATOMIC_RELAXED);
+}
+
+bool Json::Utf8Validation()
+{
+	return __atomic_load_n(&s_utf8Validation, __ATOMIC_RELAXED);
+}
+
+/*
+ * Typed extraction: the text of a scalar is converted by strto*() rather than
+ * by a stringstream as in AsNumber(), with the same result for any text: out
+ * of range values saturate, a negative one wraps around for an unsigned type
+ * only if its magnitude fits, and anything but a decimal number is 0.
+ */
+template <typename T>
+static inline T SignedText(const char *s)
+{
+	long long n = strtoll(s, NULL, 10); // saturated to the range of long long
+	if (n < std::numeric_limits<T>::min()) {
+		return std::numeric_limits<T>::min();
+	} else if (n > std::numeric_limits<T>::max()) {
+		return std::numeric_limits<T>::max();
+	}
+	return static_cast<T>(n);
+}
+
+template <typename T>
+static inline T UnsignedText(const char *s)
+{
+	while (isspace(static_cast<unsigned char>(*s))) ++s;
+	bool negative = (*s == '-');
+	if (*s == '-' || *s == '+') ++s;
+	if (!isdigit(*s)) { // strtoull() would accept another sign or space here
+		return 0;
+	}
+	errno = 0;
+	unsigned long long n = strtoull(s, NULL, 10); // the magnitude
+	if (errno == ERANGE || n > std::numeric_limits<T>::max()) {
+		return std::numeric_limits<T>::max();
+	}
+	return static_cast<T>(negative ? 0 - n : n);
+}
+
+template <typename T>
+static inline T FloatText(const char *s, T n, const char *p) // n converted from s up to p
+{
+	if (*p == 'e' || *p == 'E') { // an exponent without digits
+		return 0;
+	}
+	for (; s < p; ++s) {
+		if (isalpha(static_cast<unsigned char>(*s)) && *s != 'e' && *s != 'E') { // hex, inf or nan
+			return 0;
+		}
+	}
+	if (n > std::numeric_limits<T>::max()) {
+		return std::numeric_limits<T>::max();
+	} else if (n < -std::numeric_limits<T>::max()) {
+		return -std::numeric_limits<T>::max();
+	}
+	return n;
+}
+
+#define SIGNED_TEXT_VALUE(T) \
+	static inline void TextValue(const char *s, const char *, T& v) { v = SignedText<T>(s); }
+#define UNSIGNED_TEXT_VALUE(T) \
+	static inline void TextValue(const char *s, const char *, T& v) { v = UnsignedText<T>(s); }
+SIGNED_TEXT_VALUE(int16_t)
+SIGNED_TEXT_VALUE(int32_t)
+SIGNED_TEXT_VALUE(int64_t)
+UNSIGNED_TEXT_VALUE(uint16_t)
+UNSIGNED_TEXT_VALUE(uint32_t)
+UNSIGNED_TEXT_VALUE(uint64_t)
+#undef SIGNED_TEXT_VALUE
+#undef UNSIGNED_TEXT_VALUE
+
+// as AsInt8() and AsUint8(), through uint16_t
+static inline void TextValue(const char *s, const char *, int8_t& v)
+{
+	v = static_cast<int8_t>(UnsignedText<uint16_t>(s));
+}
+
+static inline void TextValue(const char *s, const char *, uint8_t& v)
+{
+	v = static_cast<uint8_t>(UnsignedText<uint16_t>(s));
+}
+
+static inline void TextValue(const char *s, const char *, float& v)
+{
+	char *p;
+	float n = strtof(s, &p);
+	v = FloatText(s, n, p);
+}
+
+static inline void TextValue(const char *s, const char *, double& v)
+{
+	char *p;
+	double n = strtod(s, &p);
+	v = FloatText(s, n, p);
+}
+
+static inline void TextValue(const char *s, const char *end, bool& v)
+{
+	size_t size = end - s;
+	v = (size > 0 && !(size == 1 && *s == '0') &&
+			!(size == sizeof(FALSE_TEXT) - 1 && memcmp(s, FALSE_TEXT, size) == 0));
+}
+
+static inline void TextValue(const char *s, const char *end, std::string& v)
+{
+	v.assign(s, end);
+}
+
+template <typename T>
+static inline void SymbolValue(bool b, T& v) // of true and false
+{
+	v = static_cast<T>(b ? 1 : 0);
+}
+
+static inline void SymbolValue(bool b, std::string& v)
+{
+	v = (b ? TRUE_TEXT : FALSE_TEXT);
+}
+
+template <typename T>
+static inline void ContainerValue(const Json&, T& v)
+{
+	v = 0;
+}
+
+static inline void ContainerValue(const Json& j, bool& v)
+{
+	v = j.AsBool();
+}
+
+static inline void ContainerValue(const Json& j, std::string& v)
+{
+	v = j.Dump();
+}
+
+// values are converted into a local first, std::vector<bool> has no bool& to convert into
+template <typename T>
+static inline void Store(std::vector<T>& values, size_t i, T& value)
+{
+	values[i] = value;
+}
+
+static inline void Store(std::vector<std::string>& values, size_t i, std::string& value)
+{
+	values[i].swap(value);
+}
+
+template <typename T>
+static inline void Append(std::vector<T>& values, T& value)
+{
+	values.push_back(value);
+}
+
+static inline void Append(std::vector<std::string>& values, std::string& value)
+{
+	values.push_back(std::string());
+	values.back().swap(value);
+}
+
+template <typename T>
+void Json::ItemValue(const Json& item, T& value) // of a non-null item
+{
+	const Node* node = item.node_;
+	if (node->type == TYPE_NUMBER || node->type == TYPE_STRING) {
+		const char *text = node->text.c_str();
+		TextValue(text, text + node->text.size(), value);
+	} else if (node->type == TYPE_BOOL) {
+		SymbolValue(node->text == TRUE_TEXT, value);
+	} else {
+		ContainerValue(item, value);
+	}
+}
+
+template <typename T>
+bool Json::ExtractTo(std::vector<T>& values) const
+{
+	values.clear();
+	if (Type() != TYPE_ARRAY) {
+		return false;
+	}
+	const std::vector<Json>& array = node_->array;
+	values.resize(array.size()); // null items stay 0, false or ""
+	T value = T();
+	for (size_t i = 0; i < array.size(); ++i) {
+		if (array[i].Type() != TYPE_NULL) {
+			ItemValue(array[i], value);
+			Store(values, i, value);
+		}
+	}
+	return true;
+}
+
+template <typename T>
+static bool ParseItem(const char *& s, T& v, std::string& text, bool strict)
+{
+	if (*s == '"') {
+		if (!DecodeString(s, text, true, ValidateUtf8(strict))) return false;
+		TextValue(text.c_str(), text.c_str() + text.size(), v);
+		return true;
+	}
+	if (*s == '+' || *s == '-' || *s == '.' || isdigit(*s)) {
+		const char *p = s;
+		if (ScanNumber(p) && (strict || IsVaidSeparator(*p))) {
+			TextValue(s, p, v);
+			s = p;
+			return true;
+		} else if (strict) {
+			return false;
+		}
+	}
+	if (MatchSymbol(s, NULL_TEXT, sizeof(NULL_TEXT) - 1)) {
+		v = T();
+		return true;
+	} else if (MatchSymbol(s, TRUE_TEXT, sizeof(TRUE_TEXT) - 1)) {
+		SymbolValue(true, v);
+		return true;
+	} else if (MatchSymbol(s, FALSE_TEXT, sizeof(FALSE_TEXT) - 1)) {
+		SymbolValue(false, v);
+		return true;
+	} else if (strict || *s == '[' || *s == '{') { // only arrays of scalars
+		return false;
+	}
+	const char *p = s;
+	if (!DecodeString(s, text, false, false) || s == p) return false;
+	TextValue(text.c_str(), text.c_str() + text.size(), v);
+	return true;
+}
+
+template <typename T>
+static bool ParseItems(const char *& s, std::vector<T>& values, bool strict)
+{
+	std::string text; // of string items, reused
+	T value = T();
+	SkipSpaces(s);
+	if (*s != '[') return false; else ++s;
+	for (bool first = true; ; first = false) {
+		SkipSpaces(s);
+		if (*s == ']' && (first || !strict)) {
+			++s;
+			return true;
+		} else if (*s == ',' && !strict) {
+			++s;
+			continue;
+		}
+		if (!ParseItem(s, value, text, strict)) return false;
+		Append(values, value);
+		SkipSpaces(s);
+		if (*s == ']') {
+			++s;
+			return true;
+		} else if (*s == ',') {
+			++s;
+		} else if (strict || *s == '\0' || *s == ':') {
+			return false;
+		}
+	}
+}
+
+template <typename T>
+bool Json::ParseVector(const std::string& text, std::vector<T>& values, size_t *pos, bool strict)
+{
+	values.clear();
+	const char *p = text.c_str();
+	bool parsed = ParseItems(p, values, strict);
+	if (parsed) {
+		SkipSpaces(p);
+	}
+	if (pos) *pos = p - text.c_str();
+	return (parsed && !*p);
+}
+
+struct Json::Columns::Column
+{
+	explicit Column(std::vector<bool>* v): valid(v) { }
+	virtual ~Column() { }
+	virtual void Resize(size_t rows) = 0;
+	virtual void Reset(size_t row) = 0; // to a null value
+	virtual void Set(size_t row, const Json& item) = 0; // a non-null item
+	virtual bool Parse(const char *& s, size_t row, std::string& text, bool strict) = 0; // a scalar but null
+	std::vector<bool>* valid;
+};
+
+template <typename T>
+struct Json::Columns::TypedColumn: public Json::Columns::Column
+{
+	TypedColumn(std::vector<T>& v, std::vector<bool>* valid): Column(valid), values(v), value() { }
+	virtual void Resize(size_t rows)
+	{
+		values.resize(rows);
+	}
+	virtual void Reset(size_t row)
+	{
+		values[row] = T();
+	}
+	virtual void Set(size_t row, const Json& item)
+	{
+		ItemValue(item, value);
+		Store(values, row, value);
+	}
+	virtual bool Parse(const char *& s, size_t row, std::string& text, bool strict)
+	{
+		if (!ParseItem(s, value, text, strict)) {
+			return false;
+		}
+		Store(values, row, value);
+		return true;
+	}
+	std::vector<T>& values;
+	T value;
+};
+
+Json::Columns::~Columns()
+{
+	for (size_t i = 0; i < columns_.size(); ++i) {
+		delete columns_[i];
+	}
 }
 
-static bool ParseNumber(const char *& s, Json& v)
+template <typename T>
+Json::Columns& Json::Columns::Add(const std::string& name, std::vector<T>& values, std::vector<bool>* valid)
 {
-	const char *s0 = s;
-	SkipSpaces(s);
-	if (*s == '-' || *s == '+') ++s;
-	if (!isdigit(*s) && *s != '.') return false; else ++s;
-	while (isdigit(*s)) ++s;
-	if (*s == '.') {
-		++s;
-		while (isdigit(*s)) ++s;
+	Column* column = new TypedColumn<T>(values, valid);
+	columns_.push_back(column);
+	index_[name] = column; // replaces an earlier column of the same name
+	cache_.clear();
+	column->Resize(rows_);
+	if (valid != NULL) {
+		valid->assign(rows_, false);
 	}
-	if (*s == 'e' || *s == 'E') {
-		++s;
-		if (*s == '+' || *s == '-') ++s;
-		if (!isdigit(*s)) return false; else ++s;
-		while (isdigit(*s)) ++s;
+	return *this;
+}
+
+void Json::Columns::Resize(size_t rows)
+{
+	rows_ = rows;
+	for (size_t i = 0; i < columns_.size(); ++i) {
+		columns_[i]->Resize(rows);
+		if (columns_[i]->valid != NULL) {
+			columns_[i]->valid->resize(rows, false);
+		}
 	}
-	v.Clear(Json::TYPE_NUMBER, std::string(s0, s));
-	return true;
 }
 
-static bool ParseValue(const char *& s, Json& v, bool strict);
+/*
+ * Records usually have their fields in the same order, so the column of the field
+ * at a position is remembered and a single string comparison finds it next time.
+ */
+Json::Columns::Column* Json::Columns::Find(const std::string& name, size_t position)
+{
+	if (position < cache_.size() && cache_[position].first == name) {
+		return cache_[position].second;
+	}
+	std::map<std::string, Column*>::const_iterator it = index_.find(name);
+	Column* column = (it == index_.end() ? NULL : it->second);
+	if (position >= cache_.size()) {
+		cache_.resize(position + 1);
+	}
+	cache_[position].first = name;
+	cache_[position].second = column;
+	return column;
+}
 
-static bool ParseObject(const char *& s, Json& v, bool strict)
+bool Json::Columns::Extract(const Json& rows)
 {
-	SkipSpaces(s);
-	if (*s != '{') return false; else ++s;
-	SkipSpaces(s);
-	v.Clear(Json::TYPE_OBJECT);
-	if (*s != '}') {
-		for (;;) {
-			if (!strict) {
-				SkipSpaces(s);
-				if (*s == ',') {
-					++s;
-					continue;
-				} else if (*s == '}') {
-					break;
+	Resize(0);
+	if (rows.Type() != TYPE_ARRAY) {
+		return false;
+	}
+	const std::vector<Json>& array = rows.node_->array;
+	Resize(array.size());
+	for (size_t row = 0; row < array.size(); ++row) {
+		const Node* node = array[row].node_;
+		if (node == NULL || node->type == TYPE_NULL) {
+			continue;
+		} else if (node->type != TYPE_OBJECT) {
+			return false;
+		}
+		for (size_t i = 0; i < node->object.size(); ++i) {
+			const Json& value = node->object[i];
+			Column* column = Find(node->array[i].node_->text, i);
+			if (column != NULL && value.Type() != TYPE_NULL) {
+				column->Set(row, value);
+				if (column->valid != NULL) {
+					(*column->valid)[row] = true;
 				}
 			}
-			std::string name;
-			Json o;
-			if (*s != '"' && !strict) {
-				if (!ParseString(s, o, false)) return false;
-			} else {
-				if (!ParseString(s, o)) return false;
-			}
-			name = o.AsString();
-			SkipSpaces(s);
-			if (*s != ':') return false; else ++s;
-			if (!ParseValue(s, o, strict)) return false;
-			SkipSpaces(s);
-			v[name] = o;
-			if (*s == '}') break;
-			if (*s == ',') {
-				++s;
-			} else {
-				if (strict) return false;
-			}
 		}
 	}
-	++s;
 	return true;
 }
 
-static bool ParseArray(const char *& s, Json& v, bool strict)
+bool Json::Columns::Parse(const std::string& text, size_t *pos, bool strict)
+{
+	const char *p = text.c_str();
+	bool parsed = ParseRows(p, strict);
+	if (parsed) {
+		SkipSpaces(p);
+	}
+	if (pos) *pos = p - text.c_str();
+	return (parsed && !*p);
+}
+
+bool Json::Columns::ParseRows(const char *& s, bool strict)
 {
+	std::string name; // of a field
+	std::string text; // of a string value
+	Resize(0);
 	SkipSpaces(s);
 	if (*s != '[') return false; else ++s;
-	SkipSpaces(s);
-	v.Clear(Json::TYPE_ARRAY);
-	if (*s != ']') {
-		for (;;) {
-			if (!strict) {
-				SkipSpaces(s);
-				if (*s == ',') {
-					++s;
-					continue;
-				} else if (*s == ']') {
-					break;
-				}
-			}
-			Json o;
-			if (!ParseValue(s, o, strict)) return false;
-			SkipSpaces(s);
-			v.Insert(o);
-			if (*s == ']') break;
-			if (*s == '}') return false;
-			if (*s == ',') {
-				++s;
-			} else {
-				if (strict) return false;
-			}
+	for (bool first = true; ; first = false) {
+		SkipSpaces(s);
+		if (*s == ']' && (first || !strict)) {
+			++s;
+			return true;
+		} else if (*s == ',' && !strict) {
+			++s;
+			continue;
+		}
+		Resize(rows_ + 1);
+		if (!MatchSymbol(s, NULL_TEXT, sizeof(NULL_TEXT) - 1) && !ParseRow(s, rows_ - 1, name, text, strict)) return false;
+		SkipSpaces(s);
+		if (*s == ']') {
+			++s;
+			return true;
+		} else if (*s == ',') {
+			++s;
+		} else if (strict || *s == '\0' || *s == ':') {
+			return false;
 		}
 	}
-	++s;
-	return true;
 }
 
-static inline bool IsVaidSeparator(char c)
+bool Json::Columns::ParseRow(const char *& s, size_t row, std::string& name, std::string& text, bool strict)
 {
-	return (c == '\0' || strchr(",]} \t\n\r", c) != NULL);
+	if (*s != '{') return false; else ++s;
+	for (size_t position = 0; ; ) {
+		SkipSpaces(s);
+		if (*s == '}' && (position == 0 || !strict)) {
+			++s;
+			return true;
+		} else if (*s == ',' && !strict) {
+			++s;
+			continue;
+		}
+		if (!DecodeString(s, name, strict || *s == '"', ValidateUtf8(strict))) return false;
+		SkipSpaces(s);
+		if (*s != ':') return false; else ++s;
+		SkipSpaces(s);
+		Column* column = Find(name, position++);
+		bool valid = true;
+		if (*s == '[' || *s == '{') { // only a nested value is built
+			Json value;
+			if (!value.ParseValue(s, strict)) return false;
+			if (column != NULL) column->Set(row, value);
+		} else if (MatchSymbol(s, NULL_TEXT, sizeof(NULL_TEXT) - 1)) {
+			valid = false;
+			if (column != NULL) column->Reset(row); // a duplicate field replaces the earlier one
+		} else if (column != NULL) {
+			if (!column->Parse(s, row, text, strict)) return false;
+		} else if (!ParseItem(s, name, text, strict)) { // skipped
+			return false;
+		}
+		if (column != NULL && column->valid != NULL) {
+			(*column->valid)[row] = valid;
+		}
+		SkipSpaces(s);
+		if (*s == '}') {
+			++s;
+			return true;
+		} else if (*s == ',') {
+			++s;
+		} else if (strict || *s == '\0' || *s == ':') {
+			return false;
+		}
+	}
 }
 
-static inline bool MatchSymbol(const char *& s, const char *t, size_t size)
+template <typename T>
+bool Json::Get(T& value) const
 {
-	if (memcmp(s, t, size) == 0 && IsVaidSeparator(s[size])) {
-		s += size;
-		return true;
+	if (Type() == TYPE_NULL) {
+		return false;
 	}
-	return false;
+	ItemValue(*this, value);
+	return true;
 }
 
-static bool ParseValue(const char *& s, Json& v, bool strict)
+void Json::ScanSpaces(const char *& s)
 {
 	SkipSpaces(s);
-	if (*s == '"') {
-		return ParseString(s, v);
+}
+
+template <typename T>
+bool Json::ScanValue(const char *& s, T& value, bool strict)
+{
+	SkipSpaces(s);
+	if (MatchSymbol(s, NULL_TEXT, sizeof(NULL_TEXT) - 1)) {
+		return true;
 	}
-	if (*s == '+' || *s == '-' || *s == '.' || isdigit(*s)) {
-		const char *p = s;
-		if (ParseNumber(p, v)) {
-			if (strict) {
-				s = p;
-				return true;
+	std::string text;
+	return ParseItem(s, value, text, strict);
+}
+
+bool Json::ScanString(const char *& s, std::string& text)
+{
+	return DecodeString(s, text, true, ValidateUtf8(true));
+}
+
+bool Json::SkipValue(const char *& s)
+{
+	std::string closing; // brackets of the containers entered
+	std::string text;
+	std::string value;
+	size_t maxDepth = MaxDepth();
+	bool utf8 = ValidateUtf8(true);
+	for (;;) {
+		SkipSpaces(s);
+		if (*s == '[' || *s == '{') {
+			if (closing.size() >= maxDepth) return false;
+			closing += (*s == '[' ? ']' : '}');
+			++s;
+			SkipSpaces(s);
+			if (*s != closing[closing.size() - 1]) { // the first item
+				if (closing[closing.size() - 1] == '}') {
+					if (!DecodeString(s, text, true, utf8)) return false;
+					SkipSpaces(s);
+					if (*s != ':') return false; else ++s;
+				}
+				continue;
 			}
-			if (IsVaidSeparator(*p)) {
-				s = p;
+		} else if (!ParseItem(s, value, text, true)) {
+			return false;
+		}
+
+		for (;;) { // after a value, close the containers it has completed
+			if (closing.empty()) {
 				return true;
 			}
-		} else if (strict) {
-			return false;
+			SkipSpaces(s);
+			char close = closing[closing.size() - 1];
+			if (*s == close) {
+				++s;
+				closing.erase(closing.size() - 1);
+				continue;
+			}
+			if (*s != ',') return false; else ++s;
+			if (close == '}') {
+				if (!DecodeString(s, text, true, utf8)) return false;
+				SkipSpaces(s);
+				if (*s != ':') return false; else ++s;
+			}
+			break;
 		}
-		// otherwise, try to parse as string
-	}
-	if (*s == '{') {
-		return ParseObject(s, v, strict);
-	} else if (*s == '[') {
-		return ParseArray(s, v, strict);
-	} else if (MatchSymbol(s, NULL_TEXT, sizeof(NULL_TEXT) - 1)) {
-		v.Clear();
-		return true;
-	} else if (MatchSymbol(s, TRUE_TEXT, sizeof(TRUE_TEXT) - 1)) {
-		v = true;
-		return true;
-	} else if (MatchSymbol(s, FALSE_TEXT, sizeof(FALSE_TEXT) - 1)) {
-		v = false;
-		return true;
-	} else if (!strict) {
-		return ParseString(s, v, false);
-	} else {
-		return false;
 	}
 }
 
-bool Json::Parse(const std::string& text, size_t *pos, bool strict)
+void Json::AppendString(std::string& out, const std::string& text, bool unicode)
 {
-	const char *p = text.c_str();
-	if (!ParseValue(p, *this, strict)) {
-		if (pos) *pos = p - text.c_str();
-		return false;
-	}
-	SkipSpaces(p);
-	if (pos) *pos = p - text.c_str();
-	return (!*p);
+	out += '"';
+	AppendEncoded(out, text, unicode);
+	out += '"';
+}
+
+// the same text as 'std::ostream << value' in the assignment operators
+static inline void AppendFormatted(std::string& out, const char* format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static inline void AppendFormatted(std::string& out, const char* format, ...)
+{
+	char text[64];
+	va_list args;
+	va_start(args, format);
+	int size = vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	out.append(text, std::min(static_cast<size_t>(std::max(size, 0)), sizeof(text) - 1));
 }
 
+template <typename T>
+void Json::AppendValue(std::string& out, T value) // two digits at a time rather than by printf()
+{
+	static const char DIGITS[] =
+		"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+		"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+	char text[24];
+	char* end = text + sizeof(text);
+	char* p = end;
+	uint64_t u = static_cast<uint64_t>(value);
+	bool negative = (static_cast<T>(-1) < 0 && static_cast<int64_t>(value) < 0);
+	if (negative) {
+		u = 0 - u;
+	}
+	while (u >= 100) {
+		p -= 2;
+		memcpy(p, DIGITS + (u % 100) * 2, 2);
+		u /= 100;
+	}
+	if (u >= 10) {
+		p -= 2;
+		memcpy(p, DIGITS + u * 2, 2);
+	} else {
+		*--p = static_cast<char>('0' + u);
+	}
+	if (negative) {
+		*--p = '-';
+	}
+	out.append(p, end - p);
+}
+
+template <>
+void Json::AppendValue(std::string& out, bool value)
+{
+	out += (value ? TRUE_TEXT : FALSE_TEXT);
+}
+
+template <>
+void Json::AppendValue(std::string& out, float value)
+{
+	AppendFormatted(out, "%g", static_cast<double>(value));
+}
+
+template <>
+void Json::AppendValue(std::string& out, double value)
+{
+	AppendFormatted(out, "%g", value);
+}
+
+#define INSTANTIATE_SCALAR(T) \
+	template bool Json::Get(T& value) const; \
+	template bool Json::ScanValue(const char *& s, T& value, bool strict);
+#define INSTANTIATE_NUMBER(T) \
+	INSTANTIATE_SCALAR(T) \
+	template void Json::AppendValue(std::string& out, T value);
+INSTANTIATE_SCALAR(bool)
+INSTANTIATE_NUMBER(int8_t)
+INSTANTIATE_NUMBER(int16_t)
+INSTANTIATE_NUMBER(int32_t)
+INSTANTIATE_NUMBER(int64_t)
+INSTANTIATE_NUMBER(uint8_t)
+INSTANTIATE_NUMBER(uint16_t)
+INSTANTIATE_NUMBER(uint32_t)
+INSTANTIATE_NUMBER(uint64_t)
+INSTANTIATE_SCALAR(float)
+INSTANTIATE_SCALAR(double)
+INSTANTIATE_SCALAR(std::string)
+#undef INSTANTIATE_SCALAR
+#undef INSTANTIATE_NUMBER
+
+#define INSTANTIATE_VECTOR(T) \
+	template bool Json::ExtractTo(std::vector<T>& values) const; \
+	template bool Json::ParseVector(const std::string& text, std::vector<T>& values, size_t *pos, bool strict); \
+	template Json::Columns& Json::Columns::Add(const std::string& name, std::vector<T>& values, std::vector<bool>* valid);
+INSTANTIATE_VECTOR(bool)
+INSTANTIATE_VECTOR(int8_t)
+INSTANTIATE_VECTOR(int16_t)
+INSTANTIATE_VECTOR(int32_t)
+INSTANTIATE_VECTOR(int64_t)
+INSTANTIATE_VECTOR(uint8_t)
+INSTANTIATE_VECTOR(uint16_t)
+INSTANTIATE_VECTOR(uint32_t)
+INSTANTIATE_VECTOR(uint64_t)
+INSTANTIATE_VECTOR(float)
+INSTANTIATE_VECTOR(double)
+INSTANTIATE_VECTOR(std::string)
+#undef INSTANTIATE_VECTOR
+
 bool Json::Load(const std::string& filename, bool strict)
 {
-	std::ifstream file(filename.c_str(), std::ios::in);
-	if (!file.is_open()) {
-		std::cerr << "cannot open input json file '" << filename << "'" << std::endl;
+	std::string error;
+	size_t bytes = 0;
+	if (!LoadFile(filename, strict, error, bytes)) {
+		std::cerr << error << std::endl;
 		return false;
 	}
+	return true;
+}
+
+bool Json::LoadFile(const std::string& filename, bool strict, std::string& error, size_t& bytes)
+{
 	std::string text;
-	std::string line;
-	while (std::getline(file, line)) {
-		text += line;
+	if (!JsonCodec::ReadFile(filename, text)) {
+		error = "cannot read input json file '" + filename + "'";
+		return false;
 	}
+	bytes = text.size();
 	size_t pos = 0;
 	if (!Parse(text, &pos, strict)) {
-		std::cerr << "invalid json format in file '" << filename << "'" << std::endl;
+		error = "invalid json format in file '" + filename + "'";
 		return false;
 	}
 	if (pos != text.size()) {
-		std::cerr << "unexpected character after json in file '" << filename << "'" << std::endl;
+		error = "unexpected character after json in file '" + filename + "'";
 		return false;
 	}
 	return true;
 }
 
+/*
+ * Bulk loading: the threads take the next file to load from a shared counter,
+ * so a few big files do not hold up the rest. Each file is read by plain
+ * blocking I/O, overlapped with the reading and parsing of the other threads.
+ */
+struct Json::LoadJob
+{
+	std::vector<LoadResult>* results;
+	bool strict;
+	size_t next;
+};
+
+void* Json::LoadWorker(void* arg)
+{
+	LoadJob* job = static_cast<LoadJob*>(arg);
+	for (;;) {
+		size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+		if (i >= job->results->size()) {
+			break;
+		}
+		LoadResult& result = (*job->results)[i];
+		result.loaded = result.json.LoadFile(result.filename, job->strict, result.error, result.bytes);
+		if (!result.loaded) {
+			result.json = Json();
+		}
+	}
+	return NULL;
+}
+
+static double Seconds()
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec / 1e6;
+}
+
+size_t Json::LoadMany(const std::vector<std::string>& filenames, std::vector<LoadResult>& results, size_t threads,
+		bool strict, LoadStats* stats)
+{
+	double start = Seconds();
+	results.clear();
+	results.resize(filenames.size());
+	for (size_t i = 0; i < filenames.size(); ++i) {
+		results[i].filename = filenames[i];
+		results[i].loaded = false;
+		results[i].bytes = 0;
+	}
+	LoadJob job;
+	job.results = &results;
+	job.strict = strict;
+	job.next = 0;
+	RunThreads(LoadWorker, &job, std::max(std::min(ThreadCount(threads), results.size()), static_cast<size_t>(1)));
+
+	size_t loaded = 0;
+	uint64_t bytes = 0;
+	for (size_t i = 0; i < results.size(); ++i) {
+		loaded += results[i].loaded;
+		bytes += results[i].bytes;
+	}
+	if (stats != NULL) {
+		stats->files = results.size();
+		stats->failed = results.size() - loaded;
+		stats->bytes = bytes;
+		stats->seconds = Seconds() - start;
+	}
+	return loaded;
+}
+
+static bool IsJsonFile(const std::string& name)
+{
+	const char* const SUFFIXES[] = { ".json", ".json.gz", ".json.zst" };
+	for (size_t i = 0; i < sizeof(SUFFIXES) / sizeof(SUFFIXES[0]); ++i) {
+		size_t size = strlen(SUFFIXES[i]);
+		if (name.size() > size && name.compare(name.size() - size, size, SUFFIXES[i]) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t Json::LoadDirectory(const std::string& dir, std::vector<LoadResult>& results, size_t threads, bool strict,
+		LoadStats* stats)
+{
+	std::vector<std::string> filenames;
+	DIR* d = opendir(dir.c_str());
+	if (d == NULL) { // a failed result of the directory itself
+		LoadResult failed;
+		failed.filename = dir;
+		failed.loaded = false;
+		failed.error = "cannot open json directory '" + dir + "'";
+		failed.bytes = 0;
+		results.assign(1, failed);
+		if (stats != NULL) {
+			stats->files = 1;
+			stats->failed = 1;
+			stats->bytes = 0;
+			stats->seconds = 0;
+		}
+		return 0;
+	}
+	for (struct dirent* e = readdir(d); e != NULL; e = readdir(d)) {
+		if (e->d_name[0] != '.' && IsJsonFile(e->d_name)) {
+			filenames.push_back(dir + "/" + e->d_name);
+		}
+	}
+	closedir(d);
+	std::sort(filenames.begin(), filenames.end());
+	return LoadMany(filenames, results, threads, strict, stats);
+}
+
 bool Json::Save(const std::string& filename, bool autoCreateDirectory) const
 {
-	if (autoCreateDirectory) {
-		char* p = strdup(filename.c_str());
-		if (p) {
-			mkdir(dirname(p), 0755);
-			free(p);
+	return Save(filename, autoCreateDirectory ? SAVE_CREATE_DIRECTORY : 0);
+}
+
+const size_t SAVE_BUFFER_SIZE = 1 << 20;
+static long s_saves = 0; // for unique temporary files
+
+static bool MakeDirectories(const std::string& dir) // as mkdir -p
+{
+	for (size_t slash = dir.find('/', 1); ; slash = dir.find('/', slash + 1)) {
+		if (mkdir(dir.substr(0, slash).c_str(), 0755) != 0 && errno != EEXIST) {
+			return false;
+		} else if (slash == std::string::npos) {
+			return true;
+		}
+	}
+}
+
+static bool WriteAll(int fd, const char* data, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = write(fd, data, size);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			return false;
 		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool SyncDirectory(const std::string& dir)
+{
+	int fd = open(dir.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	bool synced = (fsync(fd) == 0);
+	close(fd);
+	return synced;
+}
+
+/*
+ * The text is serialized chunk by chunk into a temporary file next to the
+ * target, which then replaces it by rename(), so that readers and crashes see
+ * either the old or the new file, never a truncated one. Files named *.gz or
+ * *.zst are compressed on the way, see JsonCodec.h.
+ */
+bool Json::Save(const std::string& filename, int flags) const
+{
+	size_t slash = filename.find_last_of('/');
+	std::string dir = (slash == std::string::npos ? "." : slash == 0 ? "/" : filename.substr(0, slash));
+	if ((flags & SAVE_CREATE_DIRECTORY) && !MakeDirectories(dir)) {
+		std::cerr << "cannot create directory of output json file '" << filename << "'" << std::endl;
+		return false;
 	}
 
-	std::ofstream file(filename.c_str(), std::ios::out);
-	if (!file.is_open()) {
+	JsonCodec::Format format = JsonCodec::FromName(filename);
+	if (!JsonCodec::Supported(format)) {
+		std::cerr << "no support of compression for output json file '" << filename << "'" << std::endl;
+		return false;
+	}
+
+	std::string temp;
+	int fd = -1;
+	for (int i = 0; i < 100 && fd < 0; ++i) {
+		temp = filename + ".tmp." + ToString(getpid()) + "." + ToString(__atomic_add_fetch(&s_saves, 1, __ATOMIC_RELAXED));
+		fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+		if (fd < 0 && errno != EEXIST) {
+			break;
+		}
+	}
+	if (fd < 0) {
 		std::cerr << "cannot open output json file '" << filename << "'" << std::endl;
 		return false;
 	}
-	file << Format(0, "\t", "\n", false, false) << std::endl; // avoid omitting long strings
-	file.close();
+	struct stat st;
+	if (stat(filename.c_str(), &st) == 0) {
+		fchmod(fd, st.st_mode & 07777); // keep the mode of the file replaced
+	}
+
+	bool compact = (flags & SAVE_COMPACT);
+	Serializer serializer(*this, 0, (compact ? "" : "\t"), (compact ? "" : "\n"));
+	JsonCodec codec(format, true);
+	std::vector<char> buffer(SAVE_BUFFER_SIZE);
+	std::string compressed;
+	bool written = true;
+	while (written && !serializer.Done()) {
+		size_t size = serializer.Fill(&buffer[0], buffer.size());
+		if (serializer.Done()) {
+			buffer.resize(size + 1);
+			buffer[size++] = '\n';
+		}
+		if (format == JsonCodec::FORMAT_NONE) {
+			written = WriteAll(fd, &buffer[0], size);
+		} else {
+			compressed.clear();
+			written = codec.Update(&buffer[0], size, compressed) && (!serializer.Done() || codec.Finish(compressed))
+				&& WriteAll(fd, compressed.data(), compressed.size());
+		}
+	}
+	if (written && (flags & SAVE_SYNC)) {
+		written = (fsync(fd) == 0);
+	}
+	written = (close(fd) == 0) && written;
+	if (!written || rename(temp.c_str(), filename.c_str()) != 0) {
+		std::cerr << "cannot write output json file '" << filename << "'" << std::endl;
+		unlink(temp.c_str());
+		return false;
+	}
+	if ((flags & SAVE_SYNC) && !SyncDirectory(dir)) { // makes the rename durable
+		std::cerr << "cannot sync directory of output json file '" << filename << "'" << std::endl;
+		return false;
+	}
 	return true;
 }
 
@@ -823,7 +3189,7 @@ Json::Iterator::Iterator(): json_(NULL), index_(0)
 std::string Json::Iterator::Name() const
 {
 	if (json_ && json_->Type() == Json::TYPE_OBJECT) {
-		return json_->array_.at(index_).AsString();
+		return json_->node_->array.at(index_).AsString();
 	}
 	return "";
 }
@@ -831,9 +3197,11 @@ std::string Json::Iterator::Name() const
 Json& Json::Iterator::operator * () const
 {
 	if (json_ && json_->Type() == Json::TYPE_OBJECT) {
-		return json_->object_.at(json_->array_.at(index_).AsString());
+		Node* node = json_->Expose();
+		return Child(node, node->object.at(index_));
 	} else if (json_ && json_->Type() == Json::TYPE_ARRAY) {
-		return json_->array_.at(index_);
+		Node* node = json_->Expose();
+		return Child(node, node->array.at(index_));
 	} else {
 		throw std::runtime_error("unexpected json type");
 	}
@@ -849,7 +3217,7 @@ bool Json::Iterator::operator == (const Iterator& it) const
 
 Json::Iterator& Json::Iterator::operator ++ ()  // only support '++it', but no 'it++' at all.
 {
-	if (index_ < json_->array_.size()) {
+	if (json_->node_ && index_ < json_->node_->array.size()) {
 		++index_;
 	}
 	return *this;
@@ -867,7 +3235,7 @@ Json::ConstIterator::ConstIterator(const Iterator& it): json_(it.json_), index_(
 std::string Json::ConstIterator::Name() const
 {
 	if (json_ && json_->Type() == Json::TYPE_OBJECT) {
-		return json_->array_.at(index_).AsString();
+		return json_->node_->array.at(index_).AsString();
 	}
 	return "";
 }
@@ -875,9 +3243,9 @@ std::string Json::ConstIterator::Name() const
 const Json& Json::ConstIterator::operator * () const
 {
 	if (json_ && json_->Type() == Json::TYPE_OBJECT) {
-		return json_->object_.at(json_->array_.at(index_).AsString());
+		return json_->node_->object.at(index_);
 	} else if (json_ && json_->Type() == Json::TYPE_ARRAY) {
-		return json_->array_.at(index_);
+		return json_->node_->array.at(index_);
 	} else {
 		return Null();
 	}
@@ -893,7 +3261,7 @@ bool Json::ConstIterator::operator == (const ConstIterator& it) const
 
 Json::ConstIterator& Json::ConstIterator::operator ++ ()  // only support '++it', but no 'it++' at all.
 {
-	if (index_ < json_->array_.size()) {
+	if (json_->node_ && index_ < json_->node_->array.size()) {
 		++index_;
 	}
 	return *this;
@@ -911,7 +3279,7 @@ Json::Iterator Json::End()
 {
 	Iterator it;
 	it.json_ = this;
-	it.index_ = array_.size();
+	it.index_ = (node_ ? node_->array.size() : 0);
 	return it;
 }
 
@@ -927,7 +3295,7 @@ Json::ConstIterator Json::End() const
 {
 	ConstIterator it;
 	it.json_ = this;
-	it.index_ = array_.size();
+	it.index_ = (node_ ? node_->array.size() : 0);
 	return it;
 }
 
@@ -966,6 +3334,36 @@ Json Json::Query(const std::string& path) const
 	return res;
 }
 
+Json Json::Query(const std::vector<JsonKey>& path) const
+{
+	return QueryFrom(path, 0);
+}
+
+Json Json::QueryFrom(const std::vector<JsonKey>& path, size_t from) const
+{
+	Json res;
+	if (from == path.size()) {
+		res = *this;
+	} else if (path[from].Name() == "*") {
+		for (Json::ConstIterator it = Begin(); it != End(); ++it) {
+			Json sub = it->QueryFrom(path, from + 1);
+			if (sub.Type() == Json::TYPE_ARRAY) {
+				for (size_t i = 0; i < sub.Size(); ++i) {
+					res += sub[i];
+				}
+			} else {
+				res += sub;
+			}
+		}
+	} else if (Type() == Json::TYPE_ARRAY) {
+		size_t index = Json(path[from].Name()).AsUint32();
+		res = Sub(index).QueryFrom(path, from + 1);
+	} else {
+		res = Sub(path[from]).QueryFrom(path, from + 1);
+	}
+	return res;
+}
+
 Json J(const std::string& s)
 {
 	Json res;
@@ -10,6 +10,13 @@
 #include <stdint.h>
 #include <stdexcept>
 
+class JsonKey;
+
+/*
+ * Thread safety: all const member functions (Sub, Query, Dump, As*, iterators, ...)
+ * only read the document, so any number of threads may call them concurrently on
+ * the same Json as long as no thread modifies it at the same time.
+ */
 class Json // Implemented according to: http://www.json.org/
 {
 public:
@@ -33,6 +40,11 @@ public:
 	explicit Json(const char* v, JsonType type = TYPE_STRING);
 	explicit Json(const std::string& v, JsonType type = TYPE_STRING);
 	Json(const Json& j);
+#if __cplusplus >= 201103L
+	Json(Json&& j) noexcept : node_(j.node_) { j.node_ = NULL; }
+	Json& operator = (Json&& j) noexcept { Swap(j); return *this; }
+#endif
+	~Json();
 
 	static const Json& Null(); // enable to generate a 'const Json&' null object
 	bool EqualTo(const Json& j) const;
@@ -41,8 +53,11 @@ public:
 	Json& Sub(const std::string& name);
 	const Json& Sub(size_t index) const;
 	const Json& Sub(const std::string& name) const;
+	Json& Sub(const JsonKey& key);
+	const Json& Sub(const JsonKey& key) const;
 
 	void Clone(const Json& j);
+	void Swap(Json& j); // O(1), exchanges the contents of two nodes
 	void Clear(JsonType type = TYPE_NULL, const std::string& text = "");
 	void Insert(const Json& value, size_t before = ~(size_t)0);
 	void Insert(const std::string& key, const Json& value, size_t before = ~(size_t)0);
@@ -50,6 +65,7 @@ public:
 	void Move(const std::string& key, size_t before = ~(size_t)0);
 	void Erase(size_t pos);
 	void Erase(const std::string& name);
+	void Erase(const JsonKey& key);
 
 	bool operator == (const Json& j) const { return EqualTo(j); }
 	bool operator != (const Json& j) const { return !EqualTo(j); }
@@ -73,11 +89,13 @@ public:
 	Json& operator [] (const std::string& name) { return Sub(name); }
 	const Json& operator [] (size_t index) const { return Sub(index); }
 	const Json& operator [] (const std::string& name) const { return Sub(name); }
+	Json& operator [] (const JsonKey& key) { return Sub(key); }
+	const Json& operator [] (const JsonKey& key) const { return Sub(key); }
 
 	template <typename T>
 	Json& operator += (T v) { Json node; node = v; Insert(node); return *this; }
 
-	JsonType Type() const { return type_; }
+	JsonType Type() const;
 
 	bool        AsBool()   const;
 	int8_t      AsInt8()   const { return static_cast<int8_t>(AsNumber<uint16_t>()); } /* To avoid getting ASCII */
@@ -91,27 +109,152 @@ public:
 	float       AsFloat()  const { return AsNumber<float>(); }
 	double      AsDouble() const { return AsNumber<double>(); }
 	std::string AsString() const;
+	// all items of an array converted as by As*() in one pass, T is any of the types above
+	template <typename T> bool ExtractTo(std::vector<T>& values) const; // false (and no values) if not an array
+	template <typename T> std::vector<T> AsVector() const { std::vector<T> values; ExtractTo(values); return values; }
+	template <typename T> bool Get(T& value) const; // as by As*() into value, false (value unchanged) if null
 public:
 	size_t Size() const;
 	std::vector<std::string> Keys() const;
 	bool Has(const std::string& name) const;
+	bool Has(const JsonKey& key) const;
 	bool HasAndNotEmpty(const std::string& name) const;
+public:
+	void SetPersistent(bool persistent = true); // copies share nodes until modified, see README
+	bool IsPersistent() const;
 public:
 	Json Query(const std::string& path) const;
+	Json Query(const std::vector<JsonKey>& path) const; // the components of a path, e.g. JsonKey("*")
 public:
 	bool Parse(const std::string& text, size_t *pos = NULL, bool strict = false);
-	bool Load(const std::string& filename, bool strict = false);
+	// an array of scalars parsed straight into values as ExtractTo() would, without building any node
+	template <typename T> static bool ParseVector(const std::string& text, std::vector<T>& values, size_t *pos = NULL, bool strict = false);
+	struct ErrorInfo // where text stopped being valid json
+	{
+		size_t offset; // as the pos of Parse()
+		size_t line;   // from 1
+		size_t column; // from 1, in bytes
+	};
+	// whether Parse() would accept the text, without building anything (nor allocating unless MaxDepth() > 4096); error is set if not
+	static bool Validate(const char* text, size_t size, bool strict = false, ErrorInfo* error = NULL);
+public: // scanning and writing json text without any node, e.g. for the struct binding of JsonBind.h
+	static void ScanSpaces(const char *& s);
+	template <typename T> static bool ScanValue(const char *& s, T& value, bool strict = true); // a scalar, null leaves value unchanged
+	static bool ScanString(const char *& s, std::string& text); // a quoted string
+	static bool SkipValue(const char *& s); // any (strict) value
+	static void AppendString(std::string& out, const std::string& text, bool unicode = false); // quoted as by Dump()
+	template <typename T> static void AppendValue(std::string& out, T value); // a number or bool as by Dump()
+	static void SetMaxDepth(size_t depth); // deeper nested arrays and objects fail to parse, 1024 by default
+	static size_t MaxDepth();
+	static void SetUtf8Validation(bool validate); // strings of strict text must be well-formed UTF-8, true by default
+	static bool Utf8Validation();
+	bool Load(const std::string& filename, bool strict = false); // gzip or zstd files are decompressed, see JsonCodec.h
+	struct LoadResult; // of one file of LoadMany(), see below
+	struct LoadStats // of all the files of LoadMany()
+	{
+		size_t files;
+		size_t failed;
+		uint64_t bytes;
+		double seconds;    // of wall time
+		double Throughput() const { return seconds > 0 ? bytes / seconds : 0; } // bytes per second
+	};
+	// loads the files concurrently by the given threads (0 for all CPUs), returns how many were loaded
+	static size_t LoadMany(const std::vector<std::string>& filenames, std::vector<LoadResult>& results,
+			size_t threads = 0, bool strict = false, LoadStats* stats = NULL);
+	// LoadMany() of the *.json (and *.json.gz, *.json.zst) files of a directory, in the order of their names;
+	// if the directory cannot be read, the only result is a failed one of the directory
+	static size_t LoadDirectory(const std::string& dir, std::vector<LoadResult>& results,
+			size_t threads = 0, bool strict = false, LoadStats* stats = NULL);
+	enum SaveFlags {
+		SAVE_CREATE_DIRECTORY = 1, // creates the missing parent directories
+		SAVE_COMPACT = 2,          // as Dump() rather than Format()
+		SAVE_SYNC = 4              // the file and the directory are on disk before Save() returns
+	};
+	// replaces the file atomically, the old file is kept on failure; *.gz and *.zst files are compressed
 	bool Save(const std::string& filename, bool autoCreateDirectory = false) const;
+	bool Save(const std::string& filename, int flags) const; // of SaveFlags
 public:
 	std::string Dump(size_t indent = 0, const std::string& sp = "", const std::string& eol = "", bool unicode = false, bool omitLongString = false) const;
 	std::string DumpU(size_t indent = 0, const std::string& sp = "", const std::string& eol = "", bool omitLongString = false) const { return Dump(indent, sp, eol, true, omitLongString); }
 	std::string Format(size_t indent = 0, const std::string& sp = "\t", const std::string& eol = "\n", bool unicode = false, bool omitLongString = true) const { return Dump(indent, sp, eol, unicode, omitLongString); }
 	std::string FormatU(size_t indent = 0, const std::string& sp = "\t", const std::string& eol = "\n", bool omitLongString = true) const { return Format(indent, sp, eol, true, omitLongString); }
+	// Same output as Dump() and Format(), but big containers are serialized by several threads (0 for all CPUs)
+	std::string DumpParallel(size_t threads, size_t indent = 0, const std::string& sp = "", const std::string& eol = "", bool unicode = false, bool omitLongString = false) const;
+	std::string FormatParallel(size_t threads, size_t indent = 0, const std::string& sp = "\t", const std::string& eol = "\n", bool unicode = false, bool omitLongString = true) const { return DumpParallel(threads, indent, sp, eol, unicode, omitLongString); }
+public:
+	struct Stats // of the calling thread, only counted if NpJson is built with NPJSON_STATS defined
+	{
+		uint64_t allocations;    // calls of operator new (by any code of the thread)
+		uint64_t bytes;          // allocated by them
+		uint64_t nodesCreated;   // including copies
+		uint64_t nodesCopied;
+		uint64_t nodesDestroyed;
+		uint64_t stringCopies;   // of node text, by AsString(), Keys(), ... and copied nodes
+	};
+	static bool HasStats();
+	static Stats GetStats();
+	static void ResetStats();
+public:
+	struct Usage // bytes of heap memory held by a document
+	{
+		size_t nodes;      // headers of all values
+		size_t strings;    // text of the values
+		size_t containers; // used element storage of arrays and objects
+		size_t slack;      // unused capacity of arrays and strings
+		size_t keys;       // object keys (nodes shared by several objects are counted once) and their hash indexes
+		size_t Total() const { return nodes + strings + containers + slack + keys; }
+	};
+	Usage MemoryUsage() const; // nodes shared by persistent copies are counted once
+	void ShrinkToFit(); // releases unused capacity, nodes shared with other documents are left alone
+	// makes the document persistent and shares its identical subtrees and values, returns the bytes saved
+	size_t Deduplicate();
 private:
-	JsonType type_;
-	std::string text_;
-	std::vector<Json> array_;
-	std::map<std::string, Json> object_;
+	struct Node;
+	Node* node_; // NULL for a plain null value
+
+	Node* Mutable();
+	Node* Expose();
+	static Json& Child(Node* parent, Json& sub);
+	static Node* Copy(Node* node, bool persistent);
+	static Node* Duplicate(const Node* node, bool persistent);
+	static void CopyTo(Node* node, Json& j, bool persistent, std::vector<std::pair<const Node*, Node*> >& pending);
+	static bool Shared(const Node* node);
+	static void Release(Node* node);
+	static void ReleaseLater(Node*& node, std::vector<Node*>& pending);
+	static void MarkPersistent(Json& j, bool persistent);
+	static bool EqualShallow(const Json& a, const Json& b, std::vector<std::pair<const Json*, const Json*> >& pending);
+	template <typename T> static void ItemValue(const Json& item, T& value);
+	static uint32_t HashKey(const std::string& name);
+	// npos if missing, shared is the interned node of name if known, hash is computed if NULL
+	static size_t FindKey(const Node* node, const std::string& name, const Node* shared, const uint32_t* hash);
+	static Json& AddKey(Node* node, Json& key); // swaps the key in and returns the slot of its value
+	static void IndexKeys(Node* node);
+	static const Json* RegisterKey(const std::string& name);
+	static const Json* RegisteredKey(const std::string& name, uint32_t hash);
+	static void InternKey(const std::string& name, uint32_t hash, Json& key);
+	static uint64_t ShallowHash(const Node* node);
+	static bool SameShallow(const Node* a, const Node* b);
+	Json& Sub(const std::string& name, const JsonKey* key);
+	const Json& Sub(const std::string& name, const JsonKey* key) const;
+	void Erase(const std::string& name, const JsonKey* key);
+	Json QueryFrom(const std::vector<JsonKey>& path, size_t from) const;
+	bool ParseValue(const char *& s, bool strict);
+
+	struct DumpStyle;
+	struct DumpTask;
+	struct DumpJob;
+	void DumpTo(std::string& out, size_t indent, const DumpStyle& style) const;
+	void DumpScalar(std::string& out, const DumpStyle& style) const;
+	void DumpItems(std::string& out, size_t begin, size_t end, size_t indent, const DumpStyle& style) const;
+	size_t Weight(size_t limit) const;
+	void PlanDump(std::vector<DumpTask>& tasks, size_t indent, const DumpStyle& style, size_t threads, size_t depth) const;
+	static void AddDumpText(std::vector<DumpTask>& tasks, const std::string& text);
+	static void AddDumpItems(std::vector<DumpTask>& tasks, const Json* json, size_t begin, size_t end, size_t indent);
+	static void RunDumpWorkers(DumpJob& job, size_t threads);
+	static void* DumpWorker(void* arg);
+	struct LoadJob;
+	bool LoadFile(const std::string& filename, bool strict, std::string& error, size_t& bytes);
+	static void* LoadWorker(void* arg);
 public:
 	class Iterator
 	{
@@ -156,12 +299,136 @@ public:
 	ConstIterator Begin() const;
 	ConstIterator End() const;
 
+	/*
+	 * Transposes an array of objects with the same fields (records) into a typed
+	 * column per field in a single pass, the values are converted as by As*().
+	 */
+	class Columns
+	{
+	public:
+		Columns(): rows_(0) { }
+		~Columns();
+		// values[row] of a field, valid[row] (if wanted) tells whether it is present and not null
+		template <typename T> Columns& Add(const std::string& name, std::vector<T>& values, std::vector<bool>* valid = NULL);
+		bool Extract(const Json& rows); // false if rows is not an array of objects (or nulls)
+		bool Parse(const std::string& text, size_t *pos = NULL, bool strict = false); // builds no records
+		size_t Rows() const { return rows_; }
+	private:
+		struct Column;
+		template <typename T> struct TypedColumn;
+		std::vector<Column*> columns_;
+		std::map<std::string, Column*> index_;
+		std::vector<std::pair<std::string, Column*> > cache_; // by the position of a field in a record
+		size_t rows_;
+
+		void Resize(size_t rows);
+		Column* Find(const std::string& name, size_t position);
+		bool ParseRows(const char *& s, bool strict);
+		bool ParseRow(const char *& s, size_t row, std::string& name, std::string& text, bool strict);
+	private:
+		Columns(const Columns&); // disable copy
+		void operator = (const Columns&);
+	};
+
+	/*
+	 * Serializes a document in chunks of bounded size, e.g. to a non-blocking
+	 * socket, with the same text as Dump() with the same arguments:
+	 *
+	 *   Json::Serializer serializer(doc);
+	 *   while (!serializer.Done()) {
+	 *       size_t size = serializer.Fill(buffer, sizeof(buffer)); // then send all of it, waiting on EAGAIN
+	 *   }
+	 *
+	 * Each Fill() resumes where the previous one stopped, from an explicit stack
+	 * of the containers entered, so the memory used does not grow with the size
+	 * of the document. The document must be neither destroyed nor modified
+	 * until it is done (a persistent copy of it can be serialized instead).
+	 */
+	class Serializer
+	{
+	public:
+		explicit Serializer(const Json& json, size_t indent = 0, const std::string& sp = "", const std::string& eol = "", bool unicode = false);
+		size_t Fill(char* buffer, size_t capacity); // bytes written, less than capacity only when done
+		bool Done() const { return (started_ && stack_.empty() && offset_ == pending_.size()); }
+	private:
+		struct Frame
+		{
+			const Json* json;
+			size_t next; // item
+			size_t indent;
+		};
+		const Json* json_;
+		size_t indent_;
+		std::string sp_;
+		std::string eol_;
+		bool unicode_;
+		bool started_;
+		std::vector<Frame> stack_;
+		std::string pending_; // text of the last value, key or bracket
+		size_t offset_; // of the pending text not written yet
+
+		bool Next();
+	};
+	friend class Columns;
+	friend class JsonKey;
+	friend class Serializer;
+
 protected:
 	template <typename T> T AsNumber() const;
 	template <typename T> static std::string ToString(T v);
 	template <typename T> static T ToNumber(const std::string& s);
 };
 
+struct Json::LoadResult
+{
+	std::string filename;
+	Json json;         // null if the file failed to load
+	bool loaded;
+	std::string error; // why it failed, as Load() would print
+	size_t bytes;      // of the (decompressed) text
+};
+
+struct Json::Node
+{
+	Node(JsonType t, const std::string& s); // only created and destroyed by Json.cpp
+	~Node();
+
+	long refs;           // number of handles (atomic), only a persistent node may have more than one
+	bool persistent;     // copies share this node instead of duplicating it
+	bool exposed;        // a mutable reference to a child has been handed out
+	JsonType type;
+	std::string text;
+	std::vector<Json> array;  // the items of an array, or the key nodes of an object in insertion order
+	std::vector<Json> object; // the values of an object, at the positions of their keys
+	std::vector<uint32_t> index; // positions + 1 of the keys of a big object by hash, 0 if unused
+};
+
+/*
+ * A precomputed object key for lookups repeated on a hot path, e.g.
+ *
+ *   static const JsonKey ID("id");
+ *   int64_t id = message[ID].AsInt64();
+ *
+ * Its hash is computed once, and the keys added through it share its node, so
+ * that finding them again is mostly a pointer comparison. The names are kept
+ * for the life of the program, so it is meant for a fixed set of names.
+ */
+class JsonKey
+{
+public:
+	explicit JsonKey(const std::string& name);
+	const std::string& Name() const;
+private:
+	const Json* key_; // a registered persistent string node
+	uint32_t hash_;
+	friend class Json;
+};
+
+inline Json::JsonType Json::Type() const
+{
+	return (node_ ? node_->type : TYPE_NULL);
+}
+
 inline std::ostream& operator << (std::ostream& os, const Json& json)
 {
 	return (os << json.Dump());
@@ -171,12 +438,13 @@ template <typename T>
 T Json::AsNumber() const
 {
 	T v = 0;
-	if (type_ == TYPE_NULL) {
+	JsonType type = Type();
+	if (type == TYPE_NULL) {
 		return 0;
-	} else if (type_ == TYPE_BOOL) {
+	} else if (type == TYPE_BOOL) {
 		return static_cast<T>(AsBool() ? 1 : 0);
-	} else if (type_ == TYPE_STRING || type_ == TYPE_NUMBER) {
-		std::stringstream ss(text_);
+	} else if (type == TYPE_STRING || type == TYPE_NUMBER) {
+		std::stringstream ss(node_->text);
 		ss >> v;
 	}
 	return v;
@@ -0,0 +1,353 @@
+#ifndef __JSON_BIND_H__
+#define __JSON_BIND_H__
+
+#include "Json.h"
+#include <cstdlib>
+#include <cstring>
+
+/*
+ * Binding of plain structs to json objects, declared once next to the struct:
+ *
+ *   struct Point { int32_t x; int32_t y; std::vector<std::string> tags; };
+ *   NPJSON_BIND(Point) { NPJSON_FIELD(x); NPJSON_FIELD(y); NPJSON_FIELD(tags); }
+ *
+ * Fields may be bool, integers, float, double, std::string, other bound structs
+ * and std::vector of any of them. JsonBind converts between bound structs and
+ * Json documents, or parses and dumps json text directly without building any
+ * node. Fields which are missing or null keep their value, unknown keys are
+ * skipped. Keys are looked up by a perfect hash table built once per struct,
+ * which gives the parser of the field directly (at its offset in the struct,
+ * hence plain structs only). A name bound twice aborts the program.
+ */
+#define NPJSON_BIND(Type) \
+	template <typename Binder> inline void NpJsonBind(Binder& binder, Type& object)
+#define NPJSON_FIELD(name) binder.Field(#name, object.name)
+
+class JsonBind
+{
+public:
+	template <typename T> static void FromJson(const Json& json, T& object) { ReadValue(json, object); }
+	template <typename T> static Json ToJson(const T& object) { Json json; WriteValue(json, object); return json; }
+	template <typename T> static bool Parse(const std::string& text, T& object, size_t *pos = NULL);
+	template <typename T> static std::string Dump(const T& object) { std::string out; DumpValue(out, object); return out; }
+
+private:
+#define NPJSON_BIND_SCALAR(T) \
+	static void ReadValue(const Json& json, T& value) { json.Get(value); } \
+	static void WriteValue(Json& json, const T& value) { json = value; } \
+	static bool ParseValue(const char *& s, T& value) { return Json::ScanValue(s, value); }
+#define NPJSON_BIND_NUMBER(T) \
+	NPJSON_BIND_SCALAR(T) \
+	static void DumpValue(std::string& out, const T& value) { Json::AppendValue(out, value); }
+	NPJSON_BIND_NUMBER(bool)
+	NPJSON_BIND_NUMBER(int8_t)
+	NPJSON_BIND_NUMBER(int16_t)
+	NPJSON_BIND_NUMBER(int32_t)
+	NPJSON_BIND_NUMBER(int64_t)
+	NPJSON_BIND_NUMBER(uint8_t)
+	NPJSON_BIND_NUMBER(uint16_t)
+	NPJSON_BIND_NUMBER(uint32_t)
+	NPJSON_BIND_NUMBER(uint64_t)
+	NPJSON_BIND_NUMBER(float)
+	NPJSON_BIND_NUMBER(double)
+	NPJSON_BIND_SCALAR(std::string)
+	static void DumpValue(std::string& out, const std::string& value) { Json::AppendString(out, value); }
+#undef NPJSON_BIND_SCALAR
+#undef NPJSON_BIND_NUMBER
+
+	template <typename T> static void ReadValue(const Json& json, std::vector<T>& values);
+	template <typename T> static void WriteValue(Json& json, const std::vector<T>& values);
+	template <typename T> static bool ParseValue(const char *& s, std::vector<T>& values);
+	template <typename T> static void DumpValue(std::string& out, const std::vector<T>& values);
+	static void ReadValue(const Json& json, std::vector<bool>& values) { json.ExtractTo(values); }
+	static void WriteValue(Json& json, const std::vector<bool>& values);
+	static bool ParseValue(const char *& s, std::vector<bool>& values);
+	static void DumpValue(std::string& out, const std::vector<bool>& values);
+
+	// bound structs
+	template <typename T> static void ReadValue(const Json& json, T& object);
+	template <typename T> static void WriteValue(Json& json, const T& object);
+	template <typename T> static bool ParseValue(const char *& s, T& object);
+	template <typename T> static void DumpValue(std::string& out, const T& object);
+
+	static uint32_t Hash(const char* s, size_t size, uint32_t seed)
+	{
+		uint32_t hash = 2166136261u ^ seed; // FNV-1a
+		for (size_t i = 0; i < size; ++i) {
+			hash = (hash ^ static_cast<unsigned char>(s[i])) * 16777619u;
+		}
+		return hash;
+	}
+
+	typedef bool (*FieldParser)(const char *& s, void* field);
+	template <typename V> static bool ParseField(const char *& s, void* field)
+	{
+		return ParseValue(s, *static_cast<V*>(field));
+	}
+	struct FieldInfo
+	{
+		const char* name;
+		size_t offset; // in the struct
+		FieldParser parse;
+	};
+
+	template <typename T> class Keys // the field of each key of T
+	{
+	public:
+		static const Keys& Get() { static const Keys keys; return keys; }
+		const FieldInfo* Find(const std::string& key) const; // NULL if not a field
+	private:
+		Keys();
+		std::vector<FieldInfo> fields_;
+		std::vector<size_t> slots_; // field index + 1, 0 if unused
+		uint32_t seed_;
+	};
+
+	struct FieldBinder
+	{
+		std::vector<FieldInfo>& fields;
+		const char* object;
+		template <typename V> void Field(const char* name, V& value)
+		{
+			FieldInfo field = { name, static_cast<size_t>(reinterpret_cast<const char*>(&value) - object), ParseField<V> };
+			fields.push_back(field);
+		}
+	};
+	struct ReadBinder
+	{
+		const Json& json;
+		template <typename V> void Field(const char* name, V& value) { ReadValue(json[name], value); }
+	};
+	struct WriteBinder
+	{
+		Json& json;
+		template <typename V> void Field(const char* name, V& value) { WriteValue(json[name], value); }
+	};
+	struct DumpBinder
+	{
+		std::string& out;
+		bool first;
+		template <typename V> void Field(const char* name, V& value)
+		{
+			out += (first ? "\"" : ",\"");
+			out += name;
+			out += "\":";
+			DumpValue(out, value);
+			first = false;
+		}
+	};
+
+	template <typename T> static T& Mutable(const T& object) { return const_cast<T&>(object); } // binders only read it
+	static bool ScanSymbol(const char *& s, char c)
+	{
+		Json::ScanSpaces(s);
+		if (*s != c) return false;
+		++s;
+		return true;
+	}
+	static bool ScanNull(const char *& s)
+	{
+		Json::ScanSpaces(s);
+		if (strncmp(s, "null", 4) != 0) return false;
+		s += 4;
+		return true;
+	}
+};
+
+template <typename T>
+JsonBind::Keys<T>::Keys(): seed_(0)
+{
+	const size_t MAX_TABLE_SIZE = 1 << 16;
+	T object;
+	FieldBinder binder = { fields_, reinterpret_cast<const char*>(&object) };
+	NpJsonBind(binder, object);
+	for (size_t i = 0; i < fields_.size(); ++i) {
+		for (size_t j = 0; j < i; ++j) {
+			if (strcmp(fields_[i].name, fields_[j].name) == 0) { // no table could tell them apart
+				fprintf(stderr, "json field '%s' is bound twice\n", fields_[i].name);
+				abort();
+			}
+		}
+	}
+	for (size_t size = 4; size <= MAX_TABLE_SIZE; size *= 2) {
+		if (size < fields_.size() * 2) continue;
+		for (seed_ = 0; seed_ < 16; ++seed_) {
+			slots_.assign(size, 0);
+			size_t i = 0;
+			for (; i < fields_.size(); ++i) {
+				size_t slot = Hash(fields_[i].name, strlen(fields_[i].name), seed_) & (size - 1);
+				if (slots_[slot] != 0) break;
+				slots_[slot] = i + 1;
+			}
+			if (i == fields_.size()) return; // no collision
+		}
+	}
+	fprintf(stderr, "no perfect hash table for %lu json fields\n", static_cast<unsigned long>(fields_.size()));
+	abort();
+}
+
+template <typename T>
+const JsonBind::FieldInfo* JsonBind::Keys<T>::Find(const std::string& key) const
+{
+	size_t slot = slots_[Hash(key.data(), key.size(), seed_) & (slots_.size() - 1)];
+	if (slot == 0 || key != fields_[slot - 1].name) {
+		return NULL;
+	}
+	return &fields_[slot - 1];
+}
+
+template <typename T>
+bool JsonBind::Parse(const std::string& text, T& object, size_t *pos)
+{
+	const char *s = text.c_str();
+	bool parsed = ParseValue(s, object);
+	if (parsed) {
+		Json::ScanSpaces(s);
+	}
+	if (pos != NULL) {
+		*pos = s - text.c_str();
+	} else if (parsed && *s != '\0') {
+		return false;
+	}
+	return parsed;
+}
+
+template <typename T>
+void JsonBind::ReadValue(const Json& json, std::vector<T>& values)
+{
+	if (json.Type() != Json::TYPE_ARRAY) {
+		return;
+	}
+	values.resize(json.Size());
+	for (size_t i = 0; i < values.size(); ++i) {
+		ReadValue(json[i], values[i]);
+	}
+}
+
+template <typename T>
+void JsonBind::WriteValue(Json& json, const std::vector<T>& values)
+{
+	json = Json(Json::TYPE_ARRAY);
+	for (size_t i = 0; i < values.size(); ++i) {
+		WriteValue(json[i], values[i]);
+	}
+}
+
+template <typename T>
+bool JsonBind::ParseValue(const char *& s, std::vector<T>& values)
+{
+	if (ScanNull(s)) {
+		return true;
+	}
+	if (!ScanSymbol(s, '[')) return false;
+	values.clear();
+	if (ScanSymbol(s, ']')) {
+		return true;
+	}
+	do {
+		values.push_back(T());
+		if (!ParseValue(s, values.back())) return false;
+	} while (ScanSymbol(s, ','));
+	return ScanSymbol(s, ']');
+}
+
+template <typename T>
+void JsonBind::DumpValue(std::string& out, const std::vector<T>& values)
+{
+	out += '[';
+	for (size_t i = 0; i < values.size(); ++i) {
+		if (i > 0) out += ',';
+		DumpValue(out, values[i]);
+	}
+	out += ']';
+}
+
+inline void JsonBind::WriteValue(Json& json, const std::vector<bool>& values)
+{
+	json = Json(Json::TYPE_ARRAY);
+	for (size_t i = 0; i < values.size(); ++i) {
+		json[i] = static_cast<bool>(values[i]);
+	}
+}
+
+inline bool JsonBind::ParseValue(const char *& s, std::vector<bool>& values)
+{
+	if (ScanNull(s)) {
+		return true;
+	}
+	if (!ScanSymbol(s, '[')) return false;
+	values.clear();
+	if (ScanSymbol(s, ']')) {
+		return true;
+	}
+	do {
+		bool value = false; // no references into std::vector<bool>
+		if (!ParseValue(s, value)) return false;
+		values.push_back(value);
+	} while (ScanSymbol(s, ','));
+	return ScanSymbol(s, ']');
+}
+
+inline void JsonBind::DumpValue(std::string& out, const std::vector<bool>& values)
+{
+	out += '[';
+	for (size_t i = 0; i < values.size(); ++i) {
+		if (i > 0) out += ',';
+		Json::AppendValue(out, static_cast<bool>(values[i]));
+	}
+	out += ']';
+}
+
+template <typename T>
+void JsonBind::ReadValue(const Json& json, T& object)
+{
+	if (json.Type() == Json::TYPE_OBJECT) {
+		ReadBinder binder = { json };
+		NpJsonBind(binder, object);
+	}
+}
+
+template <typename T>
+void JsonBind::WriteValue(Json& json, const T& object)
+{
+	json = Json(Json::TYPE_OBJECT);
+	WriteBinder binder = { json };
+	NpJsonBind(binder, Mutable(object));
+}
+
+template <typename T>
+bool JsonBind::ParseValue(const char *& s, T& object)
+{
+	if (ScanNull(s)) {
+		return true;
+	}
+	if (!ScanSymbol(s, '{')) return false;
+	if (ScanSymbol(s, '}')) {
+		return true;
+	}
+	const Keys<T>& keys = Keys<T>::Get();
+	std::string key;
+	do {
+		Json::ScanSpaces(s);
+		if (!Json::ScanString(s, key) || !ScanSymbol(s, ':')) return false;
+		const FieldInfo* field = keys.Find(key);
+		if (field == NULL) {
+			Json::ScanSpaces(s);
+			if (!Json::SkipValue(s)) return false;
+			continue;
+		}
+		if (!field->parse(s, reinterpret_cast<char*>(&object) + field->offset)) return false;
+	} while (ScanSymbol(s, ','));
+	return ScanSymbol(s, '}');
+}
+
+template <typename T>
+void JsonBind::DumpValue(std::string& out, const T& object)
+{
+	out += '{';
+	DumpBinder binder = { out, true };
+	NpJsonBind(binder, Mutable(object));
+	out += '}';
+}
+
+#endif
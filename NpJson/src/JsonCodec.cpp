@@ -0,0 +1,316 @@
+#include "JsonCodec.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef NPJSON_ZLIB
+#include <zlib.h>
+#endif
+#ifdef NPJSON_ZSTD
+#include <zstd.h>
+#endif
+
+const size_t CODEC_BUFFER_SIZE = 1 << 16;
+const size_t READ_BUFFER_SIZE = 1 << 20;
+
+static const unsigned char GZIP_MAGIC[] = { 0x1F, 0x8B };
+static const unsigned char ZSTD_MAGIC[] = { 0x28, 0xB5, 0x2F, 0xFD };
+
+static bool EndsWith(const std::string& s, const char* suffix)
+{
+	size_t size = strlen(suffix);
+	return (s.size() >= size && s.compare(s.size() - size, size, suffix) == 0);
+}
+
+JsonCodec::Format JsonCodec::Detect(const char* data, size_t size)
+{
+	if (size >= sizeof(GZIP_MAGIC) && memcmp(data, GZIP_MAGIC, sizeof(GZIP_MAGIC)) == 0) {
+		return FORMAT_GZIP;
+	} else if (size >= sizeof(ZSTD_MAGIC) && memcmp(data, ZSTD_MAGIC, sizeof(ZSTD_MAGIC)) == 0) {
+		return FORMAT_ZSTD;
+	}
+	return FORMAT_NONE; // json text never starts with these bytes
+}
+
+JsonCodec::Format JsonCodec::FromName(const std::string& filename)
+{
+	if (EndsWith(filename, ".gz")) {
+		return FORMAT_GZIP;
+	} else if (EndsWith(filename, ".zst")) {
+		return FORMAT_ZSTD;
+	}
+	return FORMAT_NONE;
+}
+
+bool JsonCodec::Supported(Format format)
+{
+	switch (format) {
+	case FORMAT_NONE: return true;
+#ifdef NPJSON_ZLIB
+	case FORMAT_GZIP: return true;
+#endif
+#ifdef NPJSON_ZSTD
+	case FORMAT_ZSTD: return true;
+#endif
+	default: return false;
+	}
+}
+
+JsonCodec::JsonCodec(Format format, bool compress, int level):
+	format_(format), compress_(compress), stream_(NULL), ended_(false), good_(false), buffer_(CODEC_BUFFER_SIZE)
+{
+#ifdef NPJSON_ZLIB
+	if (format == FORMAT_GZIP) {
+		z_stream* z = new z_stream();
+		if (compress) { // 16 for the gzip header and trailer
+			good_ = (deflateInit2(z, (level == 0 ? Z_DEFAULT_COMPRESSION : level), Z_DEFLATED, 15 + 16, 8,
+					Z_DEFAULT_STRATEGY) == Z_OK);
+		} else {
+			good_ = (inflateInit2(z, 15 + 16) == Z_OK);
+		}
+		stream_ = z;
+	}
+#endif
+#ifdef NPJSON_ZSTD
+	if (format == FORMAT_ZSTD) {
+		if (compress) {
+			ZSTD_CCtx* cctx = ZSTD_createCCtx();
+			good_ = (cctx != NULL && !ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level)));
+			stream_ = cctx;
+		} else {
+			stream_ = ZSTD_createDCtx();
+			good_ = (stream_ != NULL);
+		}
+	}
+#endif
+	(void)level;
+}
+
+JsonCodec::~JsonCodec()
+{
+#ifdef NPJSON_ZLIB
+	if (format_ == FORMAT_GZIP) {
+		z_stream* z = static_cast<z_stream*>(stream_);
+		if (compress_) {
+			deflateEnd(z);
+		} else {
+			inflateEnd(z);
+		}
+		delete z;
+	}
+#endif
+#ifdef NPJSON_ZSTD
+	if (format_ == FORMAT_ZSTD) {
+		if (compress_) {
+			ZSTD_freeCCtx(static_cast<ZSTD_CCtx*>(stream_));
+		} else {
+			ZSTD_freeDCtx(static_cast<ZSTD_DCtx*>(stream_));
+		}
+	}
+#endif
+}
+
+bool JsonCodec::Update(const char* data, size_t size, std::string& out)
+{
+	if (format_ == FORMAT_NONE) {
+		out.append(data, size);
+		return true;
+	}
+	good_ = good_ && Process(data, size, out, false);
+	return good_;
+}
+
+bool JsonCodec::Finish(std::string& out)
+{
+	if (format_ == FORMAT_NONE) {
+		return true;
+	} else if (compress_) {
+		good_ = good_ && Process(NULL, 0, out, true);
+	}
+	return good_ && (compress_ || ended_);
+}
+
+/*
+ * Feeds the input through the stream, a buffer of output at a time, until all
+ * of it is consumed and no output is pending (or the compressed stream ended
+ * when finishing). Concatenated gzip members and zstd frames are decompressed
+ * as one text, as gunzip and zstd -d do.
+ */
+bool JsonCodec::Process(const char* data, size_t size, std::string& out, bool finish)
+{
+#ifdef NPJSON_ZLIB
+	if (format_ == FORMAT_GZIP) {
+		z_stream* z = static_cast<z_stream*>(stream_);
+		z->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+		z->avail_in = size;
+		for (;;) {
+			z->next_out = reinterpret_cast<Bytef*>(&buffer_[0]);
+			z->avail_out = buffer_.size();
+			int ret = (compress_ ? deflate(z, finish ? Z_FINISH : Z_NO_FLUSH) : inflate(z, Z_NO_FLUSH));
+			out.append(&buffer_[0], buffer_.size() - z->avail_out);
+			if (ret == Z_STREAM_END && compress_) {
+				return true;
+			} else if (ret == Z_STREAM_END) {
+				ended_ = true;
+				if (z->avail_in == 0) {
+					return true;
+				} else if (inflateReset(z) != Z_OK) { // the next member
+					return false;
+				}
+				continue;
+			} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+				return false;
+			}
+			ended_ = false;
+			if (z->avail_in == 0 && z->avail_out > 0 && !finish) {
+				return true;
+			}
+		}
+	}
+#endif
+#ifdef NPJSON_ZSTD
+	if (format_ == FORMAT_ZSTD) {
+		ZSTD_inBuffer in = { data, size, 0 };
+		for (;;) {
+			ZSTD_outBuffer output = { &buffer_[0], buffer_.size(), 0 };
+			size_t ret = (compress_
+					? ZSTD_compressStream2(static_cast<ZSTD_CCtx*>(stream_), &output, &in,
+						finish ? ZSTD_e_end : ZSTD_e_continue)
+					: ZSTD_decompressStream(static_cast<ZSTD_DCtx*>(stream_), &output, &in));
+			if (ZSTD_isError(ret)) {
+				return false;
+			}
+			out.append(&buffer_[0], output.pos);
+			ended_ = (ret == 0); // the frame is complete
+			if (finish ? ret == 0 : in.pos == in.size && output.pos < output.size) {
+				return true;
+			}
+		}
+	}
+#endif
+	(void)data;
+	(void)size;
+	(void)out;
+	(void)finish;
+	return false;
+}
+
+static bool ReadAll(int fd, char* data, size_t size, size_t& read)
+{
+	read = 0;
+	while (read < size) {
+		ssize_t n = ::read(fd, data + read, size - read);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0) {
+			return false;
+		} else if (n == 0) {
+			break;
+		}
+		read += n;
+	}
+	return true;
+}
+
+// the size of the text as recorded by the compressed file, 0 if unknown
+static size_t ContentSize(int fd, JsonCodec::Format format, const char* head, size_t headSize, off_t fileSize)
+{
+	uint64_t size = 0;
+	if (format == JsonCodec::FORMAT_GZIP && fileSize >= 18) { // the trailer of the last member, modulo 2^32
+		unsigned char trailer[4];
+		if (pread(fd, trailer, 4, fileSize - 4) == 4) {
+			size = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (static_cast<uint64_t>(trailer[3]) << 24);
+		}
+	}
+#ifdef NPJSON_ZSTD
+	if (format == JsonCodec::FORMAT_ZSTD) { // of the first frame, if recorded
+		unsigned long long frame = ZSTD_getFrameContentSize(head, headSize);
+		if (frame != ZSTD_CONTENTSIZE_UNKNOWN && frame != ZSTD_CONTENTSIZE_ERROR) {
+			size = frame;
+		}
+	}
+#endif
+	(void)head;
+	(void)headSize;
+	// only a hint for reserving memory, which a corrupt or multi-member file must not blow up
+	return (size >= static_cast<uint64_t>(fileSize) && size / 1024 < static_cast<uint64_t>(fileSize) ? size : 0);
+}
+
+/*
+ * The file is read in chunks which are appended to the text as they are, or
+ * decompressed into it, so memory is only taken by the text itself (reserved
+ * up front when the size is known).
+ */
+bool JsonCodec::ReadFile(const std::string& filename, std::string& text)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	std::vector<char> buffer(READ_BUFFER_SIZE);
+	size_t size = 0;
+	bool read = (fstat(fd, &st) == 0 && ReadAll(fd, &buffer[0], buffer.size(), size));
+	Format format = Detect(&buffer[0], size);
+	text.clear();
+	if (read && format == FORMAT_NONE) {
+		text.reserve(st.st_size);
+	} else if (read) {
+		text.reserve(ContentSize(fd, format, &buffer[0], size, st.st_size));
+	}
+	JsonCodec codec(format, false);
+	while (read && size > 0) {
+		read = codec.Update(&buffer[0], size, text) && ReadAll(fd, &buffer[0], buffer.size(), size);
+	}
+	close(fd);
+	return (read && codec.Finish(text));
+}
+
+JsonFileSink::JsonFileSink(const std::string& filename, int level):
+	file_(NULL), codec_(NULL), good_(false)
+{
+	JsonCodec::Format format = JsonCodec::FromName(filename);
+	if (!JsonCodec::Supported(format)) { // the existing file is left alone
+		return;
+	} else if (format != JsonCodec::FORMAT_NONE) {
+		codec_ = new JsonCodec(format, true, level);
+	}
+	file_ = fopen(filename.c_str(), "wb");
+	good_ = (file_ != NULL);
+}
+
+JsonFileSink::~JsonFileSink()
+{
+	if (file_ != NULL) {
+		fclose(file_);
+	}
+	delete codec_;
+}
+
+bool JsonFileSink::Write(const char* data, size_t size)
+{
+	if (file_ == NULL || !good_) {
+		return false;
+	} else if (codec_ == NULL) {
+		good_ = (fwrite(data, 1, size, file_) == size);
+		return good_;
+	}
+	out_.clear();
+	good_ = codec_->Update(data, size, out_) && fwrite(out_.data(), 1, out_.size(), file_) == out_.size();
+	return good_;
+}
+
+bool JsonFileSink::Close()
+{
+	if (file_ == NULL) {
+		return false;
+	}
+	if (codec_ != NULL && good_) {
+		out_.clear();
+		good_ = codec_->Finish(out_) && fwrite(out_.data(), 1, out_.size(), file_) == out_.size();
+	}
+	good_ = (fclose(file_) == 0) && good_;
+	file_ = NULL;
+	return good_;
+}
@@ -0,0 +1,74 @@
+#ifndef __JSON_CODEC_H__
+#define __JSON_CODEC_H__
+
+#include "JsonWriter.h"
+
+/*
+ * Compression of json files. Json::Load() and ReadFile() decompress gzip and
+ * zstd files by their magic number, Json::Save() and JsonFileSink compress
+ * files named *.gz or *.zst, chunk by chunk, so neither the compressed data nor
+ * a second copy of the text is ever held in memory:
+ *
+ *   std::string text;
+ *   JsonCodec::ReadFile("orders.json.gz", text);  // then JsonReader reader(text)
+ *
+ *   JsonFileSink sink("orders.json.zst");
+ *   JsonWriter writer(sink);
+ *   ...
+ *   writer.Flush();
+ *   sink.Close();
+ *
+ * gzip is only available if NpJson is built with NPJSON_ZLIB defined (and
+ * linked with -lz), zstd with NPJSON_ZSTD (and -lzstd); otherwise compressed
+ * files fail to load or save.
+ */
+class JsonCodec
+{
+public:
+	enum Format { FORMAT_NONE, FORMAT_GZIP, FORMAT_ZSTD };
+	static Format Detect(const char* data, size_t size); // by the magic number at the start of a file
+	static Format FromName(const std::string& filename); // by the extension .gz or .zst
+	static bool Supported(Format format); // whether NpJson was built with it
+	// the whole text of a plain or compressed file, false if it cannot be read or is corrupt
+	static bool ReadFile(const std::string& filename, std::string& text);
+
+	JsonCodec(Format format, bool compress, int level = 0); // 0 for the default level of the format
+	~JsonCodec();
+	// appends the output of the next chunk of input to out, false on corrupt input or unsupported format
+	bool Update(const char* data, size_t size, std::string& out);
+	// appends the end of compressed output; when decompressing, false if the input was truncated
+	bool Finish(std::string& out);
+private:
+	bool Process(const char* data, size_t size, std::string& out, bool finish);
+private:
+	Format format_;
+	bool compress_;
+	void* stream_; // of zlib or zstd
+	bool ended_;   // whether the input ended at the end of a compressed stream
+	bool good_;
+	std::vector<char> buffer_;
+private:
+	JsonCodec(const JsonCodec&); // disable copy
+	void operator = (const JsonCodec&);
+};
+
+// a sink of JsonWriter writing a file, compressed if its name ends with .gz or .zst
+class JsonFileSink: public JsonWriter::Sink
+{
+public:
+	explicit JsonFileSink(const std::string& filename, int level = 0); // not open if the compression is not supported
+	~JsonFileSink(); // closes the file, a compressed one is incomplete unless Close() was called
+	bool IsOpen() const { return file_ != NULL; }
+	virtual bool Write(const char* data, size_t size);
+	bool Close(); // ends the compressed stream, false if anything failed to be written
+private:
+	FILE* file_;
+	JsonCodec* codec_;
+	std::string out_; // compressed
+	bool good_;
+private:
+	JsonFileSink(const JsonFileSink&); // disable copy
+	void operator = (const JsonFileSink&);
+};
+
+#endif
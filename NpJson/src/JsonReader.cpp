@@ -0,0 +1,309 @@
+#include "JsonReader.h"
+#include <cctype>
+#include <cstring>
+
+std::string JsonReader::StringView::ToString() const
+{
+	if (!escaped) {
+		return std::string(data, size);
+	}
+	const char* s = data - 1; // the opening quote, the text was validated already
+	std::string text;
+	Json::ScanString(s, text);
+	return text;
+}
+
+bool JsonReader::StringView::operator == (const char* text) const
+{
+	if (escaped) {
+		return (ToString() == text);
+	}
+	return (strlen(text) == size && memcmp(data, text, size) == 0);
+}
+
+JsonReader::JsonReader(const char* text):
+	text_(text), s_(text), error_(NULL), value_(true), first_(false)
+{
+}
+
+JsonReader::JsonReader(const std::string& text):
+	text_(text.c_str()), s_(text.c_str()), error_(NULL), value_(true), first_(false)
+{
+}
+
+void JsonReader::Fail()
+{
+	if (error_ == NULL) {
+		error_ = s_;
+	}
+}
+
+JsonReader::Token JsonReader::TokenType()
+{
+	if (error_ != NULL) {
+		return TOKEN_ERROR;
+	} else if (!value_) {
+		return TOKEN_END;
+	}
+	Json::ScanSpaces(s_);
+	switch (*s_) {
+	case '{': return TOKEN_OBJECT;
+	case '[': return TOKEN_ARRAY;
+	case '"': return TOKEN_STRING;
+	case 't':
+	case 'f': return TOKEN_BOOL;
+	case 'n': return TOKEN_NULL;
+	default:
+		if (*s_ == '-' || *s_ == '+' || *s_ == '.' || isdigit(*s_)) {
+			return TOKEN_NUMBER;
+		}
+		Fail();
+		return TOKEN_ERROR;
+	}
+}
+
+bool JsonReader::EnterObject()
+{
+	if (TokenType() != TOKEN_OBJECT || closing_.size() >= Json::MaxDepth()) {
+		Fail();
+		return false;
+	}
+	++s_;
+	closing_ += '}';
+	value_ = false;
+	first_ = true;
+	return true;
+}
+
+bool JsonReader::EnterArray()
+{
+	if (TokenType() != TOKEN_ARRAY || closing_.size() >= Json::MaxDepth()) {
+		Fail();
+		return false;
+	}
+	++s_;
+	closing_ += ']';
+	value_ = false;
+	first_ = true;
+	return true;
+}
+
+bool JsonReader::NextItem(char closing)
+{
+	if (error_ != NULL) {
+		return false;
+	} else if (closing_.empty() || closing_[closing_.size() - 1] != closing) {
+		Fail();
+		return false;
+	} else if (value_) {
+		SkipValue();
+		if (error_ != NULL) return false;
+	}
+	Json::ScanSpaces(s_);
+	if (*s_ == closing) {
+		++s_;
+		closing_.erase(closing_.size() - 1);
+		first_ = false; // the container was an item of its parent
+		return false;
+	} else if (!first_) {
+		if (*s_ != ',') {
+			Fail();
+			return false;
+		}
+		++s_;
+	}
+	first_ = false;
+	value_ = true;
+	return true;
+}
+
+bool JsonReader::Next()
+{
+	return NextItem(']');
+}
+
+bool JsonReader::NextKey(StringView& key)
+{
+	if (!NextItem('}')) {
+		return false;
+	}
+	value_ = false;
+	Json::ScanSpaces(s_);
+	if (*s_ != '"' || !ScanView(key)) {
+		Fail();
+		return false;
+	}
+	Json::ScanSpaces(s_);
+	if (*s_ != ':') {
+		Fail();
+		return false;
+	}
+	++s_;
+	value_ = true;
+	return true;
+}
+
+bool JsonReader::ScanView(StringView& view) // of the string at s_
+{
+	bool utf8 = Json::Utf8Validation();
+	const char* p = s_ + 1;
+	for (;;) {
+		unsigned char c = static_cast<unsigned char>(*p);
+		if (c == '"' || c == '\\' || c == '\0' || (c >= 0x80 && utf8)) break;
+		++p;
+	}
+	view.data = s_ + 1;
+	if (*p == '"') { // plain text, nothing to validate
+		view.size = p - view.data;
+		view.escaped = false;
+		s_ = p + 1;
+		return true;
+	}
+	const char* s = s_;
+	bool scanned = Json::ScanString(s, scratch_);
+	s_ = s;
+	if (!scanned) {
+		return false;
+	}
+	view.size = s - 1 - view.data;
+	view.escaped = (memchr(view.data, '\\', view.size) != NULL);
+	return true;
+}
+
+void JsonReader::SkipValue()
+{
+	Token token = TokenType();
+	if (token == TOKEN_ARRAY || token == TOKEN_OBJECT) {
+		SkipContainer();
+	} else if (token == TOKEN_END || token == TOKEN_ERROR || !Json::SkipValue(s_)) {
+		Fail();
+	} else {
+		value_ = false;
+	}
+}
+
+void JsonReader::SkipContainer() // counting brackets outside of strings
+{
+	size_t depth = 0;
+	const char* s = s_;
+	for (;;) {
+		s += strcspn(s, "\"[]{}");
+		switch (*s) {
+		case '"':
+			for (++s; ; s += 2) {
+				s += strcspn(s, "\"\\");
+				if (*s != '\\' || s[1] == '\0') break;
+			}
+			if (*s != '"') {
+				s_ = s;
+				Fail();
+				return;
+			}
+			++s;
+			break;
+		case '[':
+		case '{':
+			++depth;
+			++s;
+			break;
+		case ']':
+		case '}':
+			++s;
+			if (--depth == 0) {
+				s_ = s;
+				value_ = false;
+				return;
+			}
+			break;
+		default: // the end of the text
+			s_ = s;
+			Fail();
+			return;
+		}
+	}
+}
+
+template <typename T>
+T JsonReader::GetNumber(Token token)
+{
+	T value = T();
+	if (TokenType() != token || !Json::ScanValue(s_, value)) {
+		Fail();
+		return T();
+	}
+	value_ = false;
+	return value;
+}
+
+bool JsonReader::GetBool()
+{
+	return GetNumber<bool>(TOKEN_BOOL);
+}
+
+int64_t JsonReader::GetInt64()
+{
+	return GetNumber<int64_t>(TOKEN_NUMBER);
+}
+
+uint64_t JsonReader::GetUint64()
+{
+	return GetNumber<uint64_t>(TOKEN_NUMBER);
+}
+
+double JsonReader::GetDouble()
+{
+	return GetNumber<double>(TOKEN_NUMBER);
+}
+
+std::string JsonReader::GetString()
+{
+	std::string text;
+	if (TokenType() != TOKEN_STRING || !Json::ScanString(s_, text)) {
+		Fail();
+		return std::string();
+	}
+	value_ = false;
+	return text;
+}
+
+JsonReader::StringView JsonReader::GetStringView()
+{
+	StringView view = { "", 0, false };
+	if (TokenType() != TOKEN_STRING || !ScanView(view)) {
+		Fail();
+		StringView empty = { "", 0, false };
+		return empty;
+	}
+	value_ = false;
+	return view;
+}
+
+bool JsonReader::Done()
+{
+	if (error_ != NULL || value_ || !closing_.empty()) {
+		return false;
+	}
+	Json::ScanSpaces(s_);
+	if (*s_ != '\0') {
+		Fail();
+		return false;
+	}
+	return true;
+}
+
+Json::ErrorInfo JsonReader::Error() const
+{
+	const char* end = (error_ != NULL ? error_ : s_);
+	Json::ErrorInfo error;
+	error.offset = end - text_;
+	error.line = 1;
+	const char* line = text_;
+	for (const char* p = text_; p < end; ++p) {
+		if (*p == '\n') {
+			++error.line;
+			line = p + 1;
+		}
+	}
+	error.column = end - line + 1;
+	return error;
+}
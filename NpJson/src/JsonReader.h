@@ -0,0 +1,89 @@
+#ifndef __JSON_READER_H__
+#define __JSON_READER_H__
+
+#include "Json.h"
+
+/*
+ * Pull reader of strict json text for hand-written decoders, which read just
+ * the values they need without building any node:
+ *
+ *   JsonReader reader(text);
+ *   JsonReader::StringView key;
+ *   reader.EnterObject();
+ *   while (reader.NextKey(key)) {
+ *       if (key == "id") id = reader.GetInt64();
+ *       else if (key == "name") name = reader.GetString();
+ *       else reader.SkipValue();
+ *   }
+ *   if (!reader.Done()) ... // reader.Error() tells where it failed
+ *
+ * The reader is positioned at a value: TokenType() tells its type, Get*() and
+ * SkipValue() consume it, EnterObject() and EnterArray() enter it. Inside a
+ * container NextKey() or Next() move to each member or item (skipping the
+ * previous one if it was not read) and return false after the closing bracket.
+ * Malformed text or a call which does not match it stops the reader: all calls
+ * fail from then on and return false, 0 or empty values.
+ *
+ * SkipValue() jumps over arrays and objects by counting brackets and quotes
+ * only, so the text of a skipped container is not validated otherwise.
+ */
+class JsonReader
+{
+public:
+	enum Token {
+		TOKEN_NULL, TOKEN_BOOL, TOKEN_NUMBER,
+		TOKEN_STRING, TOKEN_ARRAY, TOKEN_OBJECT,
+		TOKEN_END,  // after the last item of a container or after the document
+		TOKEN_ERROR
+	};
+
+	struct StringView // the text of a string between its quotes, within the text of the reader
+	{
+		const char* data;
+		size_t size;
+		bool escaped; // whether escapes have to be decoded, as ToString() does
+		std::string ToString() const;
+		bool operator == (const char* text) const; // compares the decoded text
+		bool operator != (const char* text) const { return !(*this == text); }
+	};
+
+	explicit JsonReader(const char* text); // '\0' terminated, kept by the caller while reading
+	explicit JsonReader(const std::string& text);
+
+	Token TokenType();
+	bool EnterObject();
+	bool NextKey(StringView& key);
+	bool EnterArray();
+	bool Next();
+	void SkipValue();
+
+	bool        GetBool();
+	int64_t     GetInt64();
+	uint64_t    GetUint64();
+	double      GetDouble();
+	std::string GetString();
+	StringView  GetStringView(); // without copying the text unless it has to be validated
+
+	bool Done(); // whether the whole document was read, followed by spaces only
+	bool Failed() const { return error_ != NULL; }
+	Json::ErrorInfo Error() const; // where the reader stopped, if Failed()
+private:
+	template <typename T> T GetNumber(Token token);
+	bool NextItem(char closing); // to the next item of the current container
+	bool ScanView(StringView& view);
+	void SkipContainer();
+	void Fail();
+private:
+	const char* text_;
+	const char* s_;
+	const char* error_;
+	std::string closing_; // brackets of the containers entered
+	bool value_; // whether the reader is at a value which is not read yet
+	bool first_; // whether no item of the current container has been read
+	std::string scratch_; // of strings validated by Json::ScanString()
+private:
+	JsonReader(const JsonReader&); // disable copy
+	void operator = (const JsonReader&);
+};
+
+#endif
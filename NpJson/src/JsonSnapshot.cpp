@@ -0,0 +1,153 @@
+#include "JsonSnapshot.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+JsonSnapshot::JsonSnapshot(size_t maxReaders)
+{
+	Init(Json(), maxReaders);
+}
+
+JsonSnapshot::JsonSnapshot(const Json& json, size_t maxReaders)
+{
+	Init(json, maxReaders);
+}
+
+void JsonSnapshot::Init(const Json& json, size_t maxReaders)
+{
+	Json* copy = new Json(json);
+	copy->SetPersistent();
+	current_ = copy;
+	epoch_ = 1;
+	slotCount_ = std::max(maxReaders, static_cast<size_t>(1));
+	void* slots = NULL; // operator new does not honor the alignment of Slot
+	if (posix_memalign(&slots, CACHE_LINE_SIZE, slotCount_ * sizeof(Slot)) != 0) {
+		delete copy;
+		throw std::bad_alloc();
+	}
+	memset(slots, 0, slotCount_ * sizeof(Slot));
+	slots_ = static_cast<Slot*>(slots);
+	pthread_mutex_init(&mutex_, NULL);
+}
+
+JsonSnapshot::~JsonSnapshot()
+{
+	for (size_t i = 0; i < retired_.size(); ++i) {
+		delete retired_[i].json;
+	}
+	delete current_;
+	free(slots_);
+	pthread_mutex_destroy(&mutex_);
+}
+
+void JsonSnapshot::Publish(const Json& json)
+{
+	Json* copy = new Json(json);
+	copy->SetPersistent(); // no-op for a shared persistent document
+
+	pthread_mutex_lock(&mutex_);
+	RetiredJson old;
+	old.json = __atomic_exchange_n(&current_, copy, __ATOMIC_SEQ_CST);
+	// readers entering from now on announce at least this epoch and can only see the new version
+	old.epoch = __atomic_add_fetch(&epoch_, 1, __ATOMIC_SEQ_CST);
+	retired_.push_back(old);
+	FreeRetired();
+	pthread_mutex_unlock(&mutex_);
+}
+
+bool JsonSnapshot::Load(const std::string& filename, bool strict)
+{
+	Json json;
+	if (!json.Load(filename, strict)) {
+		return false;
+	}
+	json.SetPersistent();
+	Publish(json);
+	return true;
+}
+
+Json JsonSnapshot::Get() const // without a reader slot, the version cannot be retired while locked
+{
+	pthread_mutex_lock(&mutex_);
+	Json json(*current_); // O(1), it is persistent
+	pthread_mutex_unlock(&mutex_);
+	return json;
+}
+
+size_t JsonSnapshot::Retired() const
+{
+	pthread_mutex_lock(&mutex_);
+	size_t count = retired_.size();
+	pthread_mutex_unlock(&mutex_);
+	return count;
+}
+
+size_t JsonSnapshot::Reclaim()
+{
+	pthread_mutex_lock(&mutex_);
+	FreeRetired();
+	size_t count = retired_.size();
+	pthread_mutex_unlock(&mutex_);
+	return count;
+}
+
+void JsonSnapshot::FreeRetired() // with mutex_ held
+{
+	long oldest = __atomic_load_n(&epoch_, __ATOMIC_SEQ_CST);
+	for (size_t i = 0; i < slotCount_; ++i) {
+		long epoch = __atomic_load_n(&slots_[i].epoch, __ATOMIC_SEQ_CST);
+		if (epoch != 0 && epoch < oldest) {
+			oldest = epoch;
+		}
+	}
+	size_t kept = 0;
+	for (size_t i = 0; i < retired_.size(); ++i) {
+		if (retired_[i].epoch <= oldest) { // no reader left who may have seen it
+			delete retired_[i].json;
+		} else {
+			retired_[kept++] = retired_[i];
+		}
+	}
+	retired_.resize(kept);
+}
+
+size_t JsonSnapshot::Attach() const
+{
+	for (size_t i = 0; i < slotCount_; ++i) {
+		long unused = 0;
+		if (__atomic_compare_exchange_n(&slots_[i].used, &unused, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			return i;
+		}
+	}
+	throw std::runtime_error("too many json snapshot readers");
+}
+
+void JsonSnapshot::Detach(size_t slot) const
+{
+	__atomic_store_n(&slots_[slot].epoch, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&slots_[slot].used, 0, __ATOMIC_RELEASE);
+}
+
+JsonSnapshot::Reader::Reader(const JsonSnapshot& snapshot):
+	snapshot_(snapshot), slot_(snapshot.Attach())
+{
+}
+
+JsonSnapshot::Reader::~Reader()
+{
+	snapshot_.Detach(slot_);
+}
+
+const Json& JsonSnapshot::Reader::Acquire()
+{
+	Slot& slot = snapshot_.slots_[slot_];
+	// announce the epoch before looking at the document, no loop, no lock
+	__atomic_store_n(&slot.epoch, __atomic_load_n(&snapshot_.epoch_, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+	return *__atomic_load_n(&snapshot_.current_, __ATOMIC_SEQ_CST);
+}
+
+void JsonSnapshot::Reader::Release()
+{
+	__atomic_store_n(&snapshot_.slots_[slot_].epoch, 0, __ATOMIC_RELEASE);
+}
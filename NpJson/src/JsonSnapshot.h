@@ -0,0 +1,92 @@
+#ifndef __JSON_SNAPSHOT_H__
+#define __JSON_SNAPSHOT_H__
+
+#include "Json.h"
+#include <pthread.h>
+
+/*
+ * Holder of an immutable json document which is replaced as a whole
+ * (e.g. a hot-reloaded config), read by many threads without any lock.
+ *
+ * Readers pin the current version wait-free through a Reader registered
+ * once per thread, the writer publishes a new version atomically, and old
+ * versions are freed after all readers that may still see them have left
+ * (epoch-based reclamation). This is checked by each Publish(), so once the
+ * updates stop, the versions retired last stay alive until Reclaim() is called.
+ */
+class JsonSnapshot
+{
+public:
+	explicit JsonSnapshot(size_t maxReaders = 64); // at least 1 reader
+	explicit JsonSnapshot(const Json& json, size_t maxReaders = 64);
+	~JsonSnapshot(); // all readers must have been destroyed
+
+	void Publish(const Json& json); // O(1) if json is persistent already
+	bool Load(const std::string& filename, bool strict = false); // keeps the current version on failure
+	Json Get() const; // a (persistent) copy of the current version, takes no reader slot
+	size_t Retired() const; // number of old versions not reclaimed yet
+	size_t Reclaim(); // frees the old versions no reader can see any more, returns Retired()
+
+	class Reader // not thread-safe, each reader thread should have its own one
+	{
+	public:
+		explicit Reader(const JsonSnapshot& snapshot);
+		~Reader();
+		const Json& Acquire(); // valid until Release(), must not be nested
+		void Release();
+	private:
+		const JsonSnapshot& snapshot_;
+		size_t slot_;
+	private:
+		Reader(const Reader&); // disable copy
+		void operator = (const Reader&);
+	};
+
+	class Guard
+	{
+	public:
+		explicit Guard(Reader& reader): reader_(reader), json_(reader.Acquire()) { }
+		~Guard() { reader_.Release(); }
+		const Json& operator * () const { return json_; }
+		const Json* operator -> () const { return &json_; }
+	private:
+		Reader& reader_;
+		const Json& json_;
+	private:
+		Guard(const Guard&); // disable copy
+		void operator = (const Guard&);
+	};
+
+private:
+	enum { CACHE_LINE_SIZE = 64 };
+	struct Slot // allocated on cache line boundaries, one slot per line
+	{
+		long used;
+		long epoch; // 0 if the reader is not in a critical section
+		char padding[CACHE_LINE_SIZE - 2 * sizeof(long)];
+	} __attribute__((aligned(CACHE_LINE_SIZE)));
+	struct RetiredJson
+	{
+		long epoch;
+		const Json* json;
+	};
+
+	const Json* current_;
+	long epoch_;
+	Slot* slots_;
+	size_t slotCount_;
+	std::vector<RetiredJson> retired_;
+	mutable pthread_mutex_t mutex_; // serializes writers
+
+	friend class Reader;
+
+	void Init(const Json& json, size_t maxReaders);
+	void FreeRetired();
+	size_t Attach() const;
+	void Detach(size_t slot) const;
+private:
+	JsonSnapshot(const JsonSnapshot&); // disable copy
+	void operator = (const JsonSnapshot&);
+};
+
+#endif
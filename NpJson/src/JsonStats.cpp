@@ -0,0 +1,70 @@
+#include "Json.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef NPJSON_STATS
+__thread Json::Stats g_jsonStats; // zero initialized for every thread
+
+/*
+ * The instrumentation build replaces the global operator new, so every heap
+ * allocation of the program is counted for the thread which makes it. It is
+ * kept apart from Json.cpp so that it cannot be inlined into the callers.
+ */
+void* operator new(size_t size)
+{
+	++g_jsonStats.allocations;
+	g_jsonStats.bytes += size;
+	void* p = malloc(size ? size : 1);
+	if (p == NULL) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) throw()
+{
+	free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+	free(p);
+}
+
+bool Json::HasStats()
+{
+	return true;
+}
+
+Json::Stats Json::GetStats()
+{
+	return g_jsonStats;
+}
+
+void Json::ResetStats()
+{
+	memset(&g_jsonStats, 0, sizeof(g_jsonStats));
+}
+#else
+bool Json::HasStats()
+{
+	return false;
+}
+
+Json::Stats Json::GetStats()
+{
+	Stats stats;
+	memset(&stats, 0, sizeof(stats));
+	return stats;
+}
+
+void Json::ResetStats()
+{
+}
+#endif
@@ -0,0 +1,151 @@
+#include "JsonWriter.h"
+#include <cassert>
+
+JsonWriter::JsonWriter(std::string& out, size_t indent, const std::string& sp, const std::string& eol, bool unicode):
+	out_(&out), sink_(NULL), bufferSize_(0), indent_(indent), sp_(sp), eol_(eol), unicode_(unicode),
+	first_(false), key_(false), done_(false), good_(true)
+{
+}
+
+JsonWriter::JsonWriter(Sink& sink, size_t bufferSize, size_t indent, const std::string& sp, const std::string& eol,
+		bool unicode):
+	out_(&buffer_), sink_(&sink), bufferSize_(bufferSize), indent_(indent), sp_(sp), eol_(eol), unicode_(unicode),
+	first_(false), key_(false), done_(false), good_(true)
+{
+	buffer_.reserve(bufferSize + bufferSize / 8); // room for the value which fills it
+}
+
+JsonWriter::~JsonWriter()
+{
+	Flush();
+}
+
+bool JsonWriter::Flush()
+{
+	if (sink_ != NULL && !buffer_.empty()) {
+		good_ = sink_->Write(buffer_.data(), buffer_.size()) && good_;
+		buffer_.clear();
+	}
+	return good_;
+}
+
+void JsonWriter::AppendIndent(size_t indent)
+{
+	for (size_t i = 0; i < indent; ++i) {
+		*out_ += sp_;
+	}
+}
+
+void JsonWriter::Separate()
+{
+	if (!first_) {
+		*out_ += ',';
+	}
+	*out_ += eol_;
+	AppendIndent(indent_ + closing_.size());
+}
+
+void JsonWriter::BeforeValue()
+{
+	assert(!done_); // a single value
+	if (closing_.empty()) {
+		return;
+	} else if (closing_[closing_.size() - 1] == '}') {
+		assert(key_); // the value of a key
+		key_ = false;
+	} else {
+		Separate();
+	}
+}
+
+void JsonWriter::AfterValue()
+{
+	first_ = false;
+	done_ = closing_.empty();
+	if (sink_ != NULL && buffer_.size() >= bufferSize_) {
+		Flush();
+	}
+}
+
+void JsonWriter::StartObject()
+{
+	BeforeValue();
+	*out_ += '{';
+	closing_ += '}';
+	first_ = true;
+}
+
+void JsonWriter::StartArray()
+{
+	BeforeValue();
+	*out_ += '[';
+	closing_ += ']';
+	first_ = true;
+}
+
+void JsonWriter::Close(char bracket)
+{
+	assert(!closing_.empty() && closing_[closing_.size() - 1] == bracket && !key_);
+	*out_ += eol_;
+	AppendIndent(indent_ + closing_.size() - 1);
+	*out_ += bracket;
+	closing_.erase(closing_.size() - 1);
+	AfterValue();
+}
+
+void JsonWriter::EndObject()
+{
+	Close('}');
+}
+
+void JsonWriter::EndArray()
+{
+	Close(']');
+}
+
+void JsonWriter::Key(const std::string& name)
+{
+	assert(!closing_.empty() && closing_[closing_.size() - 1] == '}' && !key_);
+	Separate();
+	Json::AppendString(*out_, name, unicode_);
+	*out_ += ':';
+	key_ = true;
+}
+
+void JsonWriter::Key(const char* name)
+{
+	Key(std::string(name));
+}
+
+void JsonWriter::Null()
+{
+	BeforeValue();
+	*out_ += "null";
+	AfterValue();
+}
+
+void JsonWriter::Value(bool v)
+{
+	BeforeValue();
+	Json::AppendValue(*out_, v);
+	AfterValue();
+}
+
+void JsonWriter::Value(const std::string& v)
+{
+	BeforeValue();
+	Json::AppendString(*out_, v, unicode_);
+	AfterValue();
+}
+
+void JsonWriter::Value(const char* v)
+{
+	Value(std::string(v));
+}
+
+void JsonWriter::Value(const Json& v)
+{
+	BeforeValue();
+	*out_ += v.Dump(indent_ + closing_.size(), sp_, eol_, unicode_);
+	AfterValue();
+}
@@ -0,0 +1,103 @@
+#ifndef __JSON_WRITER_H__
+#define __JSON_WRITER_H__
+
+#include "Json.h"
+
+/*
+ * Streaming writer of json text, which produces output without building any
+ * Json node:
+ *
+ *   std::string out;
+ *   JsonWriter writer(out);  // or JsonWriter writer(out, 0, "\t", "\n") as Format()
+ *   writer.StartObject();
+ *   writer.Key("id");
+ *   writer.Value(42);
+ *   writer.Key("tags");
+ *   writer.StartArray();
+ *   writer.Value("a");
+ *   writer.EndArray();
+ *   writer.EndObject();      // out is {"id":42,"tags":["a"]}
+ *
+ * The text is the same as Dump() or Format() of the equivalent document with
+ * the same indent, sp, eol and unicode. It is appended to a string, or written
+ * to a Sink whenever a buffer of bufferSize bytes is full and by Flush().
+ * Unless NDEBUG is defined, the calls are checked with assert() to form one
+ * json value: keys only in objects, one value after each key, closing brackets
+ * matching the opening ones.
+ */
+class JsonWriter
+{
+public:
+	class Sink
+	{
+	public:
+		virtual ~Sink() { }
+		virtual bool Write(const char* data, size_t size) = 0; // false on failure
+	};
+
+	explicit JsonWriter(std::string& out, size_t indent = 0, const std::string& sp = "",
+			const std::string& eol = "", bool unicode = false);
+	explicit JsonWriter(Sink& sink, size_t bufferSize = 65536, size_t indent = 0, const std::string& sp = "",
+			const std::string& eol = "", bool unicode = false);
+	~JsonWriter(); // flushes to the sink
+
+	void StartObject();
+	void EndObject();
+	void StartArray();
+	void EndArray();
+	void Key(const std::string& name);
+	void Key(const char* name);
+
+	void Null();
+	void Value(bool v);
+	void Value(int8_t v)   { Number(v); }
+	void Value(int16_t v)  { Number(v); }
+	void Value(int32_t v)  { Number(v); }
+	void Value(int64_t v)  { Number(v); }
+	void Value(uint8_t v)  { Number(v); }
+	void Value(uint16_t v) { Number(v); }
+	void Value(uint32_t v) { Number(v); }
+	void Value(uint64_t v) { Number(v); }
+	void Value(float v)    { Number(v); }
+	void Value(double v)   { Number(v); }
+	void Value(const std::string& v);
+	void Value(const char* v);
+	void Value(const Json& v); // a whole document
+
+	bool Complete() const { return done_; } // whether one whole value has been written
+	bool Flush(); // false if the sink failed to write any output so far
+private:
+	template <typename T> void Number(T v);
+	void BeforeValue();
+	void AfterValue();
+	void Separate(); // before an item
+	void Close(char bracket);
+	void AppendIndent(size_t indent);
+private:
+	std::string* out_;
+	std::string buffer_; // of a sink
+	Sink* sink_;
+	size_t bufferSize_;
+	size_t indent_;
+	std::string sp_;
+	std::string eol_;
+	bool unicode_;
+	std::string closing_; // brackets of the containers started
+	bool first_; // whether the current container has no item yet
+	bool key_;   // whether a key waits for its value
+	bool done_;
+	bool good_;
+private:
+	JsonWriter(const JsonWriter&); // disable copy
+	void operator = (const JsonWriter&);
+};
+
+template <typename T>
+void JsonWriter::Number(T v)
+{
+	BeforeValue();
+	Json::AppendValue(*out_, v);
+	AfterValue();
+}
+
+#endif
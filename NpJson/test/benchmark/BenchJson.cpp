@@ -0,0 +1,710 @@
+/*
+ * Benchmark suite of the main Json operations over a standard corpus.
+ *
+ * Every case runs with an auto-calibrated number of operations (at least the
+ * given time), and reports ns/op, MB/s (for cases which consume or produce
+ * json text) and heap allocations/op, as tab-separated values or as json.
+ *
+ * usage: BenchJson [-t seconds] [-f tsv|json] [-d corpus_dir] [filter...]
+ *
+ *   -t    minimum measuring time of each case, 0.2 by default
+ *   -f    output format, tsv by default
+ *   -d    also benchmark every *.json file of a directory
+ *   filter  run only the cases whose "corpus/case" name contains one of them
+ */
+#include "Json.h"
+#include "JsonBind.h"
+#include "JsonReader.h"
+#include "JsonWriter.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <new>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifdef NPJSON_STATS
+static size_t Allocations() // counted by the instrumentation build of NpJson
+{
+	return Json::GetStats().allocations;
+}
+#else
+static size_t s_allocations = 0; // this benchmark is single-threaded
+
+void* operator new(size_t size)
+{
+	++s_allocations;
+	void* p = malloc(size ? size : 1);
+	if (p == NULL) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p) throw()
+{
+	free(p);
+}
+
+static size_t Allocations()
+{
+	return s_allocations;
+}
+#endif
+
+static double Now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+struct Corpus
+{
+	std::string name;
+	std::string text;  // compact json
+	std::string file;  // the same text in a file, for Load()
+	std::string query; // a typical Query() path, empty if none
+	Json doc;
+	Json copy;
+	std::vector<std::string> keys; // of the top level object
+	std::vector<JsonKey> jsonKeys; // the first MAX_JSON_KEYS of them precomputed
+	std::vector<std::string> fields; // of the first record if the top level is an array of objects
+};
+
+static const size_t MAX_JSON_KEYS = 64; // JsonKeys are meant for a fixed set of names, which are kept for ever
+
+static volatile size_t s_sink; // results are written here so that nothing is optimized away
+
+// Each case performs n operations and returns the number of json bytes processed (0 if not relevant)
+typedef size_t (*BenchProc)(const Corpus& c, size_t n);
+
+static size_t ParseStrict(const Corpus& c, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		Json j;
+		s_sink += j.Parse(c.text, NULL, true);
+	}
+	return n * c.text.size();
+}
+
+static size_t Validate(const Corpus& c, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		s_sink += Json::Validate(c.text.data(), c.text.size(), true);
+	}
+	return n * c.text.size();
+}
+
+static size_t ParseNonStrict(const Corpus& c, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		Json j;
+		s_sink += j.Parse(c.text);
+	}
+	return n * c.text.size();
+}
+
+static size_t Load(const Corpus& c, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		Json j;
+		s_sink += j.Load(c.file, true);
+	}
+	return n * c.text.size();
+}
+
+static size_t Save(const Corpus& c, size_t n, int flags)
+{
+	std::string file = c.file + ".save";
+	for (size_t i = 0; i < n; ++i) {
+		s_sink += c.doc.Save(file, flags);
+	}
+	struct stat st;
+	size_t size = (stat(file.c_str(), &st) == 0 ? st.st_size : 0);
+	unlink(file.c_str());
+	return n * size;
+}
+
+static size_t SaveFormat(const Corpus& c, size_t n)
+{
+	return Save(c, n, 0);
+}
+
+static size_t SaveCompact(const Corpus& c, size_t n)
+{
+	return Save(c, n, Json::SAVE_COMPACT);
+}
+
+#ifdef NPJSON_ZLIB
+static size_t SaveGzip(const Corpus& c, size_t n)
+{
+	std::string file = c.file + ".gz";
+	for (size_t i = 0; i < n; ++i) {
+		s_sink += c.doc.Save(file, Json::SAVE_COMPACT);
+	}
+	unlink(file.c_str());
+	return n * c.text.size(); // of the text, as by load_gz
+}
+
+static size_t LoadGzip(const Corpus& c, size_t n)
+{
+	std::string file = c.file + ".gz";
+	c.doc.Save(file, Json::SAVE_COMPACT);
+	for (size_t i = 0; i < n; ++i) {
+		Json j;
+		s_sink += j.Load(file, true);
+	}
+	unlink(file.c_str());
+	return n * c.text.size();
+}
+#endif
+
+static size_t Dump(const Corpus& c, size_t n)
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < n; ++i) {
+		bytes += c.doc.Dump().size();
+	}
+	return bytes;
+}
+
+static size_t Serialize(const Corpus& c, size_t n) // in chunks as to a socket
+{
+	static char buffer[65536];
+	size_t bytes = 0;
+	for (size_t i = 0; i < n; ++i) {
+		Json::Serializer serializer(c.doc);
+		while (!serializer.Done()) {
+			bytes += serializer.Fill(buffer, sizeof(buffer));
+		}
+	}
+	return bytes;
+}
+
+static size_t DumpU(const Corpus& c, size_t n)
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < n; ++i) {
+		bytes += c.doc.DumpU().size();
+	}
+	return bytes;
+}
+
+static size_t Format(const Corpus& c, size_t n)
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < n; ++i) {
+		bytes += c.doc.Format().size();
+	}
+	return bytes;
+}
+
+static size_t SubKey(const Corpus& c, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		s_sink += c.doc.Sub(c.keys[i % c.keys.size()]).Type();
+	}
+	return 0;
+}
+
+static size_t SubJsonKey(const Corpus& c, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		s_sink += c.doc.Sub(c.jsonKeys[i % c.jsonKeys.size()]).Type();
+	}
+	return 0;
+}
+
+static size_t SubIndex(const Corpus& c, size_t n)
+{
+	size_t size = c.doc.Size();
+	for (size_t i = 0; i < n; ++i) {
+		s_sink += c.doc.Sub((i * 7919) % size).Type();
+	}
+	return 0;
+}
+
+static size_t Query(const Corpus& c, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		s_sink += c.doc.Query(c.query).Size();
+	}
+	return 0;
+}
+
+static size_t EqualTo(const Corpus& c, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		s_sink += c.doc.EqualTo(c.copy);
+	}
+	return 0;
+}
+
+static size_t Iterate(const Corpus& c, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		for (Json::ConstIterator it = c.doc.Begin(); it != c.doc.End(); ++it) {
+			s_sink += it->Type();
+		}
+	}
+	return 0;
+}
+
+static size_t Copy(const Corpus& c, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		Json j(c.doc);
+		s_sink += j.Type();
+	}
+	return 0;
+}
+
+static size_t AsDoubles(const Corpus& c, size_t n)
+{
+	size_t size = c.doc.Size();
+	for (size_t i = 0; i < n; ++i) {
+		double sum = 0;
+		for (size_t k = 0; k < size; ++k) {
+			sum += c.doc[k].AsDouble();
+		}
+		s_sink += (sum > 0);
+	}
+	return 0;
+}
+
+static size_t ExtractDoubles(const Corpus& c, size_t n)
+{
+	std::vector<double> values;
+	for (size_t i = 0; i < n; ++i) {
+		s_sink += c.doc.ExtractTo(values);
+	}
+	return 0;
+}
+
+static size_t ParseDoubles(const Corpus& c, size_t n)
+{
+	std::vector<double> values;
+	for (size_t i = 0; i < n; ++i) {
+		s_sink += Json::ParseVector(c.text, values, NULL, true);
+	}
+	return n * c.text.size();
+}
+
+static size_t SubFields(const Corpus& c, size_t n)
+{
+	size_t rows = c.doc.Size();
+	for (size_t i = 0; i < n; ++i) {
+		std::vector<double> column(rows);
+		for (size_t k = 0; k < c.fields.size(); ++k) {
+			for (size_t row = 0; row < rows; ++row) {
+				column[row] = c.doc[row][c.fields[k]].AsDouble();
+			}
+		}
+		s_sink += column.size();
+	}
+	return 0;
+}
+
+static size_t Columns(const Corpus& c, size_t n, bool parse)
+{
+	std::vector<std::vector<double> > values(c.fields.size());
+	std::vector<std::vector<bool> > valid(c.fields.size());
+	Json::Columns columns;
+	for (size_t k = 0; k < c.fields.size(); ++k) {
+		columns.Add(c.fields[k], values[k], &valid[k]);
+	}
+	for (size_t i = 0; i < n; ++i) {
+		s_sink += (parse ? columns.Parse(c.text, NULL, true) : columns.Extract(c.doc));
+	}
+	return (parse ? n * c.text.size() : 0);
+}
+
+static size_t ExtractColumns(const Corpus& c, size_t n)
+{
+	return Columns(c, n, false);
+}
+
+static size_t ParseColumns(const Corpus& c, size_t n)
+{
+	return Columns(c, n, true);
+}
+
+struct Record // the rows of the "records" corpus, other fields are skipped
+{
+	int64_t ts;
+	int64_t id;
+	double v;
+	bool ok;
+	Record(): ts(0), id(0), v(0), ok(false) { }
+};
+NPJSON_BIND(Record) { NPJSON_FIELD(ts); NPJSON_FIELD(id); NPJSON_FIELD(v); NPJSON_FIELD(ok); }
+
+static size_t BindParse(const Corpus& c, size_t n)
+{
+	std::vector<Record> records;
+	for (size_t i = 0; i < n; ++i) {
+		s_sink += JsonBind::Parse(c.text, records);
+	}
+	return n * c.text.size();
+}
+
+static size_t ReadRecords(const Corpus& c, size_t n) // the same fields as BindParse() with JsonReader
+{
+	std::vector<Record> records;
+	for (size_t i = 0; i < n; ++i) {
+		records.clear();
+		JsonReader reader(c.text);
+		JsonReader::StringView key;
+		reader.EnterArray();
+		while (reader.Next()) {
+			records.push_back(Record());
+			Record& r = records.back();
+			reader.EnterObject();
+			while (reader.NextKey(key)) {
+				if (key == "ts") {
+					r.ts = reader.GetInt64();
+				} else if (key == "id") {
+					r.id = reader.GetInt64();
+				} else if (key == "v") {
+					r.v = reader.GetDouble();
+				} else if (key == "ok") {
+					r.ok = reader.GetBool();
+				}
+			}
+		}
+		s_sink += reader.Done();
+	}
+	return n * c.text.size();
+}
+
+static size_t BindDump(const Corpus& c, size_t n)
+{
+	std::vector<Record> records;
+	JsonBind::FromJson(c.doc, records);
+	size_t bytes = 0;
+	for (size_t i = 0; i < n; ++i) {
+		bytes += JsonBind::Dump(records).size();
+	}
+	return bytes;
+}
+
+static size_t WriteRecords(const Corpus& c, size_t n) // the same text as BindDump() with JsonWriter
+{
+	std::vector<Record> records;
+	JsonBind::FromJson(c.doc, records);
+	size_t bytes = 0;
+	for (size_t i = 0; i < n; ++i) {
+		std::string out;
+		JsonWriter writer(out);
+		writer.StartArray();
+		for (size_t k = 0; k < records.size(); ++k) {
+			const Record& r = records[k];
+			writer.StartObject();
+			writer.Key("ts");
+			writer.Value(r.ts);
+			writer.Key("id");
+			writer.Value(r.id);
+			writer.Key("v");
+			writer.Value(r.v);
+			writer.Key("ok");
+			writer.Value(r.ok);
+			writer.EndObject();
+		}
+		writer.EndArray();
+		bytes += out.size();
+	}
+	return bytes;
+}
+
+struct BenchCase
+{
+	const char* name;
+	BenchProc proc;
+	bool object;  // needs a top level object
+	bool array;   // needs a top level array, but not of records
+	bool query;   // needs a query path
+	bool records; // needs a top level array of objects
+};
+
+static const BenchCase CASES[] = {
+	{ "parse_strict", ParseStrict, false, false, false, false },
+	{ "parse", ParseNonStrict, false, false, false, false },
+	{ "validate", Validate, false, false, false, false },
+	{ "load", Load, false, false, false, false },
+	{ "save", SaveFormat, false, false, false, false },
+	{ "save_compact", SaveCompact, false, false, false, false },
+#ifdef NPJSON_ZLIB
+	{ "load_gz", LoadGzip, false, false, false, false },
+	{ "save_gz", SaveGzip, false, false, false, false },
+#endif
+	{ "dump", Dump, false, false, false, false },
+	{ "serialize", Serialize, false, false, false, false },
+	{ "dumpu", DumpU, false, false, false, false },
+	{ "format", Format, false, false, false, false },
+	{ "sub_key", SubKey, true, false, false, false },
+	{ "sub_jsonkey", SubJsonKey, true, false, false, false },
+	{ "sub_index", SubIndex, false, true, false, false },
+	{ "query", Query, false, false, true, false },
+	{ "equal", EqualTo, false, false, false, false },
+	{ "iterate", Iterate, false, false, false, false },
+	{ "copy", Copy, false, false, false, false },
+	{ "as_double", AsDoubles, false, true, false, false },
+	{ "extract", ExtractDoubles, false, true, false, false },
+	{ "parse_vector", ParseDoubles, false, true, false, false },
+	{ "sub_fields", SubFields, false, false, false, true },
+	{ "columns", ExtractColumns, false, false, false, true },
+	{ "parse_columns", ParseColumns, false, false, false, true },
+	{ "bind_parse", BindParse, false, false, false, true },
+	{ "reader", ReadRecords, false, false, false, true },
+	{ "writer", WriteRecords, false, false, false, true },
+	{ "bind_dump", BindDump, false, false, false, true },
+};
+
+static Json ApiPayload()
+{
+	Json j;
+	j["status"] = "ok";
+	j["page"] = 1;
+	j["total"] = 20;
+	for (int i = 0; i < 20; ++i) {
+		Json& item = j["items"][i];
+		item["id"] = 100000 + i;
+		item["name"] = "user name " + Json(i).AsString();
+		item["email"] = "user" + Json(i).AsString() + "@example.com";
+		item["active"] = (i % 3 != 0);
+		item["score"] = i * 1.25;
+		item["tags"][0] = "alpha";
+		item["tags"][1] = "beta";
+		item["address"]["city"] = "Springfield";
+		item["address"]["zip"] = "12345";
+		item["address"]["geo"][0] = 37.7749;
+		item["address"]["geo"][1] = -122.4194;
+	}
+	return j;
+}
+
+static Json Numbers()
+{
+	Json j;
+	for (int i = 0; i < 100000; ++i) {
+		j[i] = (i % 2 == 0 ? Json(i * 31) : Json(i * 0.001));
+	}
+	return j;
+}
+
+static Json Deep()
+{
+	Json j;
+	Json* p = &j;
+	for (int i = 0; i < 500; ++i) {
+		(*p)["level"] = i;
+		(*p)["tags"][0] = i;
+		p = &(*p)["next"];
+	}
+	return j;
+}
+
+static Json LongStrings()
+{
+	std::string text;
+	for (int i = 0; i < 16 * 1024; ++i) {
+		text += (i % 64 == 63 ? '\n' : (i % 50 == 0 ? '"' : static_cast<char>('a' + i % 26)));
+	}
+	Json j;
+	for (int i = 0; i < 64; ++i) {
+		j[i] = text;
+	}
+	return j;
+}
+
+static Json Records()
+{
+	Json j;
+	for (int i = 0; i < 10000; ++i) {
+		Json& r = j[i];
+		r["ts"] = 1700000000 + i;
+		r["id"] = i * 7;
+		r["v"] = i * 0.5;
+		r["ok"] = (i % 2 == 0);
+	}
+	return j;
+}
+
+static Json WideObject()
+{
+	Json j;
+	char key[32];
+	for (int i = 0; i < 20000; ++i) {
+		snprintf(key, sizeof(key), "key%05d", i);
+		j[key] = i;
+	}
+	return j;
+}
+
+static void AddCorpus(std::vector<Corpus>& corpus, const std::string& name, const Json& doc, const std::string& query)
+{
+	corpus.push_back(Corpus());
+	Corpus& c = corpus.back();
+	c.name = name;
+	c.doc = doc;
+	c.copy = doc;
+	c.text = doc.Dump();
+	c.query = query;
+	c.keys = doc.Keys();
+	for (size_t i = 0; i < c.keys.size() && i < MAX_JSON_KEYS; ++i) {
+		c.jsonKeys.push_back(JsonKey(c.keys[i]));
+	}
+	if (doc.Type() == Json::TYPE_ARRAY && doc[0].Type() == Json::TYPE_OBJECT) {
+		c.fields = doc[0].Keys();
+	}
+
+	char file[] = "/tmp/BenchJson.XXXXXX";
+	int fd = mkstemp(file);
+	if (fd >= 0) {
+		close(fd);
+		std::ofstream out(file);
+		out << c.text;
+		c.file = file;
+	}
+}
+
+static void LoadCorpus(std::vector<Corpus>& corpus, const std::string& dir)
+{
+	DIR* d = opendir(dir.c_str());
+	if (d == NULL) {
+		fprintf(stderr, "cannot open corpus directory '%s'\n", dir.c_str());
+		exit(1);
+	}
+	std::vector<std::string> names;
+	for (struct dirent* e = readdir(d); e != NULL; e = readdir(d)) {
+		std::string name = e->d_name;
+		if (name.size() > 5 && name.compare(name.size() - 5, 5, ".json") == 0) {
+			names.push_back(name);
+		}
+	}
+	closedir(d);
+	std::sort(names.begin(), names.end());
+	for (size_t i = 0; i < names.size(); ++i) {
+		Json doc;
+		if (doc.Load(dir + "/" + names[i])) {
+			AddCorpus(corpus, names[i].substr(0, names[i].size() - 5), doc, "");
+		}
+	}
+}
+
+static bool Selected(const std::string& name, const std::vector<std::string>& filters)
+{
+	for (size_t i = 0; i < filters.size(); ++i) {
+		if (name.find(filters[i]) != std::string::npos) {
+			return true;
+		}
+	}
+	return filters.empty();
+}
+
+int main(int argc, char* argv[])
+{
+	double minTime = 0.2;
+	std::string format = "tsv";
+	std::vector<std::string> filters;
+	std::vector<std::string> dirs;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			minTime = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			format = argv[++i];
+		} else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			dirs.push_back(argv[++i]);
+		} else if (argv[i][0] == '-') {
+			fprintf(stderr, "usage: %s [-t seconds] [-f tsv|json] [-d corpus_dir] [filter...]\n", argv[0]);
+			return 1;
+		} else {
+			filters.push_back(argv[i]);
+		}
+	}
+
+	std::vector<Corpus> corpus;
+	AddCorpus(corpus, "api", ApiPayload(), "items/*/address/city");
+	AddCorpus(corpus, "numbers", Numbers(), "");
+	AddCorpus(corpus, "deep", Deep(), "next/next/next/next/level");
+	AddCorpus(corpus, "strings", LongStrings(), "");
+	AddCorpus(corpus, "wide", WideObject(), "key10000");
+	AddCorpus(corpus, "records", Records(), "");
+	for (size_t i = 0; i < dirs.size(); ++i) {
+		LoadCorpus(corpus, dirs[i]);
+	}
+
+	Json results(Json::TYPE_ARRAY);
+	if (format == "tsv") {
+		printf("corpus\tcase\tbytes\toperations\tns/op\tMB/s\tallocs/op\n");
+	}
+	for (size_t i = 0; i < corpus.size(); ++i) {
+		const Corpus& c = corpus[i];
+		for (size_t k = 0; k < sizeof(CASES) / sizeof(CASES[0]); ++k) {
+			const BenchCase& bench = CASES[k];
+			if (!Selected(c.name + "/" + bench.name, filters) ||
+					(bench.object && c.doc.Type() != Json::TYPE_OBJECT) ||
+					(bench.array && (c.doc.Type() != Json::TYPE_ARRAY || !c.fields.empty())) ||
+					(bench.records && c.fields.empty()) ||
+					(bench.query && c.query.empty()) ||
+					(bench.proc == Load && c.file.empty())) {
+				continue;
+			}
+
+			size_t n = 1;
+			size_t bytes = 0;
+			size_t allocations = 0;
+			double elapsed = 0;
+			for (;;) { // grow the number of operations until it takes long enough
+				size_t before = Allocations();
+				double start = Now();
+				bytes = bench.proc(c, n);
+				elapsed = Now() - start;
+				allocations = Allocations() - before;
+				if (elapsed >= minTime) {
+					break;
+				}
+				double factor = (elapsed > 0 ? minTime * 1.2 / elapsed : 100);
+				n = static_cast<size_t>(n * std::min(std::max(factor, 2.0), 100.0));
+			}
+
+			double nsPerOp = elapsed * 1e9 / n;
+			double mbPerSec = bytes / 1e6 / elapsed;
+			double allocsPerOp = static_cast<double>(allocations) / n;
+			if (format == "tsv") {
+				char speed[32] = "-";
+				if (bytes > 0) {
+					snprintf(speed, sizeof(speed), "%.1f", mbPerSec);
+				}
+				printf("%s\t%s\t%lu\t%lu\t%.1f\t%s\t%.1f\n", c.name.c_str(), bench.name,
+						static_cast<unsigned long>(c.text.size()), static_cast<unsigned long>(n),
+						nsPerOp, speed, allocsPerOp);
+				fflush(stdout);
+			} else {
+				Json r;
+				r["corpus"] = c.name;
+				r["case"] = bench.name;
+				r["bytes"] = static_cast<uint64_t>(c.text.size());
+				r["operations"] = static_cast<uint64_t>(n);
+				r["ns_per_op"] = nsPerOp;
+				if (bytes > 0) {
+					r["mb_per_sec"] = mbPerSec;
+				}
+				r["allocs_per_op"] = allocsPerOp;
+				results.Insert(r);
+			}
+		}
+		if (!c.file.empty()) {
+			unlink(c.file.c_str());
+		}
+	}
+	if (format != "tsv") {
+		printf("%s\n", results.Format(0, "  ", "\n", false, false).c_str());
+	}
+	return 0;
+}
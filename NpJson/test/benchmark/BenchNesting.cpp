@@ -0,0 +1,91 @@
+/*
+ * Parse, dump, copy, compare and destroy of a shallow and of a nested document,
+ * to check that walking the tree with explicit stacks costs nothing on usual input.
+ *
+ * usage: BenchNesting [records] [depth] [repeats]
+ */
+#include "Json.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <sys/time.h>
+
+static double Now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static Json MakeShallow(size_t records)
+{
+	Json doc;
+	for (size_t i = 0; i < records; ++i) {
+		Json& r = doc[i];
+		r["id"] = static_cast<uint64_t>(i);
+		r["name"] = "name";
+		r["score"] = i * 0.5;
+		r["tags"][0] = "a";
+		r["tags"][1] = "b";
+	}
+	return doc;
+}
+
+static Json MakeNested(size_t records, size_t depth)
+{
+	Json doc;
+	for (size_t i = 0; i < records / depth; ++i) {
+		Json* p = &doc[i];
+		for (size_t d = 0; d < depth; ++d) {
+			(*p)["id"] = static_cast<uint64_t>(d);
+			p = &(*p)["child"];
+		}
+	}
+	return doc;
+}
+
+static void Bench(const char* name, const Json& doc, int repeats)
+{
+	const std::string text = doc.Dump();
+	double parse = 1e30, dump = 1e30, copy = 1e30, compare = 1e30, destroy = 1e30;
+	for (int n = 0; n < repeats; ++n) {
+		double t0 = Now();
+		Json* parsed = new Json;
+		parsed->Parse(text, NULL, true);
+		double t1 = Now();
+		std::string out = parsed->Dump();
+		double t2 = Now();
+		Json* copied = new Json(*parsed);
+		double t3 = Now();
+		bool same = (*copied == doc);
+		double t4 = Now();
+		delete parsed;
+		delete copied;
+		double t5 = Now();
+		if (!same || out != text) {
+			printf("%s: MISMATCH\n", name);
+			exit(1);
+		}
+		parse = std::min(parse, t1 - t0);
+		dump = std::min(dump, t2 - t1);
+		copy = std::min(copy, t3 - t2);
+		compare = std::min(compare, t4 - t3);
+		destroy = std::min(destroy, (t5 - t4) / 2);
+	}
+	double mb = text.size() / 1e6;
+	printf("%-8s  %8.1f  %10.1f  %10.1f  %10.2f  %10.2f  %10.2f\n", name, mb,
+			mb / parse, mb / dump, copy * 1e3, compare * 1e3, destroy * 1e3);
+}
+
+int main(int argc, char* argv[])
+{
+	size_t records = (argc > 1 ? atoi(argv[1]) : 100000);
+	size_t depth = (argc > 2 ? atoi(argv[2]) : 500);
+	int repeats = (argc > 3 ? atoi(argv[3]) : 5);
+
+	printf("%-8s  %8s  %10s  %10s  %10s  %10s  %10s\n", "document", "MB",
+			"parse MB/s", "dump MB/s", "copy ms", "equal ms", "free ms");
+	Bench("shallow", MakeShallow(records), repeats);
+	Bench("nested", MakeNested(records, depth), repeats);
+	return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * Serialization of a big document: Dump() compared with DumpParallel().
+ *
+ * usage: BenchParallelDump [items] [max_threads] [repeats]
+ */
+#include "Json.h"
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <sys/time.h>
+#include <unistd.h>
+
+static double Now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static Json MakeDocument(size_t items)
+{
+	Json doc;
+	Json& records = doc["records"];
+	for (size_t i = 0; i < items; ++i) {
+		Json& r = records[i];
+		r["id"] = static_cast<uint64_t>(i);
+		r["name"] = "record \"" + std::string(1, static_cast<char>('a' + i % 26)) + "\"";
+		r["score"] = i * 0.25;
+		r["active"] = (i % 2 == 0);
+		r["tags"][0] = "x";
+		r["tags"][1] = "y";
+	}
+	doc["count"] = static_cast<uint64_t>(items);
+	return doc;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t items = (argc > 1 ? atoi(argv[1]) : 200000);
+	size_t maxThreads = (argc > 2 ? atoi(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN));
+	int repeats = (argc > 3 ? atoi(argv[3]) : 3);
+
+	Json doc = MakeDocument(items);
+	std::string expected = doc.Dump();
+	printf("%lu items, %.1f MB, %ld cpus\n", static_cast<unsigned long>(items),
+			expected.size() / 1e6, sysconf(_SC_NPROCESSORS_ONLN));
+	printf("%-14s  %7s  %10s  %10s\n", "mode", "threads", "ms", "MB/s");
+
+	for (size_t threads = 0; threads <= maxThreads; threads = (threads == 0 ? 1 : threads * 2)) {
+		double best = 1e30;
+		bool same = true;
+		for (int n = 0; n < repeats; ++n) {
+			double start = Now();
+			std::string out = (threads == 0 ? doc.Dump() : doc.DumpParallel(threads));
+			best = std::min(best, Now() - start);
+			same = same && (out == expected);
+		}
+		printf("%-14s  %7lu  %10.2f  %10.1f%s\n", (threads == 0 ? "Dump" : "DumpParallel"),
+				static_cast<unsigned long>(threads), best * 1e3, expected.size() / 1e6 / best,
+				(same ? "" : "  MISMATCH"));
+		if (!same) {
+			return 1;
+		}
+	}
+	return 0;
+}
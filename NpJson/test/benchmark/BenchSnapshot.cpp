@@ -0,0 +1,131 @@
+/*
+ * Readers of a hot-reloaded config: a mutex guarded Json compared with JsonSnapshot.
+ *
+ * usage: BenchSnapshot [max_readers] [seconds_per_run] [reload_interval_us]
+ */
+#include "JsonSnapshot.h"
+#include <cstdlib>
+#include <cstdio>
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static const char CONFIG[] = "{"
+	"\"listen\":{\"host\":\"0.0.0.0\",\"port\":8080,\"backlog\":1024},"
+	"\"workers\":16,\"timeout_ms\":3000,"
+	"\"routes\":[{\"path\":\"/a\",\"upstream\":\"10.0.0.1\"},{\"path\":\"/b\",\"upstream\":\"10.0.0.2\"}],"
+	"\"features\":{\"gzip\":true,\"cache\":false,\"trace\":true}"
+	"}";
+
+static double Now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+struct Shared
+{
+	int stop;
+	pthread_mutex_t mutex;
+	Json locked;
+	JsonSnapshot snapshot;
+};
+
+struct Reader
+{
+	Shared* shared;
+	bool useSnapshot;
+	long reads;
+	long checksum;
+	char padding[64]; // keep the counters of different readers apart
+};
+
+static long ReadConfig(const Json& config)
+{
+	return config["listen"]["port"].Type() + config["workers"].Type() + config["features"]["gzip"].Type();
+}
+
+static void* ReaderProc(void* p)
+{
+	Reader* r = static_cast<Reader*>(p);
+	Shared* shared = r->shared;
+	if (r->useSnapshot) {
+		JsonSnapshot::Reader reader(shared->snapshot);
+		while (!__atomic_load_n(&shared->stop, __ATOMIC_RELAXED)) {
+			JsonSnapshot::Guard guard(reader);
+			r->checksum += ReadConfig(*guard);
+			++r->reads;
+		}
+	} else {
+		while (!__atomic_load_n(&shared->stop, __ATOMIC_RELAXED)) {
+			pthread_mutex_lock(&shared->mutex);
+			r->checksum += ReadConfig(shared->locked);
+			pthread_mutex_unlock(&shared->mutex);
+			++r->reads;
+		}
+	}
+	return NULL;
+}
+
+static void Run(bool useSnapshot, size_t readers, double seconds, long intervalUs)
+{
+	Shared shared;
+	shared.stop = 0;
+	pthread_mutex_init(&shared.mutex, NULL);
+	shared.locked = J(CONFIG);
+	shared.snapshot.Publish(J(CONFIG));
+
+	std::vector<pthread_t> threads(readers);
+	std::vector<Reader> args(readers);
+	for (size_t i = 0; i < readers; ++i) {
+		args[i].shared = &shared;
+		args[i].useSnapshot = useSnapshot;
+		args[i].reads = 0;
+		args[i].checksum = 0;
+		pthread_create(&threads[i], NULL, ReaderProc, &args[i]);
+	}
+
+	long reloads = 0;
+	double start = Now();
+	while (Now() - start < seconds) {
+		usleep(intervalUs);
+		Json config;
+		config.Parse(CONFIG, NULL, true); // the reload itself happens outside of any lock
+		if (useSnapshot) {
+			config.SetPersistent();
+			shared.snapshot.Publish(config);
+		} else {
+			pthread_mutex_lock(&shared.mutex);
+			shared.locked = config;
+			pthread_mutex_unlock(&shared.mutex);
+		}
+		++reloads;
+	}
+	__atomic_store_n(&shared.stop, 1, __ATOMIC_RELAXED);
+
+	long reads = 0;
+	for (size_t i = 0; i < readers; ++i) {
+		pthread_join(threads[i], NULL);
+		reads += args[i].reads;
+	}
+	double elapsed = Now() - start;
+	printf("%-8s  %7lu  %12.0f  %12.1f  %7ld  %7lu\n", (useSnapshot ? "snapshot" : "mutex"),
+			static_cast<unsigned long>(readers), reads / elapsed, elapsed * 1e9 * readers / reads,
+			reloads, static_cast<unsigned long>(shared.snapshot.Retired()));
+	pthread_mutex_destroy(&shared.mutex);
+}
+
+int main(int argc, char* argv[])
+{
+	size_t maxReaders = (argc > 1 ? atoi(argv[1]) : 8);
+	double seconds = (argc > 2 ? atof(argv[2]) : 1.0);
+	long intervalUs = (argc > 3 ? atol(argv[3]) : 1000);
+
+	printf("%-8s  %7s  %12s  %12s  %7s  %7s\n", "mode", "readers", "reads/s", "ns/read", "reloads", "retired");
+	for (size_t readers = 1; readers <= maxReaders; readers *= 2) {
+		Run(false, readers, seconds, intervalUs);
+		Run(true, readers, seconds, intervalUs);
+	}
+	return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * Writes the results of a unit test run as json ('-o file') and compares them
+ * with the results of an earlier run ('-B file', tolerance '-x', 0.2 by default):
+ *
+ *   {"cases": {"Json.Value": {"type": "test", "passed": true, "wall_ms": 0.05, ...}, ...}}
+ *
+ * Measured benches are compared by median_ns, tests by cpu_ms if the baseline
+ * took at least MIN_BASELINE_CPU_MS, shorter ones are too noisy to compare.
+ */
+#include "Json.h"
+#include "UnitTest.h"
+#include <cstdio>
+#include <iostream>
+
+static const double MIN_BASELINE_CPU_MS = 10;
+
+class JsonReport: public UnitTestReporter
+{
+public:
+	JsonReport() { UnitTestReporter::Set(this); }
+	virtual bool Report(const std::vector<UnitTestResult>& results, const std::string& output,
+			const std::string& baseline, double tolerance);
+private:
+	static Json ToJson(const UnitTestResult& result);
+	static bool Compare(const std::string& name, const char* metric, double current, double base, double tolerance);
+};
+
+static JsonReport s_report;
+
+Json JsonReport::ToJson(const UnitTestResult& result)
+{
+	const UnitTestStats& stats = result.stats;
+	Json j;
+	j["type"] = (result.bench ? "bench" : "test");
+	j["passed"] = result.failure.empty();
+	if (!result.failure.empty()) {
+		j["failure"] = result.failure;
+	}
+	j["assertions"] = static_cast<uint64_t>(stats.assertions);
+	j["wall_ms"] = stats.wall * 1e3;
+	j["cpu_ms"] = stats.cpu * 1e3;
+	j["rss_kb"] = static_cast<int64_t>(stats.rss);
+	if (stats.iterations > 0) {
+		j["iterations"] = static_cast<uint64_t>(stats.iterations);
+		j["median_ns"] = stats.median;
+		j["min_ns"] = stats.min;
+		j["p99_ns"] = stats.p99;
+	}
+	return j;
+}
+
+bool JsonReport::Compare(const std::string& name, const char* metric, double current, double base, double tolerance)
+{
+	if (current <= base * (1 + tolerance)) {
+		return true;
+	}
+	char text[128];
+	snprintf(text, sizeof(text), " %s %.1f, baseline %.1f (+%.0f%%)", metric, current, base, (current / base - 1) * 100);
+	std::cout << " > regression: '" << name << "'" << text << std::endl;
+	return false;
+}
+
+bool JsonReport::Report(const std::vector<UnitTestResult>& results, const std::string& output,
+		const std::string& baseline, double tolerance)
+{
+	Json cases;
+	for (size_t i = 0; i < results.size(); ++i) {
+		cases[results[i].name] = ToJson(results[i]);
+	}
+
+	bool passed = true;
+	if (!output.empty()) {
+		Json report;
+		report["cases"] = cases;
+		passed = report.Save(output);
+	}
+	if (!baseline.empty()) {
+		Json base;
+		if (!base.Load(baseline)) {
+			std::cout << "cannot load unit test baseline '" << baseline << "'" << std::endl;
+			return false;
+		}
+		const Json& baseCases = base["cases"];
+		for (size_t i = 0; i < results.size(); ++i) {
+			const UnitTestResult& r = results[i];
+			if (!r.failure.empty() || !baseCases.Has(r.name)) {
+				continue;
+			}
+			const Json& current = cases[r.name];
+			const Json& old = baseCases[r.name];
+			if (current.Has("median_ns") && old.Has("median_ns")) {
+				passed &= Compare(r.name, "median_ns", current["median_ns"].AsDouble(), old["median_ns"].AsDouble(), tolerance);
+			} else if (!r.bench && old["cpu_ms"].AsDouble() >= MIN_BASELINE_CPU_MS) {
+				passed &= Compare(r.name, "cpu_ms", current["cpu_ms"].AsDouble(), old["cpu_ms"].AsDouble(), tolerance);
+			}
+		}
+	}
+	return passed;
+}
@@ -1,5 +1,11 @@
 #include "Json.h"
 #include "UnitTest.h"
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 UNIT_TEST(Json, Value)
 {
@@ -474,6 +480,176 @@ UNIT_TEST(Json, NonStrictParsing)
 	UNIT_ASSERT_EQUAL(cj[4].AsString(), "0b");
 	UNIT_ASSERT_EQUAL(cj[5].Type(), Json::TYPE_STRING);
 	UNIT_ASSERT_EQUAL(cj[5].AsString(), "-1c");
+
+	UNIT_ASSERT_EQUAL(j.Parse("[1"), false); // unterminated containers do not hang
+	UNIT_ASSERT_EQUAL(j.Parse("[1 :"), false);
+	UNIT_ASSERT_EQUAL(j.Parse("{\"a\":1"), false);
+}
+
+template <typename T>
+static bool SameAsItems(const Json& j, const std::vector<T>& values, T (Json::*as)() const)
+{
+	if (values.size() != j.Size()) {
+		return false;
+	}
+	for (size_t i = 0; i < values.size(); ++i) {
+		if (!(values[i] == (j[i].*as)())) {
+			return false;
+		}
+	}
+	return true;
+}
+
+UNIT_TEST(Json, ExtractVector)
+{
+	const char* text = "[null,true,false,\"12abc\",-34,3.5,1e3,\"x\",[1,2],{},\"0\",\"false\",300,-1]";
+	Json j(J(text));
+	UNIT_ASSERT(SameAsItems(j, j.AsVector<int8_t>(), &Json::AsInt8));
+	UNIT_ASSERT(SameAsItems(j, j.AsVector<int16_t>(), &Json::AsInt16));
+	UNIT_ASSERT(SameAsItems(j, j.AsVector<int32_t>(), &Json::AsInt32));
+	UNIT_ASSERT(SameAsItems(j, j.AsVector<int64_t>(), &Json::AsInt64));
+	UNIT_ASSERT(SameAsItems(j, j.AsVector<uint8_t>(), &Json::AsUint8));
+	UNIT_ASSERT(SameAsItems(j, j.AsVector<uint16_t>(), &Json::AsUint16));
+	UNIT_ASSERT(SameAsItems(j, j.AsVector<uint32_t>(), &Json::AsUint32));
+	UNIT_ASSERT(SameAsItems(j, j.AsVector<uint64_t>(), &Json::AsUint64));
+	UNIT_ASSERT(SameAsItems(j, j.AsVector<float>(), &Json::AsFloat));
+	UNIT_ASSERT(SameAsItems(j, j.AsVector<double>(), &Json::AsDouble));
+	UNIT_ASSERT(SameAsItems(j, j.AsVector<bool>(), &Json::AsBool));
+	UNIT_ASSERT(SameAsItems(j, j.AsVector<std::string>(), &Json::AsString));
+
+	std::vector<double> values(3, 1.0);
+	UNIT_ASSERT_EQUAL(J("{}").ExtractTo(values), false);
+	UNIT_ASSERT_EQUAL(values.size(), 0);
+
+	// parsed straight from text, the same values without nested containers
+	std::vector<int32_t> direct;
+	UNIT_ASSERT_EQUAL(Json::ParseVector("[null,true,false,\"12abc\",-34,3.5,1e3,\"x\"]", direct, NULL, true), true);
+	std::vector<int32_t> extracted = J("[null,true,false,\"12abc\",-34,3.5,1e3,\"x\"]").AsVector<int32_t>();
+	UNIT_ASSERT(direct == extracted);
+	std::vector<std::string> strings;
+	UNIT_ASSERT_EQUAL(Json::ParseVector(" [ \"a\\tb\" , 1.50 , null, true ] ", strings), true);
+	UNIT_ASSERT_EQUAL(strings.size(), 4);
+	UNIT_ASSERT_EQUAL(strings[0], "a\tb");
+	UNIT_ASSERT_EQUAL(strings[1], "1.50");
+	UNIT_ASSERT_EQUAL(strings[2], "");
+	UNIT_ASSERT_EQUAL(strings[3], "true");
+	std::vector<bool> flags;
+	UNIT_ASSERT_EQUAL(Json::ParseVector("[]", flags, NULL, true), true);
+	UNIT_ASSERT_EQUAL(flags.size(), 0);
+	UNIT_ASSERT_EQUAL(Json::ParseVector("[a,,b c]", strings), true); // non-strict as Parse()
+	UNIT_ASSERT_EQUAL(strings.size(), 3);
+	UNIT_ASSERT_EQUAL(strings[2], "c");
+
+	size_t pos = 0;
+	UNIT_ASSERT_EQUAL(Json::ParseVector("[1,[2]]", direct, &pos), false);
+	UNIT_ASSERT_EQUAL(pos, 3);
+	UNIT_ASSERT_EQUAL(Json::ParseVector("[1,2,]", direct, NULL, true), false);
+	UNIT_ASSERT_EQUAL(Json::ParseVector("[1,2,]", direct), true);
+	UNIT_ASSERT_EQUAL(Json::ParseVector("[1,2", direct), false);
+	UNIT_ASSERT_EQUAL(Json::ParseVector("[1] x", direct), false);
+	UNIT_ASSERT_EQUAL(Json::ParseVector("{}", direct), false);
+}
+
+template <typename T>
+static bool SameAsConverted(const Json& j, T (Json::*as)() const) // by every typed extraction
+{
+	std::vector<T> values;
+	if (!j.ExtractTo(values) || !SameAsItems(j, values, as)) {
+		return false;
+	} else if (!Json::ParseVector(j.Dump(), values, NULL, true) || !SameAsItems(j, values, as)) {
+		return false;
+	}
+	Json rows;
+	for (size_t i = 0; i < j.Size(); ++i) {
+		Json row;
+		row["v"] = j[i];
+		rows.Insert(row);
+		T value = T();
+		if (!j[i].Get(value) || !(value == (j[i].*as)())) {
+			return false;
+		}
+	}
+	Json::Columns columns;
+	columns.Add("v", values);
+	return (columns.Extract(rows) && SameAsItems(j, values, as) &&
+			columns.Parse(rows.Dump(), NULL, true) && SameAsItems(j, values, as));
+}
+
+UNIT_TEST(Json, ExtractOutOfRange) // saturated as by As*(), not wrapped
+{
+	Json j(J("[5000000000,99999999999999999999,-5000000000,-99999999999999999999,18446744073709551615,"
+		"18446744073709551616,-9223372036854775809,65536,-65536,-70000,-1,-2147483649,3.7,-3.7,-0.5,1e3,"
+		"1e999,-1e999,1e39,-1e39,1e-320,\"  12\",\"+7\",\"- 5\",\"--1\",\"1e\",\"2E+\",\"12abc\",\"0x10\","
+		"\"nan\",\"-inf\",\"\"]"));
+	UNIT_ASSERT_EQUAL(j.AsVector<int32_t>()[0], 2147483647);
+	UNIT_ASSERT_EQUAL(j.AsVector<int32_t>()[1], 2147483647);
+	UNIT_ASSERT(SameAsConverted(j, &Json::AsInt8));
+	UNIT_ASSERT(SameAsConverted(j, &Json::AsInt16));
+	UNIT_ASSERT(SameAsConverted(j, &Json::AsInt32));
+	UNIT_ASSERT(SameAsConverted(j, &Json::AsInt64));
+	UNIT_ASSERT(SameAsConverted(j, &Json::AsUint8));
+	UNIT_ASSERT(SameAsConverted(j, &Json::AsUint16));
+	UNIT_ASSERT(SameAsConverted(j, &Json::AsUint32));
+	UNIT_ASSERT(SameAsConverted(j, &Json::AsUint64));
+	UNIT_ASSERT(SameAsConverted(j, &Json::AsFloat));
+	UNIT_ASSERT(SameAsConverted(j, &Json::AsDouble));
+}
+
+UNIT_TEST(Json, Columns)
+{
+	const char* text = "[{\"ts\":100,\"id\":\"a\",\"v\":1.5},"
+		"{\"v\":null,\"ts\":101,\"id\":\"b\",\"extra\":[1,2]},"
+		"null,"
+		"{\"ts\":\"102\",\"id\":3,\"v\":true,\"more\":{\"x\":1}}]";
+	std::vector<int64_t> ts;
+	std::vector<std::string> id;
+	std::vector<double> v;
+	std::vector<bool> tsValid;
+	std::vector<bool> vValid;
+	Json::Columns columns;
+	columns.Add("ts", ts, &tsValid).Add("id", id).Add("v", v, &vValid);
+
+	for (int pass = 0; pass < 2; ++pass) { // from a document, then straight from text
+		if (pass == 0) {
+			UNIT_ASSERT_EQUAL(columns.Extract(J(text)), true);
+		} else {
+			UNIT_ASSERT_EQUAL(columns.Parse(text, NULL, true), true);
+		}
+		UNIT_ASSERT_EQUAL(columns.Rows(), 4);
+		UNIT_ASSERT_EQUAL(ts.size(), 4);
+		UNIT_ASSERT_EQUAL(ts[0], 100);
+		UNIT_ASSERT_EQUAL(ts[1], 101);
+		UNIT_ASSERT_EQUAL(ts[2], 0);
+		UNIT_ASSERT_EQUAL(ts[3], 102);
+		UNIT_ASSERT_EQUAL(tsValid[0] && tsValid[1] && !tsValid[2] && tsValid[3], true);
+		UNIT_ASSERT_EQUAL(id[0], "a");
+		UNIT_ASSERT_EQUAL(id[1], "b");
+		UNIT_ASSERT_EQUAL(id[2], "");
+		UNIT_ASSERT_EQUAL(id[3], "3");
+		UNIT_ASSERT_EQUAL(v[0], 1.5);
+		UNIT_ASSERT_EQUAL(v[1], 0);
+		UNIT_ASSERT_EQUAL(v[3], 1);
+		UNIT_ASSERT_EQUAL(vValid[0] && !vValid[1] && !vValid[2] && vValid[3], true);
+	}
+
+	std::vector<std::string> extra;
+	Json::Columns nested;
+	nested.Add("extra", extra);
+	UNIT_ASSERT_EQUAL(nested.Parse(text), true);
+	UNIT_ASSERT_EQUAL(extra[1], "[1,2]");
+	UNIT_ASSERT_EQUAL(nested.Parse("[{extra:a,,extra:b},{}]"), true); // non-strict, the last duplicate wins
+	UNIT_ASSERT_EQUAL(nested.Rows(), 2);
+	UNIT_ASSERT_EQUAL(extra[0], "b");
+
+	size_t pos = 0;
+	UNIT_ASSERT_EQUAL(columns.Parse("[{\"ts\":1},2]", &pos), false);
+	UNIT_ASSERT_EQUAL(pos, 10);
+	UNIT_ASSERT_EQUAL(columns.Parse("[{\"ts\":1,}]", NULL, true), false);
+	UNIT_ASSERT_EQUAL(columns.Parse("[{\"ts\":1}", NULL, true), false);
+	UNIT_ASSERT_EQUAL(columns.Extract(J("[1]")), false);
+	UNIT_ASSERT_EQUAL(columns.Extract(J("{}")), false);
+	UNIT_ASSERT_EQUAL(columns.Rows(), 0);
+	UNIT_ASSERT_EQUAL(ts.size(), 0);
 }
 
 UNIT_TEST(Json, ValueDump)
@@ -575,11 +751,47 @@ UNIT_TEST(Json, Unicode)
 
 	UNIT_ASSERT_EQUAL(j.Parse("{\"测试\":\"abc\"}"), true);
 	UNIT_ASSERT_EQUAL(cj.Dump(), "{\"测试\":\"abc\"}");
-	UNIT_ASSERT_EQUAL(cj.DumpU(), "{\"\\u00E6\\u00B5\\u008B\\u00E8\\u00AF\\u0095\":\"abc\"}");
+	UNIT_ASSERT_EQUAL(cj.DumpU(), "{\"\\u6D4B\\u8BD5\":\"abc\"}");
 
-	UNIT_ASSERT_EQUAL(j.Parse("{\"\\u00E6\\u00B5\\u008B\\u00E8\\u00AF\\u0095\":\"abc\"}"), true);
+	UNIT_ASSERT_EQUAL(j.Parse("{\"\\u6D4B\\u8bd5\":\"abc\"}"), true);
 	UNIT_ASSERT_EQUAL(cj.Dump(), "{\"测试\":\"abc\"}");
-	UNIT_ASSERT_EQUAL(cj.DumpU(), "{\"\\u00E6\\u00B5\\u008B\\u00E8\\u00AF\\u0095\":\"abc\"}");
+	UNIT_ASSERT_EQUAL(cj.DumpU(), "{\"\\u6D4B\\u8BD5\":\"abc\"}");
+
+	// code points of 1 to 4 bytes, surrogate pairs
+	UNIT_ASSERT(j.Parse("[\"\\u0041\\u00E9\\u20AC\\uD83D\\uDE00\"]", NULL, true));
+	UNIT_ASSERT_EQUAL(cj[0].AsString(), "A\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80");
+	UNIT_ASSERT_EQUAL(cj.DumpU(), "[\"A\\u00E9\\u20AC\\uD83D\\uDE00\"]");
+	UNIT_ASSERT(J(cj.DumpU()) == cj);
+	UNIT_ASSERT_EQUAL(J("\"\\u0000x\"").AsString(), std::string("\0x", 2));
+	UNIT_ASSERT(!j.Parse("\"\\u12\"", NULL, true));
+	UNIT_ASSERT(!j.Parse("\"\\uD83D\"", NULL, true)); // a lone surrogate
+	UNIT_ASSERT(!j.Parse("\"\\uDE00\\uD83D\"", NULL, true));
+	UNIT_ASSERT(j.Parse("\"\\uD83Dx\"")); // kept in its 3 byte form
+	UNIT_ASSERT_EQUAL(cj.AsString(), "\xED\xA0\xBDx");
+
+	// malformed UTF-8 fails strict parsing only
+	const char* malformed[] = {
+		"\"\x80\"", "\"a\xC3\"", "\"\xC0\xAF\"", "\"\xE0\x80\xAF\"", "\"\xED\xA0\x80\"",
+		"\"\xF4\x90\x80\x80\"", "\"\xF5\x80\x80\x80\"", "\"\xFF\"", "{\"\xE6\xB5\":1}",
+	};
+	for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i) {
+		UNIT_ASSERT(!j.Parse(malformed[i], NULL, true));
+		UNIT_ASSERT(j.Parse(malformed[i]));
+		const char* s = malformed[i];
+		UNIT_ASSERT(!Json::SkipValue(s));
+	}
+	UNIT_ASSERT(j.Parse("\"\xE6\xB5\x8B \xF4\x8F\xBF\xBF \xC2\x80\"", NULL, true));
+	std::vector<std::string> strings;
+	UNIT_ASSERT(!Json::ParseVector("[\"a\",\"\xFF\"]", strings, NULL, true));
+	UNIT_ASSERT_EQUAL(cj.DumpU(), "\"\\u6D4B \\uDBFF\\uDFFF \\u0080\"");
+
+	Json::SetUtf8Validation(false);
+	UNIT_ASSERT(!Json::Utf8Validation());
+	UNIT_ASSERT(j.Parse("\"\xFF\"", NULL, true));
+	UNIT_ASSERT_EQUAL(cj.DumpU(), "\"\\u00FF\"");
+	UNIT_ASSERT(j.Parse("\"\\uD83D\"", NULL, true));
+	Json::SetUtf8Validation(true);
+	UNIT_ASSERT(!j.Parse("\"\xFF\"", NULL, true));
 }
 
 UNIT_TEST(Json, Insert)
@@ -638,6 +850,148 @@ UNIT_TEST(Json, Erase)
 	UNIT_ASSERT_EQUAL(cj.Dump(), "{\"foo\":\"bar\",\"xyz\":[null,null,-3.14]}");
 }
 
+UNIT_TEST(Json, BigObject) // keys found through the hash index
+{
+	Json j;
+	char key[16];
+	for (int i = 0; i < 1000; ++i) {
+		snprintf(key, sizeof(key), "k%d", i);
+		j[key] = i;
+	}
+	UNIT_ASSERT_EQUAL(j.Size(), 1000);
+	UNIT_ASSERT_EQUAL(j["k0"].AsInt32(), 0);
+	UNIT_ASSERT_EQUAL(j["k999"].AsInt32(), 999);
+	UNIT_ASSERT(!j.Has("k1000"));
+	UNIT_ASSERT_EQUAL(j.Keys()[500], "k500"); // in insertion order
+
+	for (int i = 0; i < 1000; i += 2) {
+		snprintf(key, sizeof(key), "k%d", i);
+		j.Erase(key);
+	}
+	UNIT_ASSERT_EQUAL(j.Size(), 500);
+	UNIT_ASSERT(!j.Has("k500"));
+	UNIT_ASSERT_EQUAL(j["k501"].AsInt32(), 501);
+	j.Move("k999", 0);
+	j.Insert("new", Json("x"), 1);
+	UNIT_ASSERT_EQUAL(j.Keys()[0], "k999");
+	UNIT_ASSERT_EQUAL(j.Keys()[1], "new");
+	UNIT_ASSERT_EQUAL(j["new"].AsString(), "x");
+	UNIT_ASSERT_EQUAL(j["k999"].AsInt32(), 999);
+	UNIT_ASSERT_EQUAL(j["k1"].AsInt32(), 1);
+	UNIT_ASSERT_EQUAL(j.Begin()->AsInt32(), 999);
+
+	Json parsed = J(j.Dump());
+	UNIT_ASSERT(parsed == j);
+	UNIT_ASSERT_EQUAL(parsed["k777"].AsInt32(), 777);
+	Json copy = parsed;
+	copy["k777"] = 0;
+	UNIT_ASSERT_EQUAL(parsed["k777"].AsInt32(), 777);
+	UNIT_ASSERT_EQUAL(J("{\"a\":1,\"b\":2,\"a\":3}").Dump(), "{\"a\":3,\"b\":2}");
+}
+
+UNIT_TEST(Json, Key)
+{
+	static const JsonKey ID("id");
+	static const JsonKey NAME("name");
+	static const JsonKey MISSING("missing");
+	UNIT_ASSERT_EQUAL(ID.Name(), "id");
+
+	Json j = J("{\"id\":42,\"name\":\"foo\",\"tags\":[{\"id\":1},{\"id\":2}]}");
+	const Json& cj = j;
+	UNIT_ASSERT_EQUAL(cj[ID].AsInt32(), 42);
+	UNIT_ASSERT_EQUAL(cj.Sub(NAME).AsString(), "foo");
+	UNIT_ASSERT(cj.Has(ID));
+	UNIT_ASSERT(!cj.Has(MISSING));
+	UNIT_ASSERT_EQUAL(cj[MISSING].Type(), Json::TYPE_NULL);
+	UNIT_ASSERT_EQUAL(cj.Size(), 3);
+
+	std::vector<JsonKey> path;
+	path.push_back(JsonKey("tags"));
+	path.push_back(JsonKey("*"));
+	path.push_back(ID);
+	UNIT_ASSERT_EQUAL(cj.Query(path), J("[1,2]"));
+	path[1] = JsonKey("1");
+	UNIT_ASSERT_EQUAL(cj.Query(path), J("2"));
+	UNIT_ASSERT_EQUAL(cj.Query(std::vector<JsonKey>()), j);
+
+	j.Erase(NAME);
+	UNIT_ASSERT(!j.Has("name"));
+	Json k;
+	k[ID] = 1; // shares the key node
+	k[NAME] = "bar";
+	k[ID] = 2;
+	UNIT_ASSERT_EQUAL(k.Dump(), "{\"id\":2,\"name\":\"bar\"}");
+	UNIT_ASSERT_EQUAL(k["id"].AsInt32(), 2);
+	UNIT_ASSERT(k == J("{\"id\":2,\"name\":\"bar\"}"));
+	Json copy = k;
+	copy.SetPersistent(false);
+	copy.Erase(ID);
+	UNIT_ASSERT_EQUAL(k[ID].AsInt32(), 2);
+	UNIT_ASSERT_EQUAL(copy.Dump(), "{\"name\":\"bar\"}");
+}
+
+static void* ParseRecordsProc(void* arg)
+{
+	Json* records = static_cast<Json*>(arg);
+	records->Parse("[{\"id\":1,\"name\":\"a\"},{\"id\":2,\"name\":\"b\"}]", NULL, true);
+	return NULL; // the interned keys of the thread are released, not the ones in use
+}
+
+static void ParseLateProc(void* arg) // a thread-specific destructor run after the one of the key cache
+{
+	static_cast<Json*>(arg)->Parse("{\"late\":1,\"id\":3}", NULL, true);
+}
+
+static void* ParseAtExitProc(void* arg)
+{
+	static pthread_key_t key;
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	struct Key { static void Create() { pthread_key_create(&key, ParseLateProc); } };
+	pthread_once(&once, Key::Create);
+	Json first = J("{\"id\":1}"); // the key cache of the thread is created first
+	pthread_setspecific(key, arg);
+	return NULL;
+}
+
+UNIT_TEST(Json, InternedKeys)
+{
+	std::string text = "[";
+	for (int i = 0; i < 100; ++i) {
+		text += (i > 0 ? ",{\"id\":" : "{\"id\":") + Json(i).AsString() + ",\"name\":\"n\",\"ok\":true}";
+	}
+	text += "]";
+	Json records = J(text);
+	Json::Usage usage = records.MemoryUsage(); // 3 key nodes shared by 100 records
+	UNIT_ASSERT(usage.keys * 10 < usage.nodes);
+	Json built;
+	for (int i = 0; i < 100; ++i) {
+		built[i]["id"] = i;
+		built[i]["name"] = "n";
+		built[i]["ok"] = true;
+	}
+	UNIT_ASSERT(built == records);
+	UNIT_ASSERT_EQUAL(built.MemoryUsage().keys, usage.keys);
+
+	records[5]["id"] = -1; // keys are never modified through a record
+	records[6].Erase("name");
+	UNIT_ASSERT_EQUAL(records[4]["id"].AsInt32(), 4);
+	UNIT_ASSERT_EQUAL(records[7]["name"].AsString(), "n");
+	records.SetPersistent(false);
+	UNIT_ASSERT_EQUAL(records.MemoryUsage().keys, usage.keys - sizeof(Json));
+
+	Json parsed;
+	pthread_t thread;
+	UNIT_ASSERT_EQUAL(pthread_create(&thread, NULL, ParseRecordsProc, &parsed), 0);
+	pthread_join(thread, NULL);
+	UNIT_ASSERT_EQUAL(parsed.Dump(), "[{\"id\":1,\"name\":\"a\"},{\"id\":2,\"name\":\"b\"}]");
+	UNIT_ASSERT_EQUAL(parsed[1]["name"].AsString(), "b");
+
+	Json late;
+	UNIT_ASSERT_EQUAL(pthread_create(&thread, NULL, ParseAtExitProc, &late), 0);
+	pthread_join(thread, NULL);
+	UNIT_ASSERT_EQUAL(late.Dump(), "{\"late\":1,\"id\":3}");
+}
+
 UNIT_TEST(Json, Iterator)
 {
 	{
@@ -782,3 +1136,634 @@ UNIT_TEST(Json, QueryNonEmptyArray)
 	UNIT_ASSERT_EQUAL(j.Query("0"), J("{name:Alice,age:20}"));
 	UNIT_ASSERT_EQUAL(j.Query("*/*"), J("[Alice,20,Bob,25]"));
 }
+
+UNIT_TEST(Json, PersistentCopy)
+{
+	Json a = J("{x:{y:1},z:[1,2,3]}");
+	UNIT_ASSERT_EQUAL(a.IsPersistent(), false);
+
+	Json b = a;
+	const Json& ca = a;
+	const Json& cb = b;
+	UNIT_ASSERT(&ca["z"] != &cb["z"]); // deep copy by default
+
+	a.SetPersistent();
+	UNIT_ASSERT_EQUAL(a.IsPersistent(), true);
+
+	Json c = a;
+	const Json& cc = c;
+	UNIT_ASSERT(&ca["z"] == &cc["z"]); // shared
+	UNIT_ASSERT_EQUAL(c.IsPersistent(), true);
+
+	c["x"]["y"] = 2;
+	UNIT_ASSERT_EQUAL(a, J("{x:{y:1},z:[1,2,3]}"));
+	UNIT_ASSERT_EQUAL(c, J("{x:{y:2},z:[1,2,3]}"));
+	UNIT_ASSERT(&ca["z"][0] == &cc["z"][0]); // only the modified path is copied
+	UNIT_ASSERT(&ca["x"]["y"] != &cc["x"]["y"]);
+
+	c.Insert("w", Json(5));
+	c.Erase("z");
+	c["x"].Insert(Json("v"));
+	UNIT_ASSERT_EQUAL(a, J("{x:{y:1},z:[1,2,3]}"));
+	UNIT_ASSERT_EQUAL(c, J("{x:[v],w:5}"));
+
+	Json q = a.Query("z");
+	const Json& cq = q;
+	UNIT_ASSERT(&cq[0] == &ca["z"][0]);
+
+	a.SetPersistent(false);
+	Json d = a;
+	const Json& cd = d;
+	UNIT_ASSERT_EQUAL(d.IsPersistent(), false);
+	UNIT_ASSERT(&ca["z"] != &cd["z"]);
+	UNIT_ASSERT_EQUAL(d, J("{x:{y:1},z:[1,2,3]}"));
+}
+
+UNIT_TEST(Json, PersistentReference)
+{
+	Json a;
+	a.SetPersistent();
+	a["k"]["v"] = 1;
+	a["list"][1] = "x";
+
+	Json& k = a["k"];
+	Json b = a; // k is still referenced, so b must not share it
+	k["v"] = 2;
+	UNIT_ASSERT_EQUAL(a.Dump(), "{\"k\":{\"v\":2},\"list\":[null,\"x\"]}");
+	UNIT_ASSERT_EQUAL(b.Dump(), "{\"k\":{\"v\":1},\"list\":[null,\"x\"]}");
+	UNIT_ASSERT_EQUAL(b.IsPersistent(), true);
+	UNIT_ASSERT_EQUAL(b["k"].IsPersistent(), true);
+
+	for (Json::Iterator it = b.Begin(); it != b.End(); ++it) {
+		Json c = b;
+		*it = "changed";
+		UNIT_ASSERT(c != b);
+	}
+	UNIT_ASSERT_EQUAL(b.Dump(), "{\"k\":\"changed\",\"list\":\"changed\"}");
+
+	a.SetPersistent(); // forget about the references handed out before
+	Json c = a;
+	const Json& ca = a;
+	const Json& cc = c;
+	UNIT_ASSERT(&ca["k"] == &cc["k"]);
+}
+
+struct ConcurrentReadArgs
+{
+	const Json* json;
+	const Json* expected; // results computed by a single thread
+	int errors;
+};
+
+static void* ConcurrentReadProc(void* p)
+{
+	ConcurrentReadArgs* args = static_cast<ConcurrentReadArgs*>(p);
+	const Json& j = *args->json;
+	const Json& e = *args->expected;
+	for (int n = 0; n < 200; ++n) {
+		int errors = 0;
+		errors += (j.Dump() != e["dump"].AsString());
+		errors += (j.Format() != e["format"].AsString());
+		errors += (j.DumpU() != e["dumpu"].AsString());
+		errors += (j.Query("items/*/name") != e["names"]);
+		errors += (j["items"][1]["tags"][1].AsString() != "b");
+		errors += (j["items"][0]["price"].AsDouble() != 1.5);
+		errors += (j["count"].AsInt32() != 3 || j["count"].AsUint64() != 3);
+		errors += (j["ok"].AsBool() != true);
+		errors += (j["missing"]["deep"][7].Type() != Json::TYPE_NULL); // shared Null()
+		errors += (j.Sub(99).Type() != Json::TYPE_NULL);
+		errors += (j.Keys().size() != 4 || !j.Has("items") || j.HasAndNotEmpty("none"));
+		errors += (j != *args->json || !j.EqualTo(Json(j)));
+		size_t count = 0;
+		for (Json::ConstIterator it = j.Begin(); it != j.End(); ++it, ++count) {
+			errors += (it.Name() != j.Keys()[count] || &*it != &j[it.Name()]);
+		}
+		errors += (count != j.Size());
+		Json copy = j["items"]; // a persistent source is shared, others are copied
+		copy[0]["name"] = "changed";
+		errors += (j["items"][0]["name"].AsString() != "x");
+		args->errors += errors;
+	}
+	return NULL;
+}
+
+static void ConcurrentRead(const Json& j)
+{
+	Json expected;
+	expected["dump"] = j.Dump();
+	expected["format"] = j.Format();
+	expected["dumpu"] = j.DumpU();
+	expected["names"] = j.Query("items/*/name");
+
+	const size_t THREADS = 4;
+	pthread_t threads[THREADS];
+	ConcurrentReadArgs args[THREADS];
+	for (size_t i = 0; i < THREADS; ++i) {
+		args[i].json = &j;
+		args[i].expected = &expected;
+		args[i].errors = 0;
+		UNIT_ASSERT_EQUAL(pthread_create(&threads[i], NULL, ConcurrentReadProc, &args[i]), 0);
+	}
+	for (size_t i = 0; i < THREADS; ++i) {
+		pthread_join(threads[i], NULL);
+		UNIT_ASSERT_EQUAL(args[i].errors, 0);
+	}
+}
+
+// Build with -fsanitize=thread to let ThreadSanitizer check for data races
+UNIT_TEST(Json, ConcurrentRead)
+{
+	Json j = J("{items:[{name:x,price:1.5},{name:\"\u00E9y\",tags:[a,b]},{name:z}],"
+			"count:3,ok:true,text:\"line\\nbreak\"}");
+	ConcurrentRead(j);
+
+	j.SetPersistent();
+	ConcurrentRead(j);
+}
+
+static void CheckDumpParallel(const Json& j)
+{
+	UNIT_ASSERT_EQUAL(j.DumpParallel(4), j.Dump());
+	UNIT_ASSERT_EQUAL(j.DumpParallel(4, 1, " ", "\n", true), j.Dump(1, " ", "\n", true));
+	UNIT_ASSERT_EQUAL(j.FormatParallel(3), j.Format());
+	UNIT_ASSERT_EQUAL(j.DumpParallel(0), j.Dump());
+	UNIT_ASSERT_EQUAL(j.DumpParallel(1), j.Dump());
+}
+
+UNIT_TEST(Json, DumpParallel)
+{
+	Json big;
+	for (int i = 0; i < 5000; ++i) {
+		big[i] = (i % 3 == 0 ? Json(i) : Json("item\té"));
+	}
+	CheckDumpParallel(big);
+
+	Json doc;
+	doc["name"] = "doc";
+	doc["big"] = big;
+	doc["empty"] = Json();
+	doc["list"][0] = big;
+	doc["list"][1] = J("[]");
+	doc["list"][2] = big;
+	CheckDumpParallel(doc);
+
+	Json objects;
+	for (int i = 0; i < 600; ++i) {
+		objects[i]["id"] = i;
+		objects[i]["tags"] = J("[a,b,{c:d}]");
+		objects[i]["text"] = std::string(300, 'x'); // omitted by FormatParallel()
+	}
+	CheckDumpParallel(objects);
+
+	CheckDumpParallel(J("{a:[1,2,{b:c}]}"));
+	CheckDumpParallel(J("[]"));
+	CheckDumpParallel(Json("text"));
+	CheckDumpParallel(Json());
+}
+
+UNIT_TEST(Json, MaxDepth)
+{
+	UNIT_ASSERT_EQUAL(Json::MaxDepth(), 1024);
+	Json::SetMaxDepth(3);
+
+	Json j;
+	size_t pos = 0;
+	UNIT_ASSERT_EQUAL(j.Parse("[[[1]]]", &pos, true), true);
+	UNIT_ASSERT_EQUAL(j.Parse("{\"a\":[{\"b\":[]}]}", &pos, true), false);
+	UNIT_ASSERT_EQUAL(pos, 11);
+	UNIT_ASSERT_EQUAL(j.Parse("[[[[1]]]]", &pos), false);
+	UNIT_ASSERT_EQUAL(pos, 3);
+	UNIT_ASSERT_EQUAL(j.Parse("[[1],[2,[3]],{a:[4]}]", &pos), true);
+
+	Json::SetMaxDepth(1024);
+	UNIT_ASSERT_EQUAL(j.Parse("[[[[1]]]]", &pos), true);
+}
+
+static void AssertValidateAsParse(const std::string& text, bool strict)
+{
+	Json j;
+	size_t pos = 0;
+	bool parsed = j.Parse(text, &pos, strict);
+	Json::ErrorInfo error = { 0, 0, 0 };
+	UNIT_ASSERT_EQUAL(Json::Validate(text.data(), text.size(), strict, &error), parsed);
+	if (!parsed) {
+		UNIT_ASSERT_EQUAL(error.offset, pos);
+	}
+}
+
+UNIT_TEST(Json, Validate)
+{
+	const char* texts[] = {
+		"", " ", "null", "nul", "nullx", "true ", "[true,false,null]", "[1,2,]", "[3 4,5]", "[,,1,,]",
+		"{a:1 b:c}", "{\"a\":}", "{\"a\" 1}", "{\"a\":1,}", "[1}", "{\"a\":1]", "{,}", "[[]]", "[[]", "]",
+		"0", "-", "+1", ".5", "1.", "1e", "1e+5", "-1.5E-3x", "1x", "[1x]", "\"abc", "\"a\\\"b\"",
+		"\"\\x\"", "\"\\u12g4\"", "\"\\u1234\"", "\"\\uD83D\\uDE00\"", "\"\\uD83D\"", "\"\\uD83D\\u0041\"",
+		"\"\xE6\xB5\x8B\"", "\"\xE6\xB5\"", "\"\xFF\"", "abc", "a\\tb", "[a b]", "{\"a\":\"b\"} x", "[1] /* c */",
+		"/* c */ [1 /* ] */]", "[1 /* open", "{\"k\":{\"k\":[{\"k\":null}]}}", "[\"\xC3\"]", "{\"\xC3\":1}",
+	};
+	for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); ++i) {
+		std::string text = texts[i];
+		for (size_t size = 0; size <= text.size(); ++size) { // every prefix of it too
+			AssertValidateAsParse(text.substr(0, size), true);
+			AssertValidateAsParse(text.substr(0, size), false);
+		}
+	}
+	std::string document = "{\"a\":[1,-2.5e3,\"x\\n\\u00e9\xC3\xA9\"],\"b\":{\"c\":true,\"d\":null},\"e\":[]}";
+	const char bytes[] = "{}[]\",:\\ 1e.-ntu\x80\xC3";
+	for (size_t i = 0; i < document.size(); ++i) { // every byte replaced
+		for (size_t k = 0; k < sizeof(bytes) - 1; ++k) {
+			std::string text = document;
+			text[i] = bytes[k];
+			AssertValidateAsParse(text, true);
+			AssertValidateAsParse(text, false);
+		}
+	}
+
+	Json::ErrorInfo error = { 0, 0, 0 };
+	std::string text = "{\n  \"a\": [1, 2],\n  \"b\": tru\n}";
+	UNIT_ASSERT(!Json::Validate(text.data(), text.size(), true, &error));
+	UNIT_ASSERT_EQUAL(error.offset, 24);
+	UNIT_ASSERT_EQUAL(error.line, 3);
+	UNIT_ASSERT_EQUAL(error.column, 8);
+	UNIT_ASSERT(!Json::Validate("[1]", 2, true, &error)); // the text is bounded by its size
+	UNIT_ASSERT_EQUAL(error.offset, 2);
+	UNIT_ASSERT_EQUAL(error.column, 3);
+	UNIT_ASSERT(Json::Validate("[1]]", 3));
+	UNIT_ASSERT(!Json::Validate("[1]\0 ", 5));
+
+	Json::SetMaxDepth(3);
+	UNIT_ASSERT(Json::Validate("[[[1]]]", 7, true));
+	UNIT_ASSERT(!Json::Validate("{\"a\":[{\"b\":[]}]}", 16, true, &error));
+	UNIT_ASSERT_EQUAL(error.offset, 11);
+	Json::SetMaxDepth(5000); // beyond the levels kept on the stack
+	text = std::string(5000, '[') + std::string(5000, ']');
+	UNIT_ASSERT(Json::Validate(text.data(), text.size()));
+	text = "[" + text + "]";
+	UNIT_ASSERT(!Json::Validate(text.data(), text.size()));
+	Json::SetMaxDepth(1024);
+}
+
+static std::string Serialize(Json::Serializer& serializer, size_t capacity)
+{
+	std::vector<char> buffer(capacity);
+	std::string out;
+	while (!serializer.Done()) {
+		size_t size = serializer.Fill(&buffer[0], capacity);
+		UNIT_ASSERT(size == capacity || serializer.Done());
+		out.append(&buffer[0], size);
+	}
+	return out;
+}
+
+UNIT_TEST(Json, Serializer)
+{
+	Json doc = J("{\"a\":[1,{\"b\":\"x\\\"y\"},[],{}],\"c\":{\"d\":[[null]],\"e\":\"\xE6\xB5\x8B\"},\"f\":true}");
+	for (size_t capacity = 1; capacity < 64; capacity += 3) {
+		Json::Serializer dump(doc);
+		UNIT_ASSERT_EQUAL(Serialize(dump, capacity), doc.Dump());
+		Json::Serializer format(doc, 1, "\t", "\n", true);
+		UNIT_ASSERT_EQUAL(Serialize(format, capacity), doc.Dump(1, "\t", "\n", true));
+	}
+	Json::Serializer serializer(doc);
+	UNIT_ASSERT(!serializer.Done());
+	char buffer[4096];
+	UNIT_ASSERT_EQUAL(serializer.Fill(buffer, sizeof(buffer)), doc.Dump().size());
+	UNIT_ASSERT(serializer.Done());
+	UNIT_ASSERT_EQUAL(serializer.Fill(buffer, sizeof(buffer)), 0);
+
+	const char* scalars[] = { "null", "1.5", "\"s\"", "[]", "{}" };
+	for (size_t i = 0; i < sizeof(scalars) / sizeof(scalars[0]); ++i) {
+		Json j = J(scalars[i]);
+		Json::Serializer s(j, 0, "  ", "\n");
+		UNIT_ASSERT_EQUAL(Serialize(s, 2), j.Format(0, "  "));
+	}
+
+	std::string text = std::string(100000, '[') + std::string(100000, ']'); // no recursion
+	Json::SetMaxDepth(100000);
+	Json deep = J(text);
+	Json::SetMaxDepth(1024);
+	Json::Serializer d(deep);
+	UNIT_ASSERT_EQUAL(Serialize(d, 1000), text);
+}
+
+static std::string ReadFile(const std::string& filename)
+{
+	std::ifstream file(filename.c_str());
+	return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void WriteFile(const std::string& filename, const std::string& text)
+{
+	std::ofstream file(filename.c_str());
+	file << text;
+}
+
+static size_t CountFiles(const std::string& dir)
+{
+	size_t count = 0;
+	DIR* d = opendir(dir.c_str());
+	for (struct dirent* e = (d ? readdir(d) : NULL); e != NULL; e = readdir(d)) {
+		count += (e->d_name[0] != '.');
+	}
+	if (d) closedir(d);
+	return count;
+}
+
+UNIT_TEST(Json, Save)
+{
+	char temp[] = "/tmp/TestJson.XXXXXX";
+	UNIT_ASSERT(mkdtemp(temp) != NULL);
+	std::string root = temp;
+	std::string dir = root + "/a/b/c";
+	std::string file = dir + "/doc.json";
+	Json doc = J("{\"a\":[1,2,{\"b\":\"x\"}],\"long\":\"" + std::string(2000, 'y') + "\"}");
+
+	UNIT_ASSERT(!doc.Save(file)); // no directory
+	UNIT_ASSERT(doc.Save(file, Json::SAVE_CREATE_DIRECTORY));
+	UNIT_ASSERT_EQUAL(ReadFile(file), doc.Format(0, "\t", "\n", false, false) + "\n");
+	Json loaded;
+	UNIT_ASSERT(loaded.Load(file, true));
+	UNIT_ASSERT(loaded == doc);
+
+	chmod(file.c_str(), 0600); // kept when replaced
+	doc["a"] = 3;
+	UNIT_ASSERT(doc.Save(file, Json::SAVE_COMPACT | Json::SAVE_SYNC));
+	UNIT_ASSERT_EQUAL(ReadFile(file), doc.Dump() + "\n");
+	struct stat st;
+	UNIT_ASSERT(stat(file.c_str(), &st) == 0);
+	UNIT_ASSERT_EQUAL(st.st_mode & 0777, 0600);
+	UNIT_ASSERT_EQUAL(CountFiles(dir), 1); // no temporary file is left
+
+	std::string other = root + "/d/e.json";
+	UNIT_ASSERT(J("[]").Save(other, true));
+	UNIT_ASSERT_EQUAL(ReadFile(other), "[\n]\n");
+	UNIT_ASSERT(!doc.Save(other + "/f.json", true)); // a file in the path
+	UNIT_ASSERT(!doc.Save(dir)); // a directory
+	UNIT_ASSERT_EQUAL(CountFiles(dir), 1);
+
+	unlink(file.c_str());
+	unlink(other.c_str());
+	rmdir(dir.c_str());
+	rmdir((root + "/a/b").c_str());
+	rmdir((root + "/a").c_str());
+	rmdir((root + "/d").c_str());
+	UNIT_ASSERT(rmdir(root.c_str()) == 0);
+}
+
+UNIT_TEST(Json, LoadMany)
+{
+	char temp[] = "/tmp/TestJson.XXXXXX";
+	UNIT_ASSERT(mkdtemp(temp) != NULL);
+	std::string dir = temp;
+	std::vector<std::string> filenames;
+	for (int i = 0; i < 40; ++i) {
+		char name[32];
+		snprintf(name, sizeof(name), "/%02d.json", i);
+		filenames.push_back(dir + name);
+		Json doc;
+		doc["id"] = i;
+		doc["tags"].Insert(Json(std::string(i, 'x')));
+		UNIT_ASSERT(doc.Save(filenames.back()));
+	}
+	WriteFile(filenames[7], "{\"id\": 7,}"); // only valid when not strict
+	WriteFile(filenames[9], std::string("[1]\0x", 5));
+	WriteFile(dir + "/notes.txt", "not json");
+	filenames.push_back(dir + "/missing.json");
+
+	std::vector<Json::LoadResult> results;
+	Json::LoadStats stats;
+	UNIT_ASSERT_EQUAL(Json::LoadMany(filenames, results, 4, true, &stats), 38);
+	UNIT_ASSERT_EQUAL(results.size(), 41);
+	UNIT_ASSERT_EQUAL(stats.files, 41);
+	UNIT_ASSERT_EQUAL(stats.failed, 3);
+	uint64_t bytes = 0;
+	for (size_t i = 0; i < results.size(); ++i) {
+		UNIT_ASSERT_EQUAL(results[i].filename, filenames[i]);
+		UNIT_ASSERT_EQUAL(results[i].loaded, i != 7 && i != 9 && i != 40);
+		if (results[i].loaded) {
+			UNIT_ASSERT_EQUAL(results[i].json["id"].AsInt32(), static_cast<int32_t>(i));
+			UNIT_ASSERT_EQUAL(results[i].json["tags"][0].AsString().size(), i);
+			UNIT_ASSERT_EQUAL(results[i].bytes, ReadFile(filenames[i]).size());
+			UNIT_ASSERT(results[i].error.empty());
+		} else {
+			UNIT_ASSERT_EQUAL(results[i].json.Type(), Json::TYPE_NULL);
+		}
+		bytes += results[i].bytes;
+	}
+	UNIT_ASSERT_EQUAL(stats.bytes, bytes);
+	UNIT_ASSERT(stats.seconds >= 0 && stats.Throughput() >= 0);
+	UNIT_ASSERT_EQUAL(results[7].error, "invalid json format in file '" + filenames[7] + "'");
+	UNIT_ASSERT_EQUAL(results[9].error, "unexpected character after json in file '" + filenames[9] + "'");
+	UNIT_ASSERT_EQUAL(results[40].error, "cannot read input json file '" + filenames[40] + "'");
+
+	filenames.pop_back();
+	std::vector<Json::LoadResult> sequential;
+	UNIT_ASSERT_EQUAL(Json::LoadDirectory(dir, sequential, 1), 39); // sorted, without notes.txt
+	UNIT_ASSERT_EQUAL(sequential.size(), 40);
+	for (size_t i = 0; i < sequential.size(); ++i) {
+		UNIT_ASSERT_EQUAL(sequential[i].filename, filenames[i]);
+		UNIT_ASSERT(sequential[i].json == results[i].json || i == 7);
+	}
+	UNIT_ASSERT_EQUAL(sequential[7].json["id"].AsInt32(), 7);
+	UNIT_ASSERT_EQUAL(Json::LoadMany(std::vector<std::string>(), results, 0, false, &stats), 0);
+	UNIT_ASSERT(results.empty() && stats.files == 0);
+	stats.bytes = 1;
+	stats.seconds = 1;
+	UNIT_ASSERT_EQUAL(Json::LoadDirectory(dir + "/none", results, 0, false, &stats), 0);
+	UNIT_ASSERT_EQUAL(results.size(), 1);
+	UNIT_ASSERT_EQUAL(results[0].filename, dir + "/none");
+	UNIT_ASSERT(!results[0].loaded);
+	UNIT_ASSERT_EQUAL(results[0].error, "cannot open json directory '" + dir + "/none'");
+	UNIT_ASSERT(stats.files == 1 && stats.failed == 1 && stats.bytes == 0 && stats.seconds == 0);
+	UNIT_ASSERT_EQUAL(Json::LoadDirectory(dir + "/00.json", results), 0); // not a directory
+	UNIT_ASSERT(results.size() == 1 && !results[0].loaded);
+
+	for (size_t i = 0; i < filenames.size(); ++i) {
+		unlink(filenames[i].c_str());
+	}
+	unlink((dir + "/notes.txt").c_str());
+	UNIT_ASSERT(rmdir(dir.c_str()) == 0);
+}
+
+UNIT_TEST(Json, DeepDocument)
+{
+	const size_t DEPTH = 100000; // far beyond what recursion on the call stack could handle
+	std::string text = std::string(DEPTH, '[') + std::string(DEPTH, ']');
+	Json j;
+	UNIT_ASSERT_EQUAL(j.Parse(text), false);
+	Json::SetMaxDepth(DEPTH);
+	UNIT_ASSERT_EQUAL(j.Parse(text), true);
+	Json::SetMaxDepth(1024);
+	UNIT_ASSERT_EQUAL(j.Dump(), text);
+
+	Json deep; // built by hand, no depth limit applies
+	Json* p = &deep;
+	for (size_t i = 0; i < DEPTH; ++i) {
+		p = &(*p)[i % 2 == 0 ? "k" : "v"];
+	}
+	*p = 1;
+	Json copy = deep;
+	UNIT_ASSERT(copy == deep);
+	*p = 2;
+	UNIT_ASSERT(copy != deep);
+	UNIT_ASSERT_EQUAL(copy.Dump().size(), deep.Dump().size());
+	UNIT_ASSERT_EQUAL(copy.DumpParallel(2), copy.Dump());
+
+	copy.SetPersistent();
+	Json shared = copy;
+	UNIT_ASSERT(shared == copy);
+	copy.SetPersistent(false);
+	UNIT_ASSERT_EQUAL(copy.IsPersistent(), false);
+	copy.Clear();
+	j = deep;
+	deep.Clear();
+	UNIT_ASSERT_EQUAL(j.Dump().size(), 6 * DEPTH + 1); // {"k":...}
+}
+
+static size_t JsonAllocations()
+{
+	return static_cast<size_t>(Json::GetStats().allocations);
+}
+
+UNIT_TEST(Json, Allocations)
+{
+	if (Json::HasStats()) { // an instrumentation build, otherwise the allocations are not checked
+		UnitTest::SetAllocationCounter(JsonAllocations);
+	}
+	Json j(J("{\"a\":{\"b\":[1,2,3]},\"c\":\"d\"}"));
+	const Json& cj = j;
+	UNIT_ASSERT_MAX_ALLOCATIONS(cj[0], 0);
+	UNIT_ASSERT_MAX_ALLOCATIONS(cj["a"]["b"][2], 0);
+	UNIT_ASSERT_MAX_ALLOCATIONS(cj["x"], 0);
+	UNIT_ASSERT_MAX_ALLOCATIONS(cj.Size(), 0);
+
+	j.SetPersistent();
+	UNIT_ASSERT_MAX_ALLOCATIONS(Json(j).Type(), 0); // shared, not copied
+	UNIT_ASSERT_MAX_ALLOCATIONS(Json(cj["a"]).Type(), 0);
+	UnitTest::SetAllocationCounter(NULL);
+
+	if (Json::HasStats()) {
+		j.SetPersistent(false);
+		Json::ResetStats();
+		{
+			Json copy = j;
+		}
+		Json::Stats stats = Json::GetStats();
+		UNIT_ASSERT_EQUAL(stats.nodesCopied, 7); // the root and 6 values, the 3 interned keys are shared
+		UNIT_ASSERT_EQUAL(stats.nodesCreated, 7);
+		UNIT_ASSERT_EQUAL(stats.nodesDestroyed, 7);
+		UNIT_ASSERT_EQUAL(stats.stringCopies, 7);
+		UNIT_ASSERT(stats.allocations >= 7);
+		Json::ResetStats();
+		UNIT_ASSERT_EQUAL(j["c"].AsString(), "d");
+		UNIT_ASSERT_EQUAL(Json::GetStats().nodesCreated, 0);
+	}
+}
+
+UNIT_TEST(Json, MemoryUsage)
+{
+	Json j;
+	UNIT_ASSERT_EQUAL(j.MemoryUsage().Total(), 0);
+	for (int i = 0; i < 100; ++i) {
+		j += i;
+	}
+	j[100] = std::string(1000, 'x');
+	Json::Usage usage = j.MemoryUsage();
+	UNIT_ASSERT(usage.nodes > 0);
+	UNIT_ASSERT(usage.strings > 1000);
+	UNIT_ASSERT(usage.containers >= 101 * sizeof(Json));
+	UNIT_ASSERT(usage.slack > 0); // the array has grown by doubling
+	UNIT_ASSERT_EQUAL(usage.keys, 0);
+
+	Json copy = j;
+	copy.ShrinkToFit();
+	UNIT_ASSERT(copy == j);
+	Json::Usage shrunk = copy.MemoryUsage();
+	UNIT_ASSERT_EQUAL(shrunk.slack, 0);
+	UNIT_ASSERT_EQUAL(shrunk.Total(), usage.Total() - usage.slack);
+
+	Json o(J("{\"key\":1}"));
+	UNIT_ASSERT(o.MemoryUsage().keys > 0);
+
+	j.SetPersistent();
+	Json shared; // nodes of persistent copies are counted once
+	shared["a"] = j;
+	shared["b"] = j;
+	UNIT_ASSERT(shared.MemoryUsage().Total() < 2 * j.MemoryUsage().Total());
+	shared.ShrinkToFit(); // leaves the shared nodes alone
+	UNIT_ASSERT(j.MemoryUsage().slack > 0);
+}
+
+UNIT_TEST(Json, Deduplicate)
+{
+	const std::string text = "[{\"a\":[1,2,{\"x\":\"a string too long for any small string buffer\"}]},"
+		"{\"a\":[1,2,{\"x\":\"a string too long for any small string buffer\"}]},"
+		"{\"a\":[1,2]},\"a string too long for any small string buffer\",true,true,null,null]";
+	Json j = J(text);
+	size_t total = j.MemoryUsage().Total();
+	size_t saved = j.Deduplicate();
+	UNIT_ASSERT(saved > total / 3);
+	UNIT_ASSERT_EQUAL(j.MemoryUsage().Total(), total - saved);
+	UNIT_ASSERT(j.IsPersistent());
+	UNIT_ASSERT(j == J(text));
+	UNIT_ASSERT_EQUAL(j.Deduplicate(), 0);
+
+	j[1]["a"][0] = 5; // the shared nodes are copied on write
+	j[3] = "other";
+	UNIT_ASSERT_EQUAL(j[0]["a"][0].AsInt32(), 1);
+	UNIT_ASSERT_EQUAL(j[1]["a"][0].AsInt32(), 5);
+	UNIT_ASSERT_EQUAL(j[0]["a"][2]["x"].AsString(), "a string too long for any small string buffer");
+	UNIT_ASSERT_EQUAL(j[2]["a"].Dump(), "[1,2]");
+
+	j.SetPersistent();
+	Json copy = j; // shares the whole document, which is left alone
+	UNIT_ASSERT_EQUAL(copy.Deduplicate(), 0);
+	Json empty;
+	UNIT_ASSERT_EQUAL(empty.Deduplicate(), 0);
+
+	Json deep; // no recursion
+	Json* p = &deep;
+	for (int i = 0; i < 100000; ++i) {
+		p = &(*p)[0];
+	}
+	*p = 1;
+	Json twice;
+	twice[0] = deep;
+	twice[1] = deep;
+	total = twice.MemoryUsage().Total();
+	UNIT_ASSERT(twice.Deduplicate() >= total / 2 - 1000);
+	UNIT_ASSERT(twice[0] == twice[1]);
+}
+
+static const char BENCH_PAYLOAD[] = "{\"status\":\"ok\",\"page\":1,\"items\":["
+		"{\"id\":1,\"name\":\"alice\",\"tags\":[\"a\",\"b\"],\"score\":1.5},"
+		"{\"id\":2,\"name\":\"bob\",\"tags\":[],\"score\":-2e3},"
+		"{\"id\":3,\"name\":\"carol\\n\",\"tags\":[\"c\"],\"score\":0}]}";
+
+UNIT_BENCH(Json, ParsePayload)
+{
+	const std::string text = BENCH_PAYLOAD;
+	Json expected;
+	UNIT_ASSERT(expected.Parse(text, NULL, true)); // assertions inside the loop would be measured too
+	while (bench.Loop()) {
+		Json j;
+		UnitBench::DoNotOptimize(j.Parse(text, NULL, true));
+	}
+}
+
+UNIT_BENCH(Json, DumpPayload)
+{
+	const Json j = J(BENCH_PAYLOAD);
+	while (bench.Loop()) {
+		std::string text = j.Dump();
+		UnitBench::DoNotOptimize(text);
+	}
+}
+
+UNIT_BENCH(Json, SubByKey)
+{
+	const Json j = J(BENCH_PAYLOAD);
+	while (bench.Loop()) {
+		UnitBench::DoNotOptimize(j["items"][2]["name"]);
+	}
+}
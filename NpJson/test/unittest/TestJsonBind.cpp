@@ -0,0 +1,229 @@
+#include "JsonBind.h"
+#include "UnitTest.h"
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace bind_test {
+
+struct Endpoint
+{
+	std::string host;
+	uint16_t port;
+	Endpoint(): port(0) { }
+};
+NPJSON_BIND(Endpoint) { NPJSON_FIELD(host); NPJSON_FIELD(port); }
+
+struct Config
+{
+	std::string name;
+	int32_t workers;
+	int64_t limit;
+	double ratio;
+	bool enabled;
+	Endpoint listen;
+	std::vector<Endpoint> upstreams;
+	std::vector<int32_t> ports;
+	std::vector<bool> flags;
+	Config(): workers(0), limit(0), ratio(0), enabled(false) { }
+};
+NPJSON_BIND(Config)
+{
+	NPJSON_FIELD(name);
+	NPJSON_FIELD(workers);
+	NPJSON_FIELD(limit);
+	NPJSON_FIELD(ratio);
+	NPJSON_FIELD(enabled);
+	NPJSON_FIELD(listen);
+	NPJSON_FIELD(upstreams);
+	NPJSON_FIELD(ports);
+	NPJSON_FIELD(flags);
+}
+
+struct Numbers
+{
+	int8_t i8;
+	int16_t i16;
+	int32_t i32;
+	int64_t i64;
+	uint8_t u8;
+	uint16_t u16;
+	uint32_t u32;
+	uint64_t u64;
+	float f;
+	double d;
+};
+NPJSON_BIND(Numbers)
+{
+	NPJSON_FIELD(i8); NPJSON_FIELD(i16); NPJSON_FIELD(i32); NPJSON_FIELD(i64); NPJSON_FIELD(u8);
+	NPJSON_FIELD(u16); NPJSON_FIELD(u32); NPJSON_FIELD(u64); NPJSON_FIELD(f); NPJSON_FIELD(d);
+}
+
+struct Twice
+{
+	int32_t x;
+	Twice(): x(0) { }
+};
+NPJSON_BIND(Twice) { NPJSON_FIELD(x); NPJSON_FIELD(x); } // a copy-paste mistake
+
+}
+
+using bind_test::Config;
+using bind_test::Endpoint;
+using bind_test::Numbers;
+using bind_test::Twice;
+
+static const char CONFIG[] = "{\"name\":\"web \\\"1\\\"\",\"workers\":16,\"limit\":-9000000000,\"ratio\":0.25,"
+	"\"enabled\":true,\"listen\":{\"host\":\"0.0.0.0\",\"port\":8080},"
+	"\"upstreams\":[{\"host\":\"10.0.0.1\",\"port\":81},{\"host\":\"10.0.0.2\",\"port\":82}],"
+	"\"ports\":[1,2,3],\"flags\":[true,false,true]}";
+
+static void AssertConfig(const Config& c)
+{
+	UNIT_ASSERT_EQUAL(c.name, "web \"1\"");
+	UNIT_ASSERT_EQUAL(c.workers, 16);
+	UNIT_ASSERT_EQUAL(c.limit, -9000000000LL);
+	UNIT_ASSERT_EQUAL(c.ratio, 0.25);
+	UNIT_ASSERT(c.enabled);
+	UNIT_ASSERT_EQUAL(c.listen.host, "0.0.0.0");
+	UNIT_ASSERT_EQUAL(c.listen.port, 8080);
+	UNIT_ASSERT_EQUAL(c.upstreams.size(), 2);
+	UNIT_ASSERT_EQUAL(c.upstreams[1].host, "10.0.0.2");
+	UNIT_ASSERT_EQUAL(c.upstreams[1].port, 82);
+	UNIT_ASSERT_EQUAL(c.ports.size(), 3);
+	UNIT_ASSERT_EQUAL(c.ports[2], 3);
+	UNIT_ASSERT_EQUAL(c.flags.size(), 3);
+	UNIT_ASSERT(c.flags[0] && !c.flags[1] && c.flags[2]);
+}
+
+UNIT_TEST(JsonBind, FromJson)
+{
+	Config c;
+	JsonBind::FromJson(J(CONFIG), c);
+	AssertConfig(c);
+
+	Config d; // missing and null fields keep their value
+	d.workers = 4;
+	d.listen.port = 80;
+	JsonBind::FromJson(J("{\"workers\":null,\"listen\":{\"host\":\"h\"},\"other\":1}"), d);
+	UNIT_ASSERT_EQUAL(d.workers, 4);
+	UNIT_ASSERT_EQUAL(d.listen.host, "h");
+	UNIT_ASSERT_EQUAL(d.listen.port, 80);
+}
+
+UNIT_TEST(JsonBind, ToJson)
+{
+	Config c;
+	JsonBind::FromJson(J(CONFIG), c);
+	Json j = JsonBind::ToJson(c);
+	UNIT_ASSERT(j == J(CONFIG));
+
+	Config d;
+	JsonBind::FromJson(j, d);
+	AssertConfig(d);
+}
+
+UNIT_TEST(JsonBind, Parse)
+{
+	Config c;
+	UNIT_ASSERT(JsonBind::Parse(CONFIG, c));
+	AssertConfig(c);
+
+	Endpoint e; // whitespaces, unknown keys of any value, keys in any order
+	UNIT_ASSERT(JsonBind::Parse(" { \"extra\" : [1, {\"a\": [null, \"]\"]}, {}], \"port\" : 81 ,"
+		" \"more\": {\"x\": {\"y\": true}}, \"host\": \"h\" } ", e));
+	UNIT_ASSERT_EQUAL(e.host, "h");
+	UNIT_ASSERT_EQUAL(e.port, 81);
+
+	UNIT_ASSERT(JsonBind::Parse("{\"port\":null}", e));
+	UNIT_ASSERT_EQUAL(e.port, 81);
+	UNIT_ASSERT(JsonBind::Parse("{}", e));
+	UNIT_ASSERT(JsonBind::Parse("null", e));
+
+	size_t pos = 0;
+	UNIT_ASSERT(JsonBind::Parse("{\"port\":1} tail", e, &pos));
+	UNIT_ASSERT_EQUAL(pos, 11);
+	UNIT_ASSERT(!JsonBind::Parse("{\"port\":1} tail", e));
+	UNIT_ASSERT(!JsonBind::Parse("{\"port\":1", e));
+	UNIT_ASSERT(!JsonBind::Parse("{\"port\" 1}", e));
+	UNIT_ASSERT(!JsonBind::Parse("{port:1}", e));
+	UNIT_ASSERT(!JsonBind::Parse("{\"extra\":[1,}", e));
+	UNIT_ASSERT(!JsonBind::Parse("{\"extra\":{\"a\"}}", e));
+	UNIT_ASSERT(!JsonBind::Parse("[]", e));
+
+	Config d;
+	UNIT_ASSERT(!JsonBind::Parse("{\"ports\":[1,2}", d));
+	UNIT_ASSERT(!JsonBind::Parse("{\"listen\":{\"port\":}}", d));
+}
+
+UNIT_TEST(JsonBind, Dump)
+{
+	Config c;
+	UNIT_ASSERT(JsonBind::Parse(CONFIG, c));
+	std::string text = JsonBind::Dump(c);
+	UNIT_ASSERT_EQUAL(text, JsonBind::ToJson(c).Dump());
+	UNIT_ASSERT(J(text) == J(CONFIG));
+
+	Config d;
+	UNIT_ASSERT(JsonBind::Parse(text, d));
+	AssertConfig(d);
+
+	Endpoint e;
+	UNIT_ASSERT_EQUAL(JsonBind::Dump(e), "{\"host\":\"\",\"port\":0}");
+	UNIT_ASSERT_EQUAL(JsonBind::Dump(std::vector<Endpoint>()), "[]");
+}
+
+UNIT_TEST(JsonBind, NumberText) // the same text as the Json assignment operators
+{
+	double doubles[] = { 0, -0.5, 1e-7, 3.14159265, 1234567, 1e300, 100 };
+	for (size_t i = 0; i < sizeof(doubles) / sizeof(doubles[0]); ++i) {
+		std::string text;
+		Json::AppendValue(text, doubles[i]);
+		UNIT_ASSERT_EQUAL(text, Json(doubles[i]).Dump());
+	}
+	std::string text;
+	Json::AppendValue(text, static_cast<int8_t>(-128));
+	Json::AppendValue(text, static_cast<uint64_t>(18446744073709551615ULL));
+	Json::AppendValue(text, 1.5f);
+	UNIT_ASSERT_EQUAL(text, "-128184467440737095516151.5");
+}
+
+static bool SameAsConverted(const Numbers& n, const Json& value)
+{
+	return (n.i8 == value.AsInt8() && n.i16 == value.AsInt16() && n.i32 == value.AsInt32() &&
+			n.i64 == value.AsInt64() && n.u8 == value.AsUint8() && n.u16 == value.AsUint16() &&
+			n.u32 == value.AsUint32() && n.u64 == value.AsUint64() && n.f == value.AsFloat() &&
+			n.d == value.AsDouble());
+}
+
+UNIT_TEST(JsonBind, OutOfRange) // saturated as by As*(), not wrapped
+{
+	Json values(J("[5000000000,99999999999999999999,-99999999999999999999,-70000,-1,3.7,-3.7,1e999,-1e39,"
+		"\"-2147483649\",\"1e\",\"12abc\",\"0x10\",\"nan\"]"));
+	const char* names[] = { "i8", "i16", "i32", "i64", "u8", "u16", "u32", "u64", "f", "d" };
+	for (size_t i = 0; i < values.Size(); ++i) {
+		Json doc;
+		for (size_t k = 0; k < sizeof(names) / sizeof(names[0]); ++k) {
+			doc[names[k]] = values[i];
+		}
+		Numbers n;
+		JsonBind::FromJson(doc, n);
+		UNIT_ASSERT(SameAsConverted(n, values[i]));
+		Numbers parsed;
+		UNIT_ASSERT(JsonBind::Parse(doc.Dump(), parsed));
+		UNIT_ASSERT(SameAsConverted(parsed, values[i]));
+	}
+}
+
+UNIT_TEST(JsonBind, DuplicateField)
+{
+	pid_t pid = fork();
+	if (pid == 0) {
+		Twice t;
+		JsonBind::Parse("{\"x\":1}", t);
+		_exit(0);
+	}
+	int status = 0;
+	UNIT_ASSERT(pid > 0 && waitpid(pid, &status, 0) == pid);
+	UNIT_ASSERT(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+}
@@ -0,0 +1,163 @@
+#include "JsonCodec.h"
+#include "UnitTest.h"
+#include <cstdlib>
+#include <unistd.h>
+
+static Json Records(size_t count) // about 60 bytes of text each
+{
+	Json doc;
+	for (size_t i = 0; i < count; ++i) {
+		Json record;
+		record["id"] = static_cast<int64_t>(i);
+		record["name"] = std::string("record ") + static_cast<char>('a' + i % 26);
+		record["price"] = i * 0.25;
+		doc.Insert(record);
+	}
+	return doc;
+}
+
+static void WriteFile(const std::string& filename, const std::string& data)
+{
+	FILE* file = fopen(filename.c_str(), "wb");
+	fwrite(data.data(), 1, data.size(), file);
+	fclose(file);
+}
+
+static std::string ReadRaw(const std::string& filename) // without decompressing
+{
+	std::string data;
+	FILE* file = fopen(filename.c_str(), "rb");
+	char buffer[4096];
+	for (size_t n; file != NULL && (n = fread(buffer, 1, sizeof(buffer), file)) > 0; ) {
+		data.append(buffer, n);
+	}
+	if (file != NULL) fclose(file);
+	return data;
+}
+
+UNIT_TEST(JsonCodec, Detect)
+{
+	UNIT_ASSERT_EQUAL(JsonCodec::Detect("\x1F\x8B\x08", 3), JsonCodec::FORMAT_GZIP);
+	UNIT_ASSERT_EQUAL(JsonCodec::Detect("\x28\xB5\x2F\xFD", 4), JsonCodec::FORMAT_ZSTD);
+	UNIT_ASSERT_EQUAL(JsonCodec::Detect("\x28\xB5", 2), JsonCodec::FORMAT_NONE);
+	UNIT_ASSERT_EQUAL(JsonCodec::Detect("{}", 2), JsonCodec::FORMAT_NONE);
+	UNIT_ASSERT_EQUAL(JsonCodec::FromName("a.json.gz"), JsonCodec::FORMAT_GZIP);
+	UNIT_ASSERT_EQUAL(JsonCodec::FromName("a.zst"), JsonCodec::FORMAT_ZSTD);
+	UNIT_ASSERT_EQUAL(JsonCodec::FromName("a.gz.json"), JsonCodec::FORMAT_NONE);
+	UNIT_ASSERT(JsonCodec::Supported(JsonCodec::FORMAT_NONE));
+#ifdef NPJSON_ZLIB
+	UNIT_ASSERT(JsonCodec::Supported(JsonCodec::FORMAT_GZIP));
+#endif
+#ifdef NPJSON_ZSTD
+	UNIT_ASSERT(JsonCodec::Supported(JsonCodec::FORMAT_ZSTD));
+#endif
+}
+
+UNIT_TEST(JsonCodec, Plain)
+{
+	char temp[] = "/tmp/TestJsonCodec.XXXXXX";
+	UNIT_ASSERT(mkdtemp(temp) != NULL);
+	std::string file = std::string(temp) + "/doc.json";
+	WriteFile(file, "[1,\n2]\n");
+	std::string text = "old";
+	UNIT_ASSERT(JsonCodec::ReadFile(file, text));
+	UNIT_ASSERT_EQUAL(text, "[1,\n2]\n"); // as it is, line breaks included
+	UNIT_ASSERT(!JsonCodec::ReadFile(file + ".missing", text));
+
+	std::string gz = std::string(temp) + "/doc.json.gz";
+	std::string zst = std::string(temp) + "/doc.json.zst";
+	Json doc = Records(10);
+	UNIT_ASSERT_EQUAL(doc.Save(gz), JsonCodec::Supported(JsonCodec::FORMAT_GZIP));
+	UNIT_ASSERT_EQUAL(doc.Save(zst), JsonCodec::Supported(JsonCodec::FORMAT_ZSTD));
+	if (!JsonCodec::Supported(JsonCodec::FORMAT_GZIP)) {
+		UNIT_ASSERT(access(gz.c_str(), F_OK) != 0); // nothing written
+		WriteFile(gz, std::string("\x1F\x8B\x08\x00", 4));
+		Json loaded;
+		UNIT_ASSERT(!loaded.Load(gz));
+		JsonFileSink sink(gz);
+		UNIT_ASSERT(!sink.IsOpen());
+		UNIT_ASSERT(!sink.Write("[]", 2));
+		UNIT_ASSERT(!sink.Close());
+		UNIT_ASSERT_EQUAL(ReadRaw(gz), std::string("\x1F\x8B\x08\x00", 4)); // not truncated
+	}
+	unlink(file.c_str());
+	unlink(gz.c_str());
+	unlink(zst.c_str());
+	UNIT_ASSERT(rmdir(temp) == 0);
+}
+
+#if defined(NPJSON_ZLIB) || defined(NPJSON_ZSTD)
+static std::string Compress(JsonCodec::Format format, const std::string& text)
+{
+	JsonCodec codec(format, true);
+	std::string out;
+	UNIT_ASSERT(codec.Update(text.data(), text.size(), out) && codec.Finish(out));
+	return out;
+}
+
+static void TestFormat(JsonCodec::Format format, const std::string& file)
+{
+	Json doc = Records(50000); // a few MB, many chunks of the buffers
+	UNIT_ASSERT(doc.Save(file));
+	std::string text;
+	UNIT_ASSERT(JsonCodec::ReadFile(file, text));
+	UNIT_ASSERT_EQUAL(text, doc.Format(0, "\t", "\n", false, false) + "\n");
+	std::string compressed = Compress(format, text);
+	UNIT_ASSERT_EQUAL(JsonCodec::Detect(compressed.data(), compressed.size()), format);
+	UNIT_ASSERT(compressed.size() < text.size() / 4);
+	Json loaded;
+	UNIT_ASSERT(loaded.Load(file, true));
+	UNIT_ASSERT(loaded == doc);
+
+	{ // the streaming writer
+		JsonFileSink sink(file);
+		UNIT_ASSERT(sink.IsOpen());
+		JsonWriter writer(sink, 4096);
+		writer.StartArray();
+		for (size_t i = 0; i < doc.Size(); ++i) {
+			writer.Value(doc[i]);
+		}
+		writer.EndArray();
+		UNIT_ASSERT(writer.Flush());
+		UNIT_ASSERT(sink.Close());
+	}
+	UNIT_ASSERT(JsonCodec::ReadFile(file, text));
+	UNIT_ASSERT_EQUAL(text, doc.Dump());
+
+	std::string part = Compress(format, "[1,2,");
+	WriteFile(file, part + Compress(format, "3]")); // concatenated streams
+	UNIT_ASSERT(loaded.Load(file));
+	UNIT_ASSERT(loaded == J("[1,2,3]"));
+
+	WriteFile(file, part.substr(0, part.size() - 1)); // truncated
+	UNIT_ASSERT(!JsonCodec::ReadFile(file, text));
+	std::string corrupt = compressed;
+	for (size_t i = 20; i < corrupt.size(); i += 97) {
+		corrupt[i] = ~corrupt[i];
+	}
+	WriteFile(file, corrupt);
+	UNIT_ASSERT(!loaded.Load(file));
+
+	JsonCodec codec(format, false); // byte by byte
+	std::string out;
+	for (size_t i = 0; i < part.size(); ++i) {
+		UNIT_ASSERT(codec.Update(&part[i], 1, out));
+	}
+	UNIT_ASSERT(codec.Finish(out));
+	UNIT_ASSERT_EQUAL(out, "[1,2,");
+	unlink(file.c_str());
+}
+#endif
+
+UNIT_TEST(JsonCodec, Compressed)
+{
+	char temp[] = "/tmp/TestJsonCodec.XXXXXX";
+	UNIT_ASSERT(mkdtemp(temp) != NULL);
+#ifdef NPJSON_ZLIB
+	TestFormat(JsonCodec::FORMAT_GZIP, std::string(temp) + "/doc.json.gz");
+#endif
+#ifdef NPJSON_ZSTD
+	TestFormat(JsonCodec::FORMAT_ZSTD, std::string(temp) + "/doc.json.zst");
+#endif
+	UNIT_ASSERT(rmdir(temp) == 0);
+}
@@ -0,0 +1,164 @@
+#include "JsonReader.h"
+#include "UnitTest.h"
+
+static const char ORDER[] = "{\"id\": 42, \"customer\": {\"name\": \"Ann \\\"A\\\"\", \"tags\": [\"a\", {\"x\": \"]}\"}]},"
+	" \"items\": [{\"sku\": \"x1\", \"qty\": 2, \"price\": 9.5}, {\"sku\": \"x2\", \"qty\": 1, \"price\": 0.25}],"
+	" \"paid\": true, \"note\": null, \"total\": -18446744073709551615}";
+
+UNIT_TEST(JsonReader, Read)
+{
+	JsonReader reader(ORDER);
+	UNIT_ASSERT_EQUAL(reader.TokenType(), JsonReader::TOKEN_OBJECT);
+	UNIT_ASSERT(reader.EnterObject());
+	JsonReader::StringView key;
+	UNIT_ASSERT(reader.NextKey(key));
+	UNIT_ASSERT(key == "id");
+	UNIT_ASSERT_EQUAL(reader.TokenType(), JsonReader::TOKEN_NUMBER);
+	UNIT_ASSERT_EQUAL(reader.GetInt64(), 42);
+
+	UNIT_ASSERT(reader.NextKey(key) && key == "customer");
+	UNIT_ASSERT(reader.EnterObject());
+	UNIT_ASSERT(reader.NextKey(key) && key == "name");
+	UNIT_ASSERT_EQUAL(reader.GetString(), "Ann \"A\"");
+	UNIT_ASSERT(reader.NextKey(key) && key == "tags");
+	UNIT_ASSERT(reader.EnterArray());
+	UNIT_ASSERT(reader.Next());
+	JsonReader::StringView tag = reader.GetStringView();
+	UNIT_ASSERT(tag == "a" && tag != "b" && !tag.escaped);
+	UNIT_ASSERT(reader.Next());
+	UNIT_ASSERT_EQUAL(reader.TokenType(), JsonReader::TOKEN_OBJECT);
+	UNIT_ASSERT(!reader.Next()); // the unread object is skipped
+	UNIT_ASSERT_EQUAL(reader.TokenType(), JsonReader::TOKEN_END);
+	UNIT_ASSERT(!reader.NextKey(key));
+
+	UNIT_ASSERT(reader.NextKey(key) && key == "items");
+	UNIT_ASSERT(reader.EnterArray());
+	double total = 0;
+	while (reader.Next()) {
+		UNIT_ASSERT(reader.EnterObject());
+		int64_t qty = 0;
+		double price = 0;
+		while (reader.NextKey(key)) {
+			if (key == "qty") {
+				qty = reader.GetInt64();
+			} else if (key == "price") {
+				price = reader.GetDouble();
+			}
+		}
+		total += qty * price;
+	}
+	UNIT_ASSERT_EQUAL(total, 19.25);
+
+	UNIT_ASSERT(reader.NextKey(key) && key == "paid");
+	UNIT_ASSERT_EQUAL(reader.TokenType(), JsonReader::TOKEN_BOOL);
+	UNIT_ASSERT(reader.GetBool());
+	UNIT_ASSERT(reader.NextKey(key) && key == "note");
+	UNIT_ASSERT_EQUAL(reader.TokenType(), JsonReader::TOKEN_NULL);
+	reader.SkipValue();
+	UNIT_ASSERT(reader.NextKey(key) && key == "total");
+	UNIT_ASSERT_EQUAL(reader.GetDouble(), -18446744073709551615.0);
+	UNIT_ASSERT(!reader.NextKey(key));
+	UNIT_ASSERT(reader.Done());
+	UNIT_ASSERT(!reader.Failed());
+}
+
+UNIT_TEST(JsonReader, SkipValue)
+{
+	JsonReader reader(ORDER);
+	JsonReader::StringView key;
+	UNIT_ASSERT(reader.EnterObject());
+	std::vector<std::string> keys;
+	while (reader.NextKey(key)) {
+		keys.push_back(key.ToString());
+		reader.SkipValue();
+	}
+	UNIT_ASSERT(reader.Done());
+	UNIT_ASSERT_EQUAL(keys.size(), 6);
+	UNIT_ASSERT_EQUAL(keys[2], "items");
+
+	JsonReader root(" [1, [2, \"[\\\\\"], {\"a\": \"\\\"}\"}] ");
+	root.SkipValue();
+	UNIT_ASSERT(root.Done());
+	JsonReader scalar("\"x\" ");
+	scalar.SkipValue();
+	UNIT_ASSERT(scalar.Done());
+
+	JsonReader open("[1, [2, \"]\"]");
+	open.SkipValue();
+	UNIT_ASSERT(open.Failed());
+	UNIT_ASSERT_EQUAL(open.Error().offset, 12);
+	JsonReader quote("[\"a\\\"]");
+	quote.SkipValue();
+	UNIT_ASSERT(quote.Failed());
+}
+
+UNIT_TEST(JsonReader, Strings)
+{
+	JsonReader reader("[\"plain\", \"a\\u00e9\\n\", \"\xE6\xB5\x8B\", \"\xFF\"]");
+	UNIT_ASSERT(reader.EnterArray());
+	UNIT_ASSERT(reader.Next());
+	JsonReader::StringView view = reader.GetStringView();
+	UNIT_ASSERT_EQUAL(std::string(view.data, view.size), "plain");
+	UNIT_ASSERT(reader.Next());
+	view = reader.GetStringView();
+	UNIT_ASSERT(view.escaped);
+	UNIT_ASSERT_EQUAL(std::string(view.data, view.size), "a\\u00e9\\n");
+	UNIT_ASSERT(view == "a\xC3\xA9\n");
+	UNIT_ASSERT_EQUAL(view.ToString(), "a\xC3\xA9\n");
+	UNIT_ASSERT(reader.Next());
+	view = reader.GetStringView();
+	UNIT_ASSERT(!view.escaped && view == "\xE6\xB5\x8B");
+	UNIT_ASSERT(reader.Next());
+	UNIT_ASSERT_EQUAL(reader.GetStringView().size, 0); // not UTF-8
+	UNIT_ASSERT(reader.Failed());
+	UNIT_ASSERT_EQUAL(reader.Error().offset, 31);
+}
+
+UNIT_TEST(JsonReader, Errors)
+{
+	JsonReader mismatch("{\"a\": \"x\"}");
+	UNIT_ASSERT(!mismatch.EnterArray());
+	UNIT_ASSERT(mismatch.Failed());
+	UNIT_ASSERT_EQUAL(mismatch.TokenType(), JsonReader::TOKEN_ERROR);
+	JsonReader::StringView key;
+	UNIT_ASSERT(!mismatch.EnterObject());
+	UNIT_ASSERT(!mismatch.NextKey(key));
+
+	JsonReader type("{\"a\": \"x\"}");
+	UNIT_ASSERT(type.EnterObject() && type.NextKey(key));
+	UNIT_ASSERT_EQUAL(type.GetInt64(), 0);
+	UNIT_ASSERT(type.Failed());
+	UNIT_ASSERT_EQUAL(type.GetString(), ""); // nothing is read after a failure
+	UNIT_ASSERT_EQUAL(type.Error().offset, 6);
+
+	JsonReader separator("[1 2]");
+	UNIT_ASSERT(separator.EnterArray() && separator.Next());
+	UNIT_ASSERT_EQUAL(separator.GetInt64(), 1);
+	UNIT_ASSERT(!separator.Next());
+	UNIT_ASSERT(separator.Failed());
+	UNIT_ASSERT_EQUAL(separator.Error().offset, 3);
+
+	JsonReader trailing("[1,]");
+	UNIT_ASSERT(trailing.EnterArray() && trailing.Next() && trailing.Next());
+	UNIT_ASSERT_EQUAL(trailing.TokenType(), JsonReader::TOKEN_ERROR);
+
+	JsonReader tail("{}\n x");
+	UNIT_ASSERT(tail.EnterObject());
+	UNIT_ASSERT(!tail.NextKey(key));
+	UNIT_ASSERT(!tail.Done());
+	UNIT_ASSERT_EQUAL(tail.Error().line, 2);
+	UNIT_ASSERT_EQUAL(tail.Error().column, 2);
+
+	JsonReader unread("[1]");
+	UNIT_ASSERT(!unread.Done());
+	UNIT_ASSERT(!unread.Failed());
+	JsonReader symbol("truex");
+	UNIT_ASSERT(!symbol.GetBool());
+	UNIT_ASSERT(symbol.Failed());
+
+	Json::SetMaxDepth(2);
+	JsonReader deep("[[[1]]]");
+	UNIT_ASSERT(deep.EnterArray() && deep.Next() && deep.EnterArray() && deep.Next());
+	UNIT_ASSERT(!deep.EnterArray());
+	Json::SetMaxDepth(1024);
+}
@@ -0,0 +1,112 @@
+#include "JsonSnapshot.h"
+#include "UnitTest.h"
+
+UNIT_TEST(JsonSnapshot, Publish)
+{
+	JsonSnapshot snapshot(J("{version:1}"));
+	UNIT_ASSERT_EQUAL(snapshot.Get(), J("{version:1}"));
+	UNIT_ASSERT_EQUAL(snapshot.Get().IsPersistent(), true);
+
+	JsonSnapshot::Reader reader(snapshot);
+	{
+		JsonSnapshot::Guard guard(reader);
+		UNIT_ASSERT_EQUAL((*guard)["version"].AsInt32(), 1);
+
+		snapshot.Publish(J("{version:2}")); // the guarded version stays alive
+		UNIT_ASSERT_EQUAL(guard->Sub("version").AsInt32(), 1);
+		UNIT_ASSERT_EQUAL(snapshot.Retired(), 1);
+	}
+	{
+		JsonSnapshot::Guard guard(reader);
+		UNIT_ASSERT_EQUAL((*guard)["version"].AsInt32(), 2);
+	}
+
+	snapshot.Publish(J("{version:3}"));
+	UNIT_ASSERT_EQUAL(snapshot.Retired(), 0);
+	UNIT_ASSERT_EQUAL(snapshot.Get()["version"].AsInt32(), 3);
+}
+
+UNIT_TEST(JsonSnapshot, Reclaim)
+{
+	JsonSnapshot snapshot(J("{version:1}"));
+	JsonSnapshot::Reader reader(snapshot);
+	{
+		JsonSnapshot::Guard guard(reader);
+		snapshot.Publish(J("{version:2}"));
+		UNIT_ASSERT_EQUAL(snapshot.Reclaim(), 1); // still seen by the reader
+		UNIT_ASSERT_EQUAL(guard->Sub("version").AsInt32(), 1);
+	}
+	UNIT_ASSERT_EQUAL(snapshot.Retired(), 1); // no more updates to free it
+	UNIT_ASSERT_EQUAL(snapshot.Reclaim(), 0);
+	UNIT_ASSERT_EQUAL(snapshot.Retired(), 0);
+	UNIT_ASSERT_EQUAL(snapshot.Get()["version"].AsInt32(), 2);
+}
+
+UNIT_TEST(JsonSnapshot, TooManyReaders)
+{
+	JsonSnapshot snapshot(J("{version:1}"), 1);
+	JsonSnapshot::Reader reader(snapshot);
+	UNIT_ASSERT_EXCEPTION(JsonSnapshot::Reader(snapshot), const std::runtime_error&);
+	UNIT_ASSERT_EQUAL(snapshot.Get()["version"].AsInt32(), 1); // without a reader slot
+
+	JsonSnapshot none(J("{version:1}"), 0); // as 1
+	UNIT_ASSERT_EQUAL(none.Get()["version"].AsInt32(), 1);
+	JsonSnapshot::Reader first(none);
+	UNIT_ASSERT_EXCEPTION(JsonSnapshot::Reader(none), const std::runtime_error&);
+}
+
+struct SnapshotReaderArgs
+{
+	JsonSnapshot* snapshot;
+	int* stop;
+	long reads;
+	long errors;
+};
+
+static void* SnapshotReaderProc(void* p)
+{
+	SnapshotReaderArgs* args = static_cast<SnapshotReaderArgs*>(p);
+	JsonSnapshot::Reader reader(*args->snapshot);
+	while (!__atomic_load_n(args->stop, __ATOMIC_RELAXED)) {
+		JsonSnapshot::Guard guard(reader);
+		const Json& doc = *guard;
+		if (doc["version"].AsInt32() != doc["list"][doc["list"].Size() - 1].AsInt32()) {
+			++args->errors;
+		}
+		++args->reads;
+	}
+	return NULL;
+}
+
+UNIT_TEST(JsonSnapshot, ConcurrentReaders)
+{
+	JsonSnapshot snapshot(J("{version:0,list:[0]}"));
+	int stop = 0;
+	const size_t THREADS = 4;
+	pthread_t threads[THREADS];
+	SnapshotReaderArgs args[THREADS];
+	for (size_t i = 0; i < THREADS; ++i) {
+		args[i].snapshot = &snapshot;
+		args[i].stop = &stop;
+		args[i].reads = 0;
+		args[i].errors = 0;
+		pthread_create(&threads[i], NULL, SnapshotReaderProc, &args[i]);
+	}
+
+	Json doc = J("{version:0,list:[0]}");
+	doc.SetPersistent();
+	for (int32_t v = 1; v <= 1000; ++v) {
+		doc["version"] = v;
+		doc["list"] += v;
+		snapshot.Publish(doc);
+	}
+
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	for (size_t i = 0; i < THREADS; ++i) {
+		pthread_join(threads[i], NULL);
+		UNIT_ASSERT_EQUAL(args[i].errors, 0);
+	}
+	snapshot.Publish(doc);
+	UNIT_ASSERT_EQUAL(snapshot.Retired(), 0);
+	UNIT_ASSERT_EQUAL(snapshot.Get()["version"].AsInt32(), 1000);
+}
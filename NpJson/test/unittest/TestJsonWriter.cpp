@@ -0,0 +1,161 @@
+#include "JsonWriter.h"
+#include "UnitTest.h"
+
+static const char ORDER[] = "{\"id\":42,\"customer\":{\"name\":\"Ann \\\"A\\\"\",\"tags\":[\"a\",\"\\u6D4B\"],\"vip\":false},"
+	"\"items\":[{\"sku\":\"x1\",\"qty\":2,\"price\":9.5},{\"sku\":\"x2\",\"qty\":-1,\"price\":0.25}],"
+	"\"empty\":{},\"none\":[],\"note\":null}";
+
+static void WriteOrder(JsonWriter& writer)
+{
+	writer.StartObject();
+	writer.Key("id");
+	writer.Value(42);
+	writer.Key("customer");
+	writer.StartObject();
+	writer.Key(std::string("name"));
+	writer.Value("Ann \"A\"");
+	writer.Key("tags");
+	writer.StartArray();
+	writer.Value(std::string("a"));
+	writer.Value("\xE6\xB5\x8B");
+	writer.EndArray();
+	writer.Key("vip");
+	writer.Value(false);
+	writer.EndObject();
+	writer.Key("items");
+	writer.StartArray();
+	for (int i = 0; i < 2; ++i) {
+		writer.StartObject();
+		writer.Key("sku");
+		writer.Value(i == 0 ? "x1" : "x2");
+		writer.Key("qty");
+		writer.Value(static_cast<int64_t>(i == 0 ? 2 : -1));
+		writer.Key("price");
+		writer.Value(i == 0 ? 9.5 : 0.25);
+		writer.EndObject();
+	}
+	writer.EndArray();
+	writer.Key("empty");
+	writer.StartObject();
+	writer.EndObject();
+	writer.Key("none");
+	writer.StartArray();
+	writer.EndArray();
+	writer.Key("note");
+	writer.Null();
+	writer.EndObject();
+}
+
+UNIT_TEST(JsonWriter, Dump)
+{
+	std::string out = "prefix ";
+	JsonWriter writer(out);
+	UNIT_ASSERT(!writer.Complete());
+	WriteOrder(writer);
+	UNIT_ASSERT(writer.Complete());
+	UNIT_ASSERT_EQUAL(out, "prefix " + J(ORDER).Dump());
+
+	std::string unicode;
+	JsonWriter u(unicode, 0, "", "", true);
+	WriteOrder(u);
+	UNIT_ASSERT_EQUAL(unicode, J(ORDER).DumpU());
+
+	std::string scalar;
+	JsonWriter s(scalar);
+	s.Value(1.5f);
+	UNIT_ASSERT(s.Complete());
+	UNIT_ASSERT_EQUAL(scalar, "1.5");
+}
+
+UNIT_TEST(JsonWriter, Format)
+{
+	std::string out;
+	JsonWriter writer(out, 0, "\t", "\n");
+	WriteOrder(writer);
+	UNIT_ASSERT_EQUAL(out, J(ORDER).Format());
+
+	std::string indented;
+	JsonWriter w(indented, 2, "  ", "\n");
+	WriteOrder(w);
+	UNIT_ASSERT_EQUAL(indented, J(ORDER).Format(2, "  "));
+
+	std::string embedded; // a whole document as a value
+	JsonWriter e(embedded, 0, "\t", "\n");
+	e.StartArray();
+	e.Value(J(ORDER));
+	e.Value(Json());
+	e.EndArray();
+	Json doc;
+	doc.Insert(J(ORDER));
+	doc.Insert(Json());
+	UNIT_ASSERT_EQUAL(embedded, doc.Format());
+}
+
+UNIT_TEST(JsonWriter, Numbers)
+{
+	std::string out;
+	JsonWriter writer(out);
+	writer.StartArray();
+	writer.Value(static_cast<int8_t>(-128));
+	writer.Value(static_cast<uint8_t>(255));
+	writer.Value(static_cast<int16_t>(-32768));
+	writer.Value(static_cast<int32_t>(0));
+	writer.Value(static_cast<int64_t>(-9223372036854775807LL - 1));
+	writer.Value(static_cast<int64_t>(9223372036854775807LL));
+	writer.Value(static_cast<uint64_t>(18446744073709551615ULL));
+	writer.Value(static_cast<uint32_t>(4294967295U));
+	writer.Value(static_cast<int32_t>(-7));
+	writer.Value(100);
+	writer.Value(1e300);
+	writer.Value(true);
+	writer.EndArray();
+	UNIT_ASSERT_EQUAL(out, "[-128,255,-32768,0,-9223372036854775808,9223372036854775807,"
+		"18446744073709551615,4294967295,-7,100,1e+300,true]");
+	UNIT_ASSERT_EQUAL(J(out)[4].AsInt64(), -9223372036854775807LL - 1);
+}
+
+class StringSink: public JsonWriter::Sink
+{
+public:
+	StringSink(): writes(0), fail(false) { }
+	virtual bool Write(const char* data, size_t size)
+	{
+		text.append(data, size);
+		++writes;
+		return !fail;
+	}
+	std::string text;
+	size_t writes;
+	bool fail;
+};
+
+UNIT_TEST(JsonWriter, Sink)
+{
+	StringSink sink;
+	{
+		JsonWriter writer(sink, 16);
+		WriteOrder(writer);
+		UNIT_ASSERT(sink.writes > 5); // whenever 16 bytes are buffered
+		UNIT_ASSERT(sink.text.size() < J(ORDER).Dump().size());
+	}
+	UNIT_ASSERT_EQUAL(sink.text, J(ORDER).Dump()); // the rest when destroyed
+
+	StringSink large;
+	JsonWriter writer(large, 1 << 20, 0, "\t", "\n");
+	WriteOrder(writer);
+	UNIT_ASSERT_EQUAL(large.writes, 0);
+	UNIT_ASSERT(writer.Flush());
+	UNIT_ASSERT_EQUAL(large.writes, 1);
+	UNIT_ASSERT_EQUAL(large.text, J(ORDER).Format());
+	UNIT_ASSERT(writer.Flush()); // nothing to write
+
+	StringSink failing;
+	failing.fail = true;
+	JsonWriter w(failing, 4);
+	w.StartArray();
+	w.Value("abcdef");
+	w.Value(1);
+	w.EndArray();
+	UNIT_ASSERT(!w.Flush());
+	UNIT_ASSERT_EQUAL(failing.text, "[\"abcdef\",1]");
+}
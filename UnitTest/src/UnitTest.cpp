@@ -4,17 +4,33 @@
 #include <utility>
 #include <vector>
 #include <set>
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 
 int verbose = 0;
 
 const char * const SEP = "::";
 
+const size_t BENCH_REPETITIONS = 10;
+const double BENCH_MIN_TIME = 0.01; // seconds of each repetition
+const size_t BENCH_MAX_GROWTH = 100;
+const size_t BENCH_MAX_ITERATIONS = 1000000000; // of one repetition, however fast it is
+const double CASE_TIMEOUT = 300; // seconds of each case in a worker process
+const double BASELINE_TOLERANCE = 0.2;
+
 class UnitTestSystem
 {
 private:
-	UnitTestSystem(): tests_(0), assertions_(0) { }
+	UnitTestSystem(): tests_(0), benches_(0), assertions_(0),
+		measure_(false), repetitions_(BENCH_REPETITIONS), minTime_(BENCH_MIN_TIME), reporter_(NULL) { }
 public:
 	static UnitTestSystem& Instance()
 	{
@@ -22,26 +38,94 @@ public:
 		return unitTestSystem;
 	}
 
-	void Register(const std::string& pkg, const std::string& name, UnitTest::Proc proc)
+	void Register(const std::string& pkg, const std::string& name, UnitTest::Proc proc, UnitTest::BenchProc bench)
 	{
-		cases_.push_back(std::make_pair(pkg + SEP + name, proc));
+		Case c;
+		c.name = pkg + SEP + name;
+		c.proc = proc;
+		c.bench = bench;
+		cases_.push_back(c);
 	}
 
 	int Run(int argc, char *const argv[]);
 
 	void IncreaseAssertion() { ++assertions_; }
+	void SetReporter(UnitTestReporter* reporter) { reporter_ = reporter; }
 private:
-	std::vector<std::pair<std::string, UnitTest::Proc> > cases_;
+	struct Case
+	{
+		std::string name;
+		UnitTest::Proc proc;       // NULL for a benchmark
+		UnitTest::BenchProc bench;
+	};
+	struct Worker // process running a case
+	{
+		size_t index; // in the selected cases
+		pid_t pid;
+		FILE* out;
+		double start;
+		bool killed;
+	};
+	std::vector<Case> cases_;
 	size_t tests_;
+	size_t benches_;
 	size_t assertions_;
+	bool measure_;
+	size_t repetitions_;
+	double minTime_;
+	UnitTestReporter* reporter_;
+	std::vector<UnitTestResult> results_; // of the selected cases
+
+	UnitTestStats RunCase(const Case& c, bool selected);
+	void AddResult(const Case& c, const std::string& failure, const UnitTestStats& stats);
+	void PrintSummary() const;
+	int RunParallel(const std::vector<size_t>& selected, size_t jobs, double timeout,
+			const std::string& output, const std::string& baseline, double tolerance);
+	bool Report(const std::string& output, const std::string& baseline, double tolerance);
+	static void Measure(UnitTest::BenchProc proc, size_t repetitions, double minTime, UnitTestStats& stats);
 private:
 	UnitTestSystem(const UnitTestSystem&);  // disable copy
 	void operator = (const UnitTestSystem&);
 };
 
+void UnitTestReporter::Set(UnitTestReporter* reporter)
+{
+	UnitTestSystem::Instance().SetReporter(reporter);
+}
+
 UnitTest::UnitTest(const char* pkg, const char* name, Proc proc)
 {
-	UnitTestSystem::Instance().Register(pkg, name, proc);
+	UnitTestSystem::Instance().Register(pkg, name, proc, NULL);
+}
+
+UnitTest::UnitTest(const char* pkg, const char* name, BenchProc proc)
+{
+	UnitTestSystem::Instance().Register(pkg, name, NULL, proc);
+}
+
+static UnitTest::CounterProc s_allocationCounter = NULL;
+
+void UnitTest::SetAllocationCounter(CounterProc counter)
+{
+	s_allocationCounter = counter;
+}
+
+bool UnitTest::CountsAllocations()
+{
+	return (s_allocationCounter != NULL);
+}
+
+size_t UnitTest::Allocations()
+{
+	return (s_allocationCounter != NULL ? s_allocationCounter() : 0);
+}
+
+std::string UnitTest::AllocationMessage(size_t allocations, size_t max)
+{
+	std::ostringstream ss;
+	ss << "\n"
+		"allocations = " << allocations << " (at most " << max << ")" << std::endl;
+	return ss.str();
 }
 
 void UnitTest::Test(bool res, const char* file, int line,
@@ -61,43 +145,339 @@ void UnitTest::Test(bool res, const char* file, int line,
 	UnitTestSystem::Instance().IncreaseAssertion();
 }
 
+static double Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void GetUsage(double& cpu, long& maxRss)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+		usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+	maxRss = usage.ru_maxrss;
+}
+
+UnitBench::UnitBench(size_t iterations):
+	iterations_(iterations), remaining_(iterations), running_(false), start_(0), elapsed_(0), finished_(false)
+{
+}
+
+bool UnitBench::Loop()
+{
+	if (!running_) {
+		running_ = true;
+		start_ = Now();
+	}
+	if (remaining_ > 0) {
+		--remaining_;
+		return true;
+	}
+	if (!finished_) {
+		elapsed_ = Now() - start_;
+		finished_ = true;
+	}
+	return false;
+}
+
+static void RunBench(UnitTest::BenchProc proc, UnitBench& bench)
+{
+	proc(bench);
+	if (!bench.Finished()) { // its time would be meaningless
+		std::cout << " failed!\nthe unit bench returned before its bench.Loop() returned false" << std::endl;
+		exit(1);
+	}
+}
+
+void UnitTestSystem::Measure(UnitTest::BenchProc proc, size_t repetitions, double minTime, UnitTestStats& stats)
+{
+	size_t iterations = 1;
+	for (;;) { // calibrate the number of iterations of one repetition
+		UnitBench bench(iterations);
+		RunBench(proc, bench);
+		double elapsed = bench.Elapsed();
+		if (elapsed >= minTime || iterations >= BENCH_MAX_ITERATIONS) {
+			break;
+		}
+		size_t growth = (elapsed > 0 ? static_cast<size_t>(minTime * 1.2 / elapsed) + 1 : BENCH_MAX_GROWTH);
+		growth = std::min(std::max(growth, static_cast<size_t>(2)), BENCH_MAX_GROWTH);
+		iterations = (iterations > BENCH_MAX_ITERATIONS / growth ? BENCH_MAX_ITERATIONS : iterations * growth);
+	}
+	UnitBench warmup(iterations);
+	RunBench(proc, warmup);
+
+	std::vector<double> times; // ns per iteration of each repetition
+	for (size_t i = 0; i < repetitions; ++i) {
+		UnitBench bench(iterations);
+		RunBench(proc, bench);
+		times.push_back(bench.Elapsed() * 1e9 / iterations);
+	}
+	std::sort(times.begin(), times.end());
+	size_t n = times.size();
+	double median = (n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2);
+	double p99 = times[std::max(static_cast<size_t>(n * 0.99 + 0.999999), static_cast<size_t>(1)) - 1];
+
+	stats.iterations = iterations;
+	stats.median = median;
+	stats.min = times[0];
+	stats.p99 = p99;
+
+	char text[256];
+	snprintf(text, sizeof(text), " median %.1f ns, min %.1f ns, p99 %.1f ns (%lu x %lu iterations)",
+			median, times[0], p99, static_cast<unsigned long>(n), static_cast<unsigned long>(iterations));
+	std::cout << text << std::flush;
+}
+
+UnitTestStats UnitTestSystem::RunCase(const Case& c, bool selected)
+{
+	UnitTestStats stats;
+	memset(&stats, 0, sizeof(stats));
+	double cpu = 0;
+	long rss = 0;
+	GetUsage(cpu, rss);
+	double start = Now();
+	size_t assertions = assertions_;
+
+	std::cout << " > unit " << (c.proc != NULL ? "test" : "bench") << ": '" << c.name << "' " << std::flush;
+	if (!selected) {
+		std::cout << " passed!" << std::endl;
+	} else if (c.proc != NULL) {
+		(c.proc)();
+	} else if (measure_) {
+		Measure(c.bench, repetitions_, minTime_, stats);
+	} else {
+		UnitBench bench(1); // just make sure it works
+		RunBench(c.bench, bench);
+	}
+	++(c.proc != NULL ? tests_ : benches_);
+	if (!selected) {
+		return stats;
+	}
+
+	stats.wall = Now() - start;
+	GetUsage(stats.cpu, stats.rss);
+	stats.cpu -= cpu;
+	stats.rss -= rss;
+	stats.assertions = assertions_ - assertions;
+	char text[128];
+	snprintf(text, sizeof(text), " (wall %.3f ms, cpu %.3f ms, rss +%ld KB)",
+			stats.wall * 1e3, stats.cpu * 1e3, stats.rss);
+	std::cout << (c.proc != NULL || !measure_ ? " passed!" : "") << text << std::endl;
+	return stats;
+}
+
+void UnitTestSystem::AddResult(const Case& c, const std::string& failure, const UnitTestStats& stats)
+{
+	UnitTestResult result;
+	result.name = c.name;
+	result.bench = (c.proc == NULL);
+	result.failure = failure;
+	result.stats = stats;
+	results_.push_back(result);
+}
+
+void UnitTestSystem::PrintSummary() const
+{
+	std::cout << "All " << tests_ << " unit tests ";
+	if (benches_ > 0) {
+		std::cout << "and " << benches_ << " unit benches ";
+	}
+	std::cout << "(total " << assertions_ << " assertions) passed!\n";
+}
+
+/*
+ * Every case runs in a process of its own, at most 'jobs' at the same time, so
+ * that a failed assertion, a crash or a hang only affects that case. The output
+ * of a case is kept in a temporary file and printed once it has finished.
+ */
+int UnitTestSystem::RunParallel(const std::vector<size_t>& selected, size_t jobs, double timeout,
+		const std::string& output, const std::string& baseline, double tolerance)
+{
+	size_t size = std::max(selected.size(), static_cast<size_t>(1)) * sizeof(UnitTestStats);
+	void* shared = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	UnitTestStats* stats = static_cast<UnitTestStats*>(shared); // written by each worker when it passes
+
+	std::vector<Worker> workers;
+	std::vector<std::string> failures;
+	size_t next = 0;
+	while (next < selected.size() || !workers.empty()) {
+		while (workers.size() < jobs && next < selected.size()) {
+			Worker w;
+			w.index = next++;
+			w.out = tmpfile();
+			w.start = Now();
+			w.killed = false;
+			std::cout << std::flush;
+			w.pid = (w.out != NULL ? fork() : -1);
+			if (w.pid == 0) {
+				dup2(fileno(w.out), STDOUT_FILENO);
+				dup2(fileno(w.out), STDERR_FILENO);
+				stats[w.index] = RunCase(cases_[selected[w.index]], true);
+				std::cout << std::flush;
+				_exit(0);
+			} else if (w.pid < 0) { // no more cases are started, the running ones are still waited for
+				perror("cannot start a test process");
+				if (w.out != NULL) {
+					fclose(w.out);
+				}
+				for (size_t i = w.index; i < selected.size(); ++i) {
+					const Case& c = cases_[selected[i]];
+					failures.push_back(c.name + " not started");
+					memset(&stats[i], 0, sizeof(stats[i]));
+					AddResult(c, "not started", stats[i]);
+				}
+				next = selected.size();
+				break;
+			}
+			workers.push_back(w);
+		}
+
+		int status = 0;
+		pid_t pid = waitpid(-1, &status, WNOHANG);
+		if (pid <= 0) {
+			for (size_t i = 0; i < workers.size(); ++i) {
+				if (timeout > 0 && !workers[i].killed && Now() - workers[i].start > timeout) {
+					kill(workers[i].pid, SIGKILL);
+					workers[i].killed = true;
+				}
+			}
+			usleep(2000);
+			continue;
+		}
+
+		size_t k = 0;
+		while (k < workers.size() && workers[k].pid != pid) {
+			++k;
+		}
+		if (k == workers.size()) {
+			continue;
+		}
+		Worker w = workers[k];
+		workers.erase(workers.begin() + k);
+
+		const Case& c = cases_[selected[w.index]];
+		rewind(w.out);
+		char buffer[4096];
+		for (size_t n; (n = fread(buffer, 1, sizeof(buffer), w.out)) > 0; ) {
+			std::cout.write(buffer, n);
+		}
+		fclose(w.out);
+
+		std::ostringstream reason;
+		if (w.killed) {
+			reason << "timed out after " << timeout << " seconds";
+		} else if (WIFSIGNALED(status)) {
+			reason << "crashed (" << strsignal(WTERMSIG(status)) << ")";
+		} else if (WEXITSTATUS(status) != 0) {
+			reason << "failed";
+		}
+		if (reason.str().empty()) {
+			assertions_ += stats[w.index].assertions;
+			++(c.proc != NULL ? tests_ : benches_);
+		} else {
+			if (reason.str() != "failed") { // a failed assertion has printed the reason already
+				std::cout << " " << reason.str() << "!" << std::endl;
+			}
+			failures.push_back(c.name + " " + reason.str());
+			memset(&stats[w.index], 0, sizeof(stats[w.index]));
+			stats[w.index].wall = Now() - w.start;
+		}
+		AddResult(c, reason.str(), stats[w.index]);
+		std::cout << std::flush;
+	}
+	munmap(shared, size);
+
+	bool reported = Report(output, baseline, tolerance);
+	if (!failures.empty()) {
+		std::cout << failures.size() << " of " << selected.size() << " unit tests failed:\n";
+		for (size_t i = 0; i < failures.size(); ++i) {
+			std::cout << "    " << failures[i] << "\n";
+		}
+		return 1;
+	}
+	PrintSummary();
+	return (reported ? 0 : 1);
+}
+
+bool UnitTestSystem::Report(const std::string& output, const std::string& baseline, double tolerance)
+{
+	if (output.empty() && baseline.empty()) {
+		return true;
+	} else if (reporter_ == NULL) {
+		std::cout << "no unit test reporter is linked, cannot write or compare results\n";
+		return false;
+	}
+	return reporter_->Report(results_, output, baseline, tolerance);
+}
+
 int UnitTestSystem::Run(int argc, char *const argv[])
 {
 	std::set<std::string> args;
+	size_t jobs = 0;
+	double timeout = CASE_TIMEOUT;
+	std::string output;
+	std::string baseline;
+	double tolerance = BASELINE_TOLERANCE;
 	for (int i = 1; i < argc; ++i) {
 		if (argv[i][0] == '-') {
 			if (strcmp(argv[i], "-v") == 0) {
 				++verbose;
+			} else if (strcmp(argv[i], "-b") == 0) {
+				measure_ = true;
+			} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+				repetitions_ = std::max(atoi(argv[++i]), 1);
+			} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+				minTime_ = atof(argv[++i]);
+			} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+				jobs = std::max(atoi(argv[++i]), 1);
+			} else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) {
+				timeout = atof(argv[++i]);
+			} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+				output = argv[++i];
+			} else if (strcmp(argv[i], "-B") == 0 && i + 1 < argc) {
+				baseline = argv[++i];
+			} else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+				tolerance = atof(argv[++i]);
 			}
 		} else {
 			args.insert(argv[i]);
 		}
 	}
 
+	std::vector<size_t> selected;
 	for (size_t i = 0; i < cases_.size(); ++i) {
-		const std::string& fullname = cases_[i].first;
+		const std::string& fullname = cases_[i].name;
 		std::string pkg;
-		std::string name;
 		size_t pos = fullname.find(SEP);
 		if (pos != std::string::npos) {
 			pkg = fullname.substr(0, pos);
-			name = fullname.substr(pos + 2);
-		} else {
-			pkg = "";
-			name = fullname;
 		}
-		std::cout << " > unit test: '" << fullname << "' " << std::flush;
 		if (args.empty() || args.find(pkg) != args.end() ||
 				args.find(fullname) != args.end()) {
-			(cases_[i].second)();
+			selected.push_back(i);
 		}
-		++tests_;
+	}
+	if (jobs > 0) {
+		return RunParallel(selected, jobs, timeout, output, baseline, tolerance);
+	}
 
-		std::cout << " passed!" << std::endl;
+	for (size_t i = 0, k = 0; i < cases_.size(); ++i) {
+		bool isSelected = (k < selected.size() && selected[k] == i);
+		k += isSelected;
+		UnitTestStats stats = RunCase(cases_[i], isSelected);
+		if (isSelected) {
+			AddResult(cases_[i], "", stats);
+		}
 	}
-	std::cout << "All " << tests_ << " unit tests (total "
-			<< assertions_ << " assertions) passed!\n";
-	return 0;
+	PrintSummary();
+	return (Report(output, baseline, tolerance) ? 0 : 1);
 }
 
 int main(int argc, char * const argv[])
@@ -2,12 +2,29 @@
 #define __UNIT_TEST_H__
 
 #include <sstream>
+#include <string>
+#include <vector>
+#include <cstddef>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+class UnitBench;
 
 class UnitTest
 {
 public:
 	typedef void (*Proc)();
+	typedef void (*BenchProc)(UnitBench& bench);
+	typedef size_t (*CounterProc)();
 	UnitTest(const char* pkg, const char* name, Proc proc);
+	UnitTest(const char* pkg, const char* name, BenchProc proc);
+	// counter of the heap allocations made by the calling thread, provided by the
+	// code under test, UNIT_ASSERT_MAX_ALLOCATIONS() checks nothing without one
+	static void SetAllocationCounter(CounterProc counter);
+	static bool CountsAllocations();
+	static size_t Allocations();
+	static std::string AllocationMessage(size_t allocations, size_t max);
 	static void Test(bool res, const char* file, int line,
 			const char* func, const char* expr, const char* msg = "");
 	template <typename T, typename V>
@@ -29,6 +46,89 @@ void UnitTest::Test(T value, V expected, const char* file,
 	Test(res, file, line, func, expr, ss.str().c_str());
 }
 
+/*
+ * State of a micro benchmark, only the code inside 'while (bench.Loop()) { }'
+ * is measured. Without '-b' on the command line every benchmark runs a single
+ * iteration as a plain test, with it the number of iterations is calibrated and
+ * the median, min and p99 time of several repetitions are reported.
+ */
+class UnitBench
+{
+public:
+	UnitBench(size_t iterations);
+	bool Loop();
+	size_t Iterations() const { return iterations_; }
+	double Elapsed() const { return elapsed_; } // seconds spent in the loop
+	bool Finished() const { return finished_; } // whether Loop() has returned false
+
+	template <typename T>
+	static void DoNotOptimize(const T& value); // make the compiler believe value is used
+	static void ClobberMemory(); // make the compiler believe all memory is read and written
+private:
+	size_t iterations_;
+	size_t remaining_;
+	bool running_;
+	double start_;
+	double elapsed_;
+	bool finished_;
+};
+
+template <typename T>
+inline void UnitBench::DoNotOptimize(const T& value)
+{
+#if defined(__GNUC__)
+	__asm__ __volatile__("" : : "r,m"(value) : "memory");
+#else
+	static const void* volatile sink;
+	sink = &value;
+	ClobberMemory();
+#endif
+}
+
+inline void UnitBench::ClobberMemory()
+{
+#if defined(__GNUC__)
+	__asm__ __volatile__("" : : : "memory");
+#elif defined(_MSC_VER)
+	_ReadWriteBarrier();
+#endif
+}
+
+struct UnitTestStats // measured around a single case
+{
+	size_t assertions;
+	double wall;       // seconds
+	double cpu;        // seconds, user and system
+	long rss;          // growth of the peak resident set size, KB
+	size_t iterations; // per repetition of a measured benchmark, 0 otherwise
+	double median;     // ns per iteration of a measured benchmark
+	double min;
+	double p99;
+};
+
+struct UnitTestResult
+{
+	std::string name;
+	bool bench;
+	std::string failure; // empty if passed
+	UnitTestStats stats;
+};
+
+/*
+ * Receives the results of all selected cases at the end of a run, linking an
+ * implementation into the test program enables the '-o', '-B' and '-x' options.
+ */
+class UnitTestReporter
+{
+public:
+	virtual ~UnitTestReporter() { }
+	// output: file to write the results to, baseline: file of earlier results to compare
+	// with (both may be empty), returns false to fail the run, e.g. on a regression
+	virtual bool Report(const std::vector<UnitTestResult>& results, const std::string& output,
+			const std::string& baseline, double tolerance) = 0;
+	static void Set(UnitTestReporter* reporter);
+};
+
 #ifndef CONCAT
 #define CONCAT_(x, y) x##y
 #define CONCAT(x, y) CONCAT_(x, y)
@@ -39,6 +139,11 @@ void UnitTest::Test(T value, V expected, const char* file,
 	static UnitTest CONCAT(unitTest, __LINE__)(#Pkg, #Name, UnitTest_##Pkg##_##Name); \
 	void UnitTest_##Pkg##_##Name()
 
+#define UNIT_BENCH(Pkg, Name) \
+	void UnitBench_##Pkg##_##Name(UnitBench& bench); \
+	static UnitTest CONCAT(unitBench, __LINE__)(#Pkg, #Name, UnitBench_##Pkg##_##Name); \
+	void UnitBench_##Pkg##_##Name(UnitBench& bench)
+
 #define UNIT_ASSERT(exp) \
 	UnitTest::Test(exp, __FILE__, __LINE__, __FUNCTION__, #exp)
 
@@ -56,6 +161,16 @@ void UnitTest::Test(T value, V expected, const char* file,
 #define UNIT_ASSERT_ANY_EXCEPTION(expression) \
 	UNIT_ASSERT_EXCEPTION(expression, ...)
 
+#define UNIT_ASSERT_MAX_ALLOCATIONS(expression, max) \
+	do { \
+		size_t allocations = UnitTest::Allocations(); \
+		(expression); \
+		allocations = UnitTest::Allocations() - allocations; \
+		UnitTest::Test(!UnitTest::CountsAllocations() || allocations <= static_cast<size_t>(max), \
+				__FILE__, __LINE__, __FUNCTION__, #expression, \
+				UnitTest::AllocationMessage(allocations, max).c_str()); \
+	} while(0)
+
 #define UNIT_ASSERT_NO_EXCEPTION(expression) \
 	do { \
 		bool caught = false; \